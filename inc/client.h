@@ -7,6 +7,16 @@
 
 #include "debug_log.h"
 #include <pthread.h>
+#include <stdatomic.h>
+
+/*
+    Defines
+*/
+
+#define CLIENT_INPUT_SIZE       (64 * 1024)     /* 一行输入的最大长度，超过MSG_FRAME_DATA_MAX的公共消息作为流式帧发送 */
+#define CLIENT_STREAM_CHUNK     (64 * 1024)     /* 接收流式帧时每次读取的字节数 */
+#define CLIENT_FILE_RENAME_MAX  (100)           /* 收到的文件与已有文件重名时最多尝试的编号 */
+#define CLIENT_DOWNLOAD_DIR     "downloads"     /* 收到的文件保存在当前目录下的该子目录中，不存在时创建 */
 
 /*
     Typedefs
@@ -16,6 +26,8 @@ typedef struct client_s
 {
     int socket_fd;        /* 客户端socket文件描述符 */
     pthread_t thread_id;    /* 客户端子线程ID */
+    atomic_int version;     /* 服务器握手确认的帧格式版本，确认前为0，只发送旧格式帧 */
+    atomic_int caps;        /* 服务器握手确认的能力位，确认前为0 */
 }client_t;
 
 /*
@@ -63,15 +63,24 @@ typedef enum
     ERR_NO_MEMORY,      /* 内存不足 */
 
     ERR_THREAD_POOL_INIT = 100,     /* 线程池初始化失败 */
+    ERR_THREAD_POOL_FULL,           /* 线程池任务队列已满 */
 
     ERR_FILE_OPEN = 200,      /* 文件打开失败 */
+    ERR_FILE_WRITE,           /* 文件写入失败 */
 
     ERR_SERVER_INIT = 300,  /* 服务器初始化失败 */
     ERR_SERVER_NEW_CONNECT, /* 服务器新连接处理失败 */
+    ERR_SERVER_USER_EXIST,  /* 用户名已被占用 */
 
     ERR_CLIENT_INIT = 400,  /* 客户端初始化失败 */
     ERR_CLIENT_INPUT, /* 客户端输入处理失败 */
     ERR_CLIENT_RECEIVE, /* 客户端接收消息失败 */
+
+    ERR_PROTOCOL_FRAME = 500,   /* 帧格式非法 */
+    ERR_PROTOCOL_IO,            /* 帧收发失败 */
+    ERR_PROTOCOL_CLOSED,        /* 对端关闭连接 */
+
+    ERR_URING_INIT = 600,       /* io_uring初始化或提交失败 */
 }ERR_CODE;
 
 /*
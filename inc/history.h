@@ -0,0 +1,81 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/*
+    Include files
+*/
+
+#include <pthread.h>
+
+#include "debug_log.h"
+#include "msg_buf.h"
+
+/*
+    Typedefs
+*/
+
+/*
+    消息历史：在一块连续的环形缓冲区中按到达顺序保存最近的已编码帧，帧头即记录帧长，
+    空间或帧数超过上限时从最早的帧开始淘汰，内存上限在初始化时确定
+*/
+typedef struct history_s
+{
+    pthread_mutex_t mutex;  /* 保护环形缓冲区 */
+    char *arena;            /* 环形缓冲区，首次追加时申请 */
+    int cap;                /* 缓冲区字节数上限 */
+    int max_count;          /* 保留的帧数上限，0表示不保留历史 */
+    int head;               /* 最早一帧的起始偏移 */
+    int len;                /* 已用字节数 */
+    int count;              /* 保存的帧数 */
+}history_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    初始化消息历史，缓冲区在首次追加时申请
+    in          p_history       指向消息历史
+                max_count       保留的帧数上限，0表示不保留历史
+                cap             缓冲区字节数上限
+    out
+    ret         errCode
+*/
+ERR_CODE history_init(IN history_t *p_history, IN int max_count, IN int cap);
+
+/*
+    function    销毁消息历史，释放缓冲区
+    in          p_history       指向消息历史
+    out
+    ret
+*/
+void history_destroy(IN history_t *p_history);
+
+/*
+    function    追加一帧，按需淘汰最早的帧，超过缓冲区大小的帧不保存
+    in          p_history       指向消息历史
+                p_buf           已编码的完整帧，可为分段缓冲区
+    out
+    ret         errCode
+*/
+ERR_CODE history_append(IN history_t *p_history, IN msg_buf_t *p_buf);
+
+/*
+    function    追加一段连续内存中的完整帧，用于从日志恢复历史
+    in          p_history       指向消息历史
+                frame           已编码的完整帧
+                len             帧字节数
+    out
+    ret         errCode
+*/
+ERR_CODE history_append_frame(IN history_t *p_history, IN const char *frame, IN int len);
+
+/*
+    function    把保存的所有帧按顺序拷贝到一个缓冲区，回放时一次发送
+    in          p_history       指向消息历史
+    out
+    ret         缓冲区指针，没有历史或申请失败返回NULL
+*/
+msg_buf_t *history_snapshot(IN history_t *p_history);
+
+#endif
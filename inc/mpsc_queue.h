@@ -0,0 +1,62 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+/*
+    Include files
+*/
+
+#include <stdatomic.h>
+
+#include "debug_log.h"
+
+/*
+    Typedefs
+*/
+
+/* 队列节点，嵌入到元素结构体的首个成员 */
+typedef struct mpsc_node_s
+{
+    _Atomic(struct mpsc_node_s *) next;
+}mpsc_node_t;
+
+/*
+    无锁多生产者单消费者队列（侵入式链表）：生产者只做一次原子交换，不分配内存，
+    消费者独占队尾，不需要原子操作
+*/
+typedef struct mpsc_queue_s
+{
+    _Atomic(mpsc_node_t *) head;    /* 最近入队的节点，生产者竞争修改 */
+    mpsc_node_t *tail;              /* 下一个出队的节点，只由消费者访问 */
+    mpsc_node_t stub;               /* 哨兵节点，队列为空时head与tail指向它 */
+}mpsc_queue_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    队列初始化
+    in          p_queue         队列指针
+    out
+    ret         errCode
+*/
+ERR_CODE mpsc_queue_init(IN mpsc_queue_t *p_queue);
+
+/*
+    function    入队，任意线程可调用，无锁
+    in          p_queue         队列指针
+                p_node          待入队节点
+    out
+    ret
+*/
+void mpsc_queue_push(IN mpsc_queue_t *p_queue, IN mpsc_node_t *p_node);
+
+/*
+    function    出队，只能由唯一的消费者线程调用
+    in          p_queue         队列指针
+    out
+    ret         出队的节点，队列为空时返回NULL
+*/
+mpsc_node_t *mpsc_queue_pop(IN mpsc_queue_t *p_queue);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef MSG_BUF_H
+#define MSG_BUF_H
+
+/*
+    Include files
+*/
+
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "debug_log.h"
+
+/*
+    Defines
+*/
+
+#define MSG_BUF_SEG_MAX     (2)     /* 分段缓冲区最多引用的其他缓冲区数量 */
+#define MSG_BUF_VARIANT_MAX (3)     /* 每个缓冲区最多缓存的变体数量 */
+
+/*
+    Typedefs
+*/
+
+typedef struct msg_buf_s msg_buf_t;
+
+/* 分段，引用另一个缓冲区中的一段数据 */
+typedef struct msg_seg_s
+{
+    msg_buf_t *p_buf;   /* 被引用的缓冲区，不能是分段缓冲区，可以是文件缓冲区 */
+    int offset;         /* 数据在被引用缓冲区中的偏移 */
+    int len;            /* 数据长度 */
+}msg_seg_t;
+
+/* 引用计数的只读消息缓冲区，广播时所有接收者共享同一份已编码的帧 */
+struct msg_buf_s
+{
+    atomic_int refcnt;  /* 引用计数，为0时释放 */
+    int len;            /* 数据长度，分段缓冲区为data与所有分段的长度之和 */
+    int data_len;       /* data中的数据长度，位于所有分段之前 */
+    int seg_count;      /* 分段数量，0表示数据全部在data中 */
+    int file_fd;        /* 文件缓冲区的数据所在的文件，从偏移0开始共len字节，-1表示数据在内存中 */
+    msg_seg_t segs[MSG_BUF_SEG_MAX];    /* 按顺序接在data之后的分段，各持有被引用缓冲区的一个引用 */
+    _Atomic(msg_buf_t *) variants[MSG_BUF_VARIANT_MAX];  /* 同一内容的其他编码，首次需要时生成，各持有一个引用；指向自身时不持有引用 */
+    char data[];        /* 已编码的帧，发布后不再修改 */
+};
+
+/* 由缓冲区生成它的一个变体，返回新缓冲区，失败返回NULL；返回p_buf本身表示该编码与原缓冲区相同，不增加引用 */
+typedef msg_buf_t *(*msg_buf_build_t)(msg_buf_t *p_buf);
+
+/*
+    Function declarations
+*/
+
+/*
+    function    申请消息缓冲区，引用计数为1
+    in          len             数据长度
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+msg_buf_t *msg_buf_new(IN int len);
+
+/*
+    function    申请分段缓冲区，由data与其后的分段按顺序组成，分段只引用不拷贝
+    in          data            位于分段之前的数据，拷贝到缓冲区中
+                data_len        data长度
+                segs            分段，被引用的缓冲区各增加一个引用
+                seg_count       分段数量
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+msg_buf_t *msg_buf_gather(IN const char *data, IN int data_len, IN const msg_seg_t *segs, IN int seg_count);
+
+/*
+    function    申请文件缓冲区，数据留在文件中不读入内存，作为分段被引用，发送时由内核从文件直接发送
+    in          fd              文件描述符，由缓冲区接管，最后一个引用释放时关闭
+                len             文件字节数
+    out
+    ret         缓冲区指针，失败返回NULL，此时fd未关闭
+*/
+msg_buf_t *msg_buf_file(IN int fd, IN int len);
+
+/*
+    function    用缓冲区从offset开始的数据填写iovec，遇到文件中的数据即停止
+    in          p_buf           缓冲区指针
+                offset          起始偏移
+                max             iovec数组容量
+    out         iov             iovec数组
+    ret         填写的iovec数量，容量不足时只填写前max个
+*/
+int msg_buf_iov(IN msg_buf_t *p_buf, IN int offset, OUT struct iovec *iov, IN int max);
+
+/*
+    function    查询缓冲区在offset处的数据是否位于文件中
+    in          p_buf           缓冲区指针
+                offset          偏移
+    out         p_fd            数据所在的文件
+                p_file_offset   数据在文件中的偏移
+    ret         从offset开始连续位于该文件中的字节数，数据在内存中时返回0
+*/
+int msg_buf_file_at(IN msg_buf_t *p_buf, IN int offset, OUT int *p_fd, OUT off_t *p_file_offset);
+
+/*
+    function    统计缓冲区中位于文件中的字节数，这部分数据不占用内存
+    in          p_buf           缓冲区指针
+    out
+    ret         字节数
+*/
+int msg_buf_file_len(IN msg_buf_t *p_buf);
+
+/*
+    function    拷贝缓冲区从offset开始的数据，文件中的数据用pread读取
+    in          p_buf           缓冲区指针
+                offset          起始偏移
+                len             拷贝的字节数，超出缓冲区的部分不拷贝
+    out         buf             输出缓冲区
+    ret         拷贝的字节数，读文件失败返回-1
+*/
+int msg_buf_read(IN msg_buf_t *p_buf, IN int offset, OUT char *buf, IN int len);
+
+/*
+    function    取缓冲区在slot处缓存的变体，不存在时用build生成并发布；并发生成时只保留先发布的一份，
+                所有接收者共享，每个广播对每种编码最多生成一次；build返回p_buf本身时缓存的变体就是原缓冲区
+    in          p_buf           缓冲区指针
+                slot            变体编号，小于MSG_BUF_VARIANT_MAX，含义由调用者约定
+                build           变体生成函数
+    out
+    ret         变体指针，不增加引用，在p_buf释放前有效；生成失败返回NULL
+*/
+msg_buf_t *msg_buf_variant(IN msg_buf_t *p_buf, IN int slot, IN msg_buf_build_t build);
+
+/*
+    function    增加引用
+    in          p_buf           缓冲区指针
+    out
+    ret         缓冲区指针
+*/
+msg_buf_t *msg_buf_ref(IN msg_buf_t *p_buf);
+
+/*
+    function    释放引用，最后一个引用释放时回收内存
+    in          p_buf           缓冲区指针
+    out
+    ret
+*/
+void msg_buf_unref(IN msg_buf_t *p_buf);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef MSG_LOG_H
+#define MSG_LOG_H
+
+/*
+    Include files
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "debug_log.h"
+#include "msg_buf.h"
+
+/*
+    Defines
+*/
+
+#define MSG_LOG_RECORD_HEADER_SIZE  (8)     /* 记录头：4字节大端帧长 + 4字节大端CRC32 */
+#define MSG_LOG_PATH_SIZE           (256)   /* 日志目录与段文件路径长度上限 */
+#define MSG_LOG_SEGMENT_SUFFIX      ".log"  /* 段文件后缀，文件名为16位十进制段序号 */
+#define MSG_LOG_INDEX_SUFFIX        ".idx"  /* 稀疏索引文件后缀，与段文件同名 */
+#define MSG_LOG_INDEX_ENTRY_SIZE    (8)     /* 索引项：8字节大端段内偏移，指向一条记录的起始位置 */
+#define MSG_LOG_INDEX_INTERVAL      (64 * 1024)  /* 相邻索引项之间至少间隔的段内字节数 */
+
+/*
+    Typedefs
+*/
+
+/* 启动时映射的历史段，只读，服务器退出时解除映射 */
+typedef struct msg_log_segment_s
+{
+    long id;                    /* 段序号 */
+    const char *data;           /* 段文件映射，空文件为NULL */
+    long len;                   /* 段文件字节数，末尾可能是崩溃时写了一半的记录 */
+    const unsigned char *index; /* 稀疏索引映射，没有索引时为NULL */
+    long index_count;           /* 索引项数 */
+}msg_log_segment_t;
+
+/* 判断一帧是否为要恢复的记录，frame为完整的已编码帧 */
+typedef int (*msg_log_match_t)(const char *frame, int len, void *arg);
+
+/*
+    持久化消息日志：工作线程把已编码的帧连同记录头拷贝到待写缓冲区后立即返回，
+    专用写线程每个提交周期交换一次双缓冲区，整批数据一次write加一次fdatasync落盘，
+    段文件写满后滚动到下一个段，每次启动都从新的段开始写
+*/
+typedef struct msg_log_s
+{
+    pthread_t thread;           /* 写线程 */
+    pthread_mutex_t mutex;      /* 保护待写缓冲区与退出标志 */
+    pthread_cond_t cond;        /* 有待写记录或退出时唤醒写线程 */
+    pthread_cond_t space_cond;  /* 待写缓冲区腾空时唤醒等待的工作线程 */
+    char *pending;              /* 待写缓冲区，工作线程追加 */
+    char *writing;              /* 写缓冲区，只由写线程访问 */
+    int buf_cap;                /* 每个缓冲区的字节数 */
+    int pending_len;            /* 待写缓冲区已用字节数 */
+    int commit_ms;              /* 提交周期，毫秒，0表示有数据即提交 */
+    int stop;                   /* 退出标志，写线程写完剩余记录后退出 */
+    char dir[MSG_LOG_PATH_SIZE];    /* 日志目录 */
+    int fd;                     /* 当前段文件描述符 */
+    long segment_id;            /* 当前段序号 */
+    long segment_len;           /* 当前段已写字节数 */
+    long segment_max;           /* 段文件字节数上限，超过后滚动 */
+    int index_fd;               /* 当前段的稀疏索引文件描述符 */
+    long index_next;            /* 当前段中下一个索引项的最小偏移 */
+    msg_log_segment_t *segments;    /* 启动前已有的段，按序号升序映射，恢复历史时按需解析 */
+    int segment_count;          /* 已有段数 */
+    long record_count;          /* 已追加的记录数 */
+    long commit_count;          /* 提交次数，即fdatasync次数 */
+}msg_log_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    初始化消息日志：创建日志目录，映射已有的段与稀疏索引但不解析，打开序号最大的段之后的新段，启动写线程
+    in          p_log           指向消息日志
+                dir             日志目录，不存在时创建
+                segment_max     段文件字节数上限
+                buf_cap         待写缓冲区字节数，写线程落后时工作线程在此阻塞
+                commit_ms       提交周期，毫秒
+    out
+    ret         errCode
+*/
+ERR_CODE msg_log_init(IN msg_log_t *p_log, IN const char *dir, IN long segment_max, IN int buf_cap, IN int commit_ms);
+
+/*
+    function    销毁消息日志：通知写线程把剩余记录落盘后退出，关闭段文件，解除已有段的映射
+    in          p_log           指向消息日志
+    out
+    ret
+*/
+void msg_log_destroy(IN msg_log_t *p_log);
+
+/*
+    function    追加一帧：计算校验和并拷贝到待写缓冲区后返回，不等待落盘
+    in          p_log           指向消息日志
+                p_buf           已编码的完整帧，可为分段缓冲区
+    out
+    ret         errCode
+*/
+ERR_CODE msg_log_append(IN msg_log_t *p_log, IN msg_buf_t *p_buf);
+
+/*
+    function    从启动前已有的段中找出最近max_count条匹配的记录：按稀疏索引把段切成小块，从最新的块向前逐块解析，
+                找够即停止，不必解析整个日志；长度越界或校验和不符的记录及其后的数据视为崩溃时未写完，予以忽略
+    in          p_log           指向消息日志
+                match           匹配函数
+                arg             匹配函数参数
+                max_scan        最多解析的字节数，更早的记录不再恢复
+                max_count       最多返回的记录数
+    out         frames          按时间顺序的帧，指向映射的页面，消息日志销毁前有效
+                lens            各帧字节数
+    ret         找到的记录数
+*/
+int msg_log_recover(IN msg_log_t *p_log, IN msg_log_match_t match, IN void *arg, IN long max_scan, IN int max_count,
+                    OUT const char **frames, OUT int *lens);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef OBJ_POOL_H
+#define OBJ_POOL_H
+
+/*
+    Include files
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "debug_log.h"
+
+/*
+    Defines
+*/
+
+#define OBJ_POOL_MAX                    (8)   /* 可同时存在的对象池数量，每个线程为每个对象池保留一个本地缓存 */
+#define OBJ_POOL_ALIGN                  (16)  /* 对象大小按该值对齐 */
+#define OBJ_POOL_BATCH                  (32)  /* 线程本地缓存与全局仓库之间一次转移的对象数 */
+
+/*
+    Typedefs
+*/
+
+/* 空闲对象，链接指针直接存放在对象内存中 */
+typedef struct obj_free_s
+{
+    struct obj_free_s *next;        /* 同一批中的下一个空闲对象 */
+    struct obj_free_s *next_batch;  /* 仓库中的下一批，只在每批的首个对象中有效 */
+}obj_free_t;
+
+/* 对象池统计 */
+typedef struct obj_pool_stats_s
+{
+    long slab_count;        /* 已申请的slab数量 */
+    long obj_total;         /* slab中的对象总数 */
+    long alloc_count;       /* 累计分配次数，按批汇总，存在每线程不超过一批的滞后 */
+    long free_count;        /* 累计释放次数，按批汇总 */
+    long depot_objs;        /* 全局仓库中的空闲对象数 */
+    long transfer_count;    /* 线程本地缓存与全局仓库之间的转移次数 */
+}obj_pool_stats_t;
+
+/*
+    定长对象池：对象从按块申请的slab中切分，每个线程有本地空闲链表，分配与释放不加锁，
+    本地链表为空或过长时与全局仓库整批交换，适合一个线程分配、另一个线程释放的场景
+*/
+typedef struct obj_pool_s
+{
+    const char *name;           /* 对象池名称，用于统计输出 */
+    int obj_size;               /* 对象大小，已对齐 */
+    int slab_objs;              /* 每个slab中的对象数 */
+    unsigned long gen;          /* 对象池代号，全局唯一，线程本地缓存据此判断是否属于当前对象池 */
+
+    pthread_mutex_t mutex;      /* 保护仓库与slab链表 */
+    obj_free_t *depot;          /* 全局仓库，每批OBJ_POOL_BATCH个对象 */
+    long depot_batches;         /* 仓库中的批数 */
+    void *slabs;                /* slab链表，销毁时统一释放 */
+
+    atomic_long slab_count;     /* 统计：slab数量 */
+    atomic_long alloc_count;    /* 统计：分配次数 */
+    atomic_long free_count;     /* 统计：释放次数 */
+    atomic_long transfer_count; /* 统计：批量转移次数 */
+}obj_pool_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    对象池初始化
+    in          p_pool          对象池指针
+                name            对象池名称
+                obj_size        对象大小
+                slab_objs       每个slab中的对象数
+    out
+    ret         errCode
+*/
+ERR_CODE obj_pool_init(IN obj_pool_t *p_pool, IN const char *name, IN int obj_size, IN int slab_objs);
+
+/*
+    function    对象池销毁，释放所有slab，调用时不能再有线程使用对象池中的对象
+    in          p_pool          对象池指针
+    out
+    ret
+*/
+void obj_pool_destroy(IN obj_pool_t *p_pool);
+
+/*
+    function    分配一个对象，内容未初始化
+    in          p_pool          对象池指针
+    out
+    ret         对象指针，内存不足时返回NULL
+*/
+void *obj_pool_alloc(IN obj_pool_t *p_pool);
+
+/*
+    function    释放一个对象，可在任意线程释放
+    in          p_pool          对象池指针
+                p_obj           对象指针，可为NULL
+    out
+    ret
+*/
+void obj_pool_free(IN obj_pool_t *p_pool, IN void *p_obj);
+
+/*
+    function    获取对象池统计
+    in          p_pool          对象池指针
+    out         p_stats         统计
+    ret
+*/
+void obj_pool_stats(IN obj_pool_t *p_pool, OUT obj_pool_stats_t *p_stats);
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+    Include files
+*/
+
+#include <stdint.h>
+
+#include "debug_log.h"
+
+/*
+    Defines
+*/
+
+#define USER_NAME_SIZE                  (32)  /* 用户名大小 */
+#define ROOM_NAME_SIZE                  (32)  /* 房间名大小，房间名不含空格 */
+#define BUFFER_SIZE                     (1024) /* socket读写缓冲区大小 */
+
+/*
+    帧格式，所有多字节字段均为网络序，按字节编解码，与编译器和主机字节序无关：
+    版本帧：| 0x80|version(1B) | protocol(1B) | flags(1B) | length(varint 1~4B) | data(length B) |
+    旧格式：| protocol(1B) | length(3B) | data(length B) |
+    首字节最高位区分两种格式，接收方总能同时解析两种帧；发送方在注册握手确认对方版本后才发送版本帧
+    流式帧：数据超过MSG_FRAME_DATA_MAX的公共消息与文件只能以版本帧发送，接收方不整帧缓存，边收边转存或输出
+    压缩帧：带MSG_FLAG_COMPRESSED的版本帧，length为压缩后的长度，压缩前后都不超过MSG_FRAME_DATA_MAX，流式帧不压缩
+*/
+#define MSG_FRAME_VERSION               (1)     /* 本端支持的最高帧格式版本，0为旧格式 */
+#define MSG_FRAME_VERSIONED             (0x80)  /* 版本帧首字节的标志位，低7位为版本号 */
+#define MSG_FRAME_LEGACY_HEADER_SIZE    (4)     /* 旧格式帧头大小 */
+#define MSG_FRAME_VARINT_MAX            (4)     /* 长度字段最多字节数，每字节7位，低位在后 */
+#define MSG_FRAME_HEADER_MAX            (3 + MSG_FRAME_VARINT_MAX)  /* 帧头最大长度 */
+#define MSG_FRAME_DATA_MAX              (BUFFER_SIZE - MSG_FRAME_HEADER_MAX - 1)  /* 帧数据最大长度，保留结束符 */
+#define MSG_FRAME_SIZE_MAX              (MSG_FRAME_HEADER_MAX + MSG_FRAME_DATA_MAX)  /* 帧最大长度 */
+#define MSG_FRAME_STREAM_MAX            ((1 << (7 * MSG_FRAME_VARINT_MAX)) - 1)  /* 流式帧数据最大长度，即长度字段能表示的最大值 */
+#define MSG_FILE_NAME_MAX               (255)   /* 文件分享的文件名最大长度 */
+
+/* 可以作为流式帧发送的协议类型 */
+#define MSG_FRAME_STREAMABLE(protocol)  (MSG_TYPE_MSG == (protocol) || MSG_TYPE_FILE == (protocol))
+
+/* 帧标志 */
+#define MSG_FLAG_HANDSHAKE              (0x01)  /* 注册握手应答，数据为能力块 */
+#define MSG_FLAG_COMPRESSED             (0x02)  /* 数据经zlib压缩，只发送给握手时声明MSG_CAPS_COMPRESS的对端 */
+
+#define MSG_COMPRESS_MIN                (256)   /* 数据不少于该字节数时才尝试压缩，更短的消息压缩收益抵不过开销 */
+#define MSG_COMPRESS_LEVEL              (1)     /* zlib压缩级别，压缩在广播路径上，取最快的一级 */
+
+/*
+    注册握手：客户端以旧格式发送注册帧，数据为"用户名\0能力块"，不理解能力块的旧服务器只取到用户名；
+    服务器以带MSG_FLAG_HANDSHAKE的版本帧应答双方共同的能力块，之后双方都可以发送版本帧；
+    没有能力块的旧客户端不会收到应答，服务器只向它发送旧格式的帧
+    能力块：| version(1B) | caps(1B) |
+*/
+#define MSG_CAPS_SIZE                   (2)     /* 能力块大小 */
+#define MSG_CAPS_STREAM                 (0x01)  /* 能接收流式帧与文件分享 */
+#define MSG_CAPS_COMPRESS               (0x02)  /* 能接收压缩帧 */
+#define MSG_CAPS_SUPPORTED              (MSG_CAPS_STREAM | MSG_CAPS_COMPRESS)  /* 本端支持的能力位，新能力按位追加，未知的位由对端忽略 */
+
+/*
+    Typedefs
+*/
+
+typedef enum
+{
+    MSG_TYPE_MSG = 0,  /* 消息类型 */
+    MSG_TYPE_USER_REGISTER, /* 用户注册类型 */
+    MSG_TYPE_USER_OFFLINE, /* 用户下线类型 */
+    MSG_TYPE_USER_ONLINE,   /* 用户上线类型 */
+    MSG_TYPE_ROOM_JOIN,     /* 加入房间，数据为房间名；服务器以同类型通知房间成员 */
+    MSG_TYPE_ROOM_LEAVE,    /* 离开房间，数据为房间名；服务器以同类型通知房间成员 */
+    MSG_TYPE_ROOM_MSG,      /* 房间消息，数据为"房间名 消息"，只发送给房间成员 */
+    MSG_TYPE_DIRECT,        /* 私聊消息，数据为"用户名 消息"，只发送给该用户 */
+    MSG_TYPE_FILE,          /* 文件分享，数据为"文件名\0文件内容"；服务器转发的数据为"[用户名] 文件名\0文件内容" */
+}msg_type_t;
+
+/* 解码后的帧头 */
+typedef struct msg_header_s
+{
+    uint8_t version;        /* 帧格式版本，0表示旧格式 */
+    uint8_t flags;          /* 帧标志，旧格式为0 */
+    msg_type_t protocol;    /* 协议类型 */
+    int length;             /* 消息数据长度 */
+    int header_len;         /* 线上帧头字节数，数据紧随其后 */
+}msg_header_t;
+
+/* 服务器-客户端通信缓冲区结构 */
+typedef struct msg_s
+{
+    msg_header_t header;    /* 帧头 */
+    char data[MSG_FRAME_DATA_MAX + 1];  /* 消息数据，以'\0'结尾；流式帧只存放前MSG_FRAME_DATA_MAX字节 */
+}msg_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    编码帧头，数据由调用者另行接在帧头之后，可用于分段发送
+    in          version         帧格式版本，0为旧格式，旧格式不携带flags
+                protocol        协议类型
+                flags           帧标志
+                length          消息数据长度，可以作为流式帧发送的版本帧不超过MSG_FRAME_STREAM_MAX，其余不超过MSG_FRAME_DATA_MAX
+    out         buf             帧头输出缓冲区，至少MSG_FRAME_HEADER_MAX字节
+    ret         帧头长度，失败返回-1
+*/
+int msg_frame_header_encode(IN uint8_t version, IN msg_type_t protocol, IN uint8_t flags, IN int length, OUT char *buf);
+
+/*
+    function    编码帧，帧头后紧跟length字节数据
+    in          version         帧格式版本，0为旧格式
+                protocol        协议类型
+                data            消息数据，length为0时可为NULL
+                length          消息数据长度
+                size            输出缓冲区大小
+    out         buf             帧输出缓冲区
+    ret         帧长度，失败返回-1
+*/
+int msg_frame_encode(IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length, OUT char *buf, IN int size);
+
+/*
+    function    从字节流中解析一帧的帧头，两种格式均可解析，不拷贝数据，数据位于buf + header_len；
+                只读取帧头，判断整帧是否到齐只比较长度；帧头完整而数据不足时也填写帧头
+    in          buf             字节流
+                len             字节流长度
+    out         p_header        帧头，帧头不完整时不修改
+    ret         >0 整帧字节数，0 数据不足一帧，-1 帧非法
+*/
+int msg_frame_header_decode(IN const char *buf, IN int len, OUT msg_header_t *p_header);
+
+/*
+    function    从字节流中解码一帧，压缩帧解压后清除MSG_FLAG_COMPRESSED，length为解压后的长度
+    in          buf             字节流
+                len             字节流长度
+    out         p_msg           解码后的消息，data以'\0'结尾
+    ret         >0 消费的字节数，0 数据不足一帧，-1 帧非法
+*/
+int msg_frame_decode(IN const char *buf, IN int len, OUT msg_t *p_msg);
+
+/*
+    function    压缩消息数据
+    in          data            消息数据
+                length          数据长度
+                size            输出缓冲区大小
+    out         buf             压缩后的数据
+    ret         压缩后的长度，压缩失败或不比原数据短时返回-1，调用者应发送原数据
+*/
+int msg_data_compress(IN const char *data, IN int length, OUT char *buf, IN int size);
+
+/*
+    function    解压压缩帧的数据
+    in          data            压缩后的数据
+                length          压缩后的长度
+                size            输出缓冲区大小，解压后超过该大小视为帧非法
+    out         buf             解压后的数据
+    ret         解压后的长度，失败返回-1
+*/
+int msg_data_decompress(IN const char *data, IN int length, OUT char *buf, IN int size);
+
+/*
+    function    编码能力块
+    in          version         帧格式版本
+                caps            能力位
+    out         buf             至少MSG_CAPS_SIZE字节
+    ret         能力块长度
+*/
+int msg_caps_encode(IN uint8_t version, IN uint8_t caps, OUT char *buf);
+
+/*
+    function    解析能力块，只取已知的前MSG_CAPS_SIZE字节，能力块可能随版本增长
+    in          buf             能力块
+                len             能力块长度
+    out         p_version       帧格式版本
+                p_caps          能力位
+    ret         1 成功，0 长度不足
+*/
+int msg_caps_decode(IN const char *buf, IN int len, OUT uint8_t *p_version, OUT uint8_t *p_caps);
+
+/*
+    function    解析注册帧数据"用户名\0能力块"，没有能力块时按旧客户端处理
+    in          data            注册帧数据
+                length          数据长度
+    out         p_name_len      用户名长度
+                p_version       对端支持的最高帧格式版本，旧客户端为0
+                p_caps          对端能力位，旧客户端为0
+    ret         1 带能力块，0 旧格式注册
+*/
+int msg_register_decode(IN const char *data, IN int length, OUT int *p_name_len, OUT uint8_t *p_version, OUT uint8_t *p_caps);
+
+/*
+    function    阻塞发送一帧
+    in          fd              socket文件描述符
+                version         帧格式版本，0为旧格式
+                protocol        协议类型
+                data            消息数据
+                length          消息数据长度
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length);
+
+/*
+    function    阻塞发送一帧，数据不少于MSG_COMPRESS_MIN且压缩后更短时发送压缩帧，只用于对端声明了MSG_CAPS_COMPRESS的版本帧；
+                流式帧与其余情况同msg_frame_send
+    in          fd              socket文件描述符
+                version         帧格式版本
+                protocol        协议类型
+                data            消息数据
+                length          消息数据长度
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send_compressed(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length);
+
+/*
+    function    阻塞发送一个流式帧，帧数据由data与文件内容组成，文件内容由内核直接从文件发送到socket
+    in          fd              socket文件描述符
+                version         帧格式版本，必须为版本帧
+                protocol        协议类型
+                data            位于文件内容之前的数据
+                length          data长度
+                file_fd         文件描述符，从文件当前位置开始发送
+                file_len        发送的文件字节数
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send_file(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length,
+                             IN int file_fd, IN int file_len);
+
+/*
+    function    阻塞接收一帧，压缩帧解压后返回；流式帧只接收前MSG_FRAME_DATA_MAX字节数据，其余由调用者用msg_frame_recv_data分块接收
+    in          fd              socket文件描述符
+    out         p_msg           接收到的消息，data以'\0'结尾
+    ret         errCode，对端关闭返回ERR_PROTOCOL_CLOSED
+*/
+ERR_CODE msg_frame_recv(IN int fd, OUT msg_t *p_msg);
+
+/*
+    function    阻塞接收流式帧其余的数据
+    in          fd              socket文件描述符
+                len             接收的字节数
+    out         buf             接收缓冲区
+    ret         errCode，对端关闭返回ERR_PROTOCOL_CLOSED
+*/
+ERR_CODE msg_frame_recv_data(IN int fd, OUT char *buf, IN int len);
+
+#endif
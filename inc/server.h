@@ -6,8 +6,16 @@
 */
 
 #include "thread_pool.h"
+#include "protocol.h"
+#include "msg_buf.h"
+#include "mpsc_queue.h"
+#include "obj_pool.h"
+#include "uring.h"
+#include "history.h"
+#include "msg_log.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -21,53 +29,276 @@
 
 /* 线程池参数 */
 #define SERVER_THREAD_POOL_SIZE         (5)   /* 服务器线程池大小 */
-#define SERVER_THREAD_TASK_QUEUE_SIZE   (10)  /* 服务器线程池任务队列大小 */
+#define SERVER_THREAD_TASK_QUEUE_SIZE   (4096)  /* 服务器线程池任务队列大小，队列满时由reactor自行处理任务 */
 
 /* 服务器最大连接限制 */
-#define SERVER_CONNECT_SIZE             (5)
+#define SERVER_LISTEN_BACKLOG           (4096)  /* 默认监听队列长度，实际长度受net.core.somaxconn限制 */
+#define SERVER_CONNECT_TABLE_MAX        (65536)  /* 连接表容量上限，实际容量取RLIMIT_NOFILE与该值的较小者 */
 
 /* socket相关参数 */
 #define SERVER_PORT                     (9090) /* 服务器监听端口 */
-#define USER_NAME_SIZE               (32)  /* 用户名大小 */
-#define BUFFER_HEADER_SIZE              (32)  /* 消息头部大小 */
-#define BUFFER_SIZE                     (1024) /* socket读写缓冲区大小 */
+
+/* reactor参数 */
+#define SERVER_REACTOR_COUNT            (1)   /* 默认reactor数量，多于1个时各reactor通过SO_REUSEPORT监听同一端口 */
+#define SERVER_REACTOR_MAX              (64)  /* reactor数量上限 */
 
 /* epoll相关参数 */
 #define SERVER_EPOLL_EVENT_SIZE         (10)  /* epoll事件数量 */
 
+/* 连接读缓冲区参数 */
+#define SERVER_READ_BUFFER_SIZE         (4096)  /* 读缓冲区初始大小，不足时按倍数扩容 */
+
+/* 连接发送队列参数 */
+#define SERVER_OUT_QUEUE_LIMIT          (1024 * 1024)  /* 单连接待发送字节上限，超过则断开慢连接 */
+#define SERVER_OUT_QUEUE_SIZE           (16)  /* 发送队列初始容量，不足时按倍数扩容 */
+#define SERVER_OUT_IOV_MAX              (64)  /* 一次聚合发送的最大缓冲区数量 */
+#define SERVER_OUT_FILE_FACTOR          (4)   /* 单连接待发送的暂存文件字节上限，为单个流式帧上限的倍数，超过则断开慢连接 */
+
+/* 流式帧参数，暂存文件为memfd，占用内存 */
+#define SERVER_UPLOAD_MAX               (16 * 1024 * 1024)  /* 默认单个流式帧的字节数上限，超过的帧被丢弃 */
+#define SERVER_UPLOAD_CONCURRENCY       (8)   /* 默认同时暂存中的流式帧数量上限，已满时新的流式帧被丢弃 */
+
+/* io_uring后端参数 */
+#define SERVER_URING_ENTRIES            (1024)  /* 提交队列长度 */
+#define SERVER_URING_BUF_COUNT          (512)   /* 每个reactor注册的接收缓冲区数量，2的幂 */
+#define SERVER_URING_BUF_SIZE           (4096)  /* 接收缓冲区大小 */
+
+/* 房间参数 */
+#define SERVER_ROOM_BUCKETS             (4096)  /* 房间注册表哈希桶数量，2的幂 */
+#define SERVER_ROOM_PER_CONNECT         (16)  /* 单连接可加入的房间数上限 */
+#define SERVER_ROOM_MEMBERS_SIZE        (4)   /* 房间在单个reactor上的成员数组初始容量，不足时按倍数扩容 */
+
+/* 消息历史参数，公共消息与每个房间各保留一份 */
+#define SERVER_HISTORY_COUNT            (32)  /* 默认保留的消息数，新用户注册或加入房间时回放 */
+#define SERVER_HISTORY_BYTES            (16 * 1024)  /* 默认每份历史的缓冲区字节数上限 */
+
+/* 帧编码相关定义 */
+#define SERVER_FRAME_VARIANT_LEGACY     (0)   /* 帧缓冲区缓存旧格式编码的变体编号，发给旧客户端时按需生成一次 */
+#define SERVER_FRAME_VARIANT_BRIEF      (1)   /* 流式帧缓存简短文本变体的编号，发给不支持流式帧的客户端 */
+#define SERVER_FRAME_VARIANT_COMPRESSED (2)   /* 帧缓冲区缓存压缩变体的编号，发给支持压缩的客户端，压缩不划算时即为原缓冲区 */
+
+/* 消息日志相关定义 */
+#define SERVER_LOG_SEGMENT_BYTES        (64 * 1024 * 1024)  /* 日志段文件字节数上限 */
+#define SERVER_LOG_BUFFER_SIZE          (4 * 1024 * 1024)   /* 日志待写缓冲区字节数 */
+#define SERVER_LOG_COMMIT_MS            (10)  /* 默认日志提交周期，毫秒 */
+#define SERVER_LOG_RECOVER_BYTES        (64 * 1024 * 1024)  /* 恢复一份消息历史时最多向前解析的日志字节数 */
+
+/* 用户名索引参数 */
+#define SERVER_USER_BUCKETS             (16384)  /* 用户名索引哈希桶数量，2的幂 */
+
+/* 对象池参数 */
+#define SERVER_POOL_SLAB_OBJS           (64)  /* 对象池每个slab中的对象数 */
+
+/* 连接状态 */
 typedef enum
 {
-    MSG_TYPE_MSG = 0,  /* 消息类型 */
-    MSG_TYPE_USER_REGISTER, /* 用户注册类型 */
-    MSG_TYPE_USER_OFFLINE, /* 用户下线类型 */
-    MSG_TYPE_USER_ONLINE,   /* 用户上线类型 */
-}msg_type_t;
-
-/* 服务器-客户端通信缓冲区结构 */
-typedef struct msg_s
-{
-    msg_type_t protocol : 8;  /* 协议类型 */
-    int length : 24;   /* 消息长度 */
-    char data[BUFFER_SIZE - BUFFER_HEADER_SIZE]; /* 消息数据 */
-}msg_t;
+    CONNECT_STATE_FREE = 0,     /* 空闲槽位 */
+    CONNECT_STATE_OPEN,         /* 连接已建立 */
+    CONNECT_STATE_CLOSING,      /* 已移出活跃连接数组，等待引用全部释放后关闭描述符 */
+}connect_state_t;
 
-/* 服务器与客户端连接结构 */
+/* 服务器与客户端连接结构，按fd索引存放在连接表中，只保存收发路径上的热数据 */
 typedef struct connect_s
 {
     int fd;
-    char user_name[USER_NAME_SIZE]; /* 用户名 */
-    msg_t msg;
-    struct connect_s *next;
+    atomic_int state;   /* 连接状态，取值connect_state_t */
+    _Atomic(uint8_t) version;   /* 注册握手协商的帧格式版本，0表示旧客户端，由工作线程设置，发送时由reactor读取 */
+    _Atomic(uint8_t) caps;      /* 注册握手协商的能力位 */
+    atomic_int refs;    /* 引用计数，所属reactor持有一个，每个在途任务持有一个，归零时关闭描述符 */
+    int index;          /* 在所属reactor活跃连接数组中的下标 */
+    int reactor_id;     /* 接受该连接的reactor，连接的读事件与epoll注册只由该reactor处理 */
+    char *read_buf;     /* 读缓冲区，只由所属reactor访问，保存未组成完整帧的字节 */
+    int read_len;       /* 读缓冲区中已有数据长度 */
+    int read_cap;       /* 读缓冲区容量 */
+    int upload_fd;      /* 正在接收的流式帧的暂存memfd，-1表示没有，只由所属reactor访问 */
+    int upload_len;     /* 暂存文件的总字节数 */
+    int upload_left;    /* 暂存文件尚未收到的字节数 */
+    int upload_discard; /* 被拒绝的流式帧尚未收到的字节数，收到后直接丢弃 */
+    msg_type_t upload_protocol; /* 流式帧的协议类型 */
+    msg_buf_t *p_upload_head;   /* 流式帧位于暂存文件之前的数据，即文件分享的文件名 */
+    pthread_mutex_t out_mutex;  /* 发送队列锁 */
+    msg_buf_t **out_ring;       /* 发送队列，环形数组，元素指向共享的消息缓冲区 */
+    int out_cap;                /* 发送队列容量 */
+    int out_first;              /* 队首下标 */
+    int out_count;              /* 队列中缓冲区数量 */
+    int out_offset;             /* 队首缓冲区已发送的字节数 */
+    int out_bytes;              /* 发送队列中待发送的内存字节数，不含暂存文件中的数据 */
+    int out_file_bytes;         /* 发送队列中待发送的暂存文件字节数，慢连接引用的暂存文件无法释放，单独限制 */
+    int out_armed;              /* 发送已由后端接管：已注册EPOLLOUT，或io_uring发送在途 */
+    int out_pending;            /* 已登记在所属reactor的待发送列表中 */
+    int out_error;              /* 发送出错或队列超限，不再入队 */
+    struct iovec *out_iov;      /* io_uring聚合发送在途时使用的iovec，首次使用时分配 */
+    struct msghdr out_msg;      /* io_uring聚合发送在途时使用的msghdr */
+    thread_strand_t strand;     /* 串行执行器，同一连接的消息按到达顺序逐个处理 */
 }connect_t;
 
+/* 房间在单个reactor上的成员，紧凑数组，发送时只遍历该数组 */
+typedef struct room_members_s
+{
+    int *fds;       /* 成员连接描述符 */
+    int count;      /* 成员数 */
+    int cap;        /* 数组容量 */
+}room_members_t;
+
+/* 房间，成员按所属reactor划分，房间消息由各reactor发送给自己的成员 */
+typedef struct room_s
+{
+    struct room_s *next;        /* 注册表哈希桶链表 */
+    atomic_int refs;            /* 注册表与在途邮件各持有一个引用，为0时释放 */
+    pthread_mutex_t mutex;      /* 保护成员数组 */
+    int member_count;           /* 成员总数，为0时移出注册表 */
+    room_members_t *members;    /* 成员数组，按reactor编号索引 */
+    history_t history;          /* 房间消息历史，成员加入时回放 */
+    char name[ROOM_NAME_SIZE];  /* 房间名 */
+}room_t;
+
+/* 房间注册表，按房间名哈希，只在加入与离开时访问 */
+typedef struct room_table_s
+{
+    room_t **buckets;           /* 哈希桶 */
+    int room_count;             /* 房间数 */
+    pthread_mutex_t mutex;      /* 保护哈希桶与各房间的成员数 */
+}room_table_t;
+
+/* 连接的冷数据，与connect_t同样按fd索引，不与热数据混在同一缓存行 */
+typedef struct connect_info_s
+{
+    char user_name[USER_NAME_SIZE]; /* 用户名 */
+    msg_buf_t *p_prefix;            /* 预先生成的"[用户名] "前缀，注册时生成，广播时作为分段引用 */
+    room_t *rooms[SERVER_ROOM_PER_CONNECT];     /* 已加入的房间，只由连接的串行执行器与连接释放时访问 */
+    int room_count;                 /* 已加入的房间数 */
+    struct connect_info_s *name_next;   /* 用户名索引哈希桶链表 */
+    int indexed;                    /* 用户名已登记在索引中 */
+}connect_info_t;
+
+/* 用户名索引，按用户名哈希到连接冷数据，用户名即保存在连接冷数据中，注册时登记，连接释放时删除 */
+typedef struct user_index_s
+{
+    connect_info_t **buckets;   /* 哈希桶 */
+    int user_count;             /* 已登记的用户数 */
+    pthread_rwlock_t lock;      /* 私聊查找持读锁，登记与删除持写锁 */
+}user_index_t;
+
+/* reactor邮箱中的广播消息，每次广播每个reactor一个 */
+typedef struct reactor_mail_s
+{
+    mpsc_node_t node;   /* 邮箱队列节点，必须为首个成员 */
+    msg_buf_t *p_buf;   /* 共享的已编码帧，邮件持有一个引用 */
+    room_t *p_room;     /* 房间消息的目标房间，NULL表示发送给全部连接，邮件持有一个引用 */
+    connect_t *p_target;    /* 单播的目标连接，NULL表示广播，邮件持有其引用 */
+    int exclude_fd;     /* 不接收广播的连接，-1表示全部发送 */
+}reactor_mail_t;
+
+struct server_s;
+struct reactor_backend_s;
+
+/* reactor的I/O后端类型 */
+typedef enum
+{
+    SERVER_BACKEND_EPOLL = 0,   /* epoll就绪通知，reactor自行读写 */
+    SERVER_BACKEND_URING,       /* io_uring完成通知，多发接受与接收，发送批量提交 */
+}server_backend_t;
+
+/* io_uring请求类型，与连接fd一起编码在user_data中 */
+typedef enum
+{
+    REACTOR_URING_ACCEPT = 1,   /* 监听socket上的多发接受 */
+    REACTOR_URING_WAKE,         /* 读取唤醒eventfd */
+    REACTOR_URING_RECV,         /* 连接上的多发接收 */
+    REACTOR_URING_SEND,         /* 连接上的发送 */
+    REACTOR_URING_CANCEL,       /* 取消连接上的多发接收 */
+    REACTOR_URING_POLL,         /* 队首数据在文件中时等待连接可写 */
+}reactor_uring_op_t;
+
+#define REACTOR_URING_DATA(type, fd)    (((unsigned long long)(type) << 32) | (unsigned int)(fd))
+#define REACTOR_URING_TYPE(data)        ((int)((data) >> 32))
+#define REACTOR_URING_FD(data)          ((int)((data) & 0xffffffffu))
+
+/* reactor，每个reactor一个线程，拥有独立的监听socket与I/O后端实例，只处理自己接受的连接 */
+typedef struct reactor_s
+{
+    struct server_s *p_server;  /* 所属服务器 */
+    int id;                     /* reactor编号，即在reactor数组中的下标 */
+    int socket_fd;              /* 监听socket文件描述符 */
+    const struct reactor_backend_s *p_backend;  /* I/O后端 */
+    int epoll_fd;               /* epoll文件描述符，epoll后端使用 */
+    uring_t ring;               /* io_uring实例，io_uring后端使用 */
+    uring_buf_ring_t buf_ring;  /* io_uring接收缓冲区环 */
+    unsigned long long wake_value;  /* io_uring读取eventfd的缓冲区 */
+    int *send_fds;              /* 本轮有数据待发送的连接，一轮结束后每个连接聚合发送一次 */
+    int send_count;             /* 待发送连接数量 */
+    int send_cap;               /* 待发送连接数组容量 */
+    int wake_fd;                /* eventfd，邮箱有新邮件或服务器退出时唤醒阻塞在等待中的reactor */
+    int spare_fd;               /* 备用描述符，描述符耗尽时释放它以接受并关闭排队的连接 */
+    pthread_t thread;           /* reactor线程，0号reactor运行在主线程 */
+    mpsc_queue_t mailbox;       /* 广播邮箱，任意线程无锁投递，由本reactor取出并发送给自己的连接 */
+    atomic_int mail_signaled;   /* 邮箱已写过eventfd且尚未被取出，避免每封邮件一次唤醒 */
+    int *connect_fds;           /* 本reactor的活跃连接fd数组，紧凑存放，只由本reactor访问 */
+    int connect_count;          /* 本reactor的连接数量 */
+    int connect_cap;            /* 活跃连接数组容量 */
+    task_t *task_batch;         /* 本轮epoll事件产生的待提交任务，一轮结束后批量提交到线程池 */
+    int task_batch_count;       /* 待提交任务数量 */
+    int task_batch_cap;         /* 待提交任务数组容量 */
+}reactor_t;
+
+/* reactor的I/O后端接口，所有函数只在所属reactor线程调用 */
+typedef struct reactor_backend_s
+{
+    const char *name;                                       /* 后端名称 */
+    ERR_CODE (*init)(reactor_t *p_reactor);                 /* 创建后端实例并开始接受监听socket与eventfd上的事件 */
+    void (*destroy)(reactor_t *p_reactor);                  /* 销毁后端实例 */
+    void (*run)(reactor_t *p_reactor);                      /* 事件循环，服务器退出时返回 */
+    ERR_CODE (*connect_add)(reactor_t *p_reactor, connect_t *p_connect);    /* 开始接收新连接上的数据 */
+    void (*connect_del)(reactor_t *p_reactor, connect_t *p_connect);        /* 停止接收连接上的数据 */
+    void (*connect_flush)(reactor_t *p_reactor, connect_t *p_connect);      /* 聚合发送连接积压的数据，不阻塞，调用者持有out_mutex */
+}reactor_backend_t;
+
+/* 服务器配置 */
+typedef struct server_config_s
+{
+    int thread_pool_size;       /* 服务器线程池线程数量 */
+    int task_queue_size;        /* 服务器线程池任务队列大小 */
+    thread_pool_mode_t thread_pool_mode;    /* 服务器线程池调度模式 */
+    int reactor_count;          /* reactor数量 */
+    int listen_backlog;         /* 监听队列长度 */
+    server_backend_t backend;   /* reactor的I/O后端 */
+    int history_count;          /* 每份消息历史保留的消息数，0表示不保留 */
+    int history_bytes;          /* 每份消息历史的缓冲区字节数上限 */
+    const char *log_dir;        /* 消息日志目录，NULL表示不持久化 */
+    int log_commit_ms;          /* 消息日志提交周期，毫秒 */
+    int upload_max;             /* 单个流式帧的字节数上限 */
+    int upload_concurrency;     /* 同时暂存中的流式帧数量上限，0表示不接收流式帧 */
+    int compress;               /* 是否与声明能力的客户端协商压缩帧 */
+}server_config_t;
+
 /* 服务器结构 */
 typedef struct server_s
 {
     thread_pool_t thread_pool;  /* 服务器线程池 */
-    int socket_fd;              /* socket通信文件描述符 */
-    connect_t connect_head;     /* 连接队列头 */
-    int connect_count;          /* 当前连接的数量 */
-    int epoll_fd;            /* epoll文件描述符 */
+    reactor_t *reactors;        /* reactor数组 */
+    int reactor_count;          /* reactor数量 */
+    int listen_backlog;         /* 监听队列长度 */
+    server_backend_t backend;   /* reactor的I/O后端，io_uring不可用的reactor退回epoll */
+    atomic_int shutdown;        /* 退出标志，由信号处理函数设置，无锁原子量在信号处理函数中可安全使用 */
+    connect_t *connects;        /* 连接表，按fd索引 */
+    connect_info_t *connect_infos;  /* 连接冷数据表，按fd索引 */
+    int connect_max;            /* 连接表容量，fd不小于该值的连接被拒绝 */
+    atomic_int connect_count;   /* 所有reactor的连接总数 */
+    room_table_t rooms;         /* 房间注册表 */
+    user_index_t users;         /* 用户名索引 */
+    int history_count;          /* 每份消息历史保留的消息数 */
+    int history_bytes;          /* 每份消息历史的缓冲区字节数上限 */
+    history_t history;          /* 公共消息历史，用户注册时回放 */
+    msg_log_t log;              /* 持久化消息日志 */
+    int log_enabled;            /* 是否启用消息日志 */
+    atomic_int history_recovered;   /* 公共消息历史是否已从日志恢复，首次使用时恢复 */
+    int upload_max;             /* 单个流式帧的字节数上限 */
+    int upload_concurrency;     /* 同时暂存中的流式帧数量上限 */
+    atomic_int upload_count;    /* 正在暂存的流式帧数量，所有reactor共享 */
+    int out_file_limit;         /* 单连接待发送的暂存文件字节上限 */
+    int compress;               /* 是否与声明能力的客户端协商压缩帧 */
+    obj_pool_t s_c_pool;        /* 服务器-连接任务参数对象池，reactor分配，工作线程释放 */
+    obj_pool_t mail_pool;       /* reactor邮件对象池，工作线程分配，reactor释放 */
     pthread_mutex_t mutex;      /* 服务器互斥锁 */
 }server_t;
 
@@ -76,6 +307,10 @@ typedef struct server_connect
 {
     server_t *p_server;
     int connect_fd;
+    thread_strand_task_t strand_task;   /* 提交到连接串行执行器的任务节点 */
+    msg_type_t protocol;    /* 协议类型 */
+    msg_buf_t *p_payload;   /* 从连接读缓冲区中解出的消息数据，以'\0'结尾，任务持有一个引用；流式帧为暂存文件之前的数据 */
+    msg_buf_t *p_file;      /* 流式帧暂存在memfd中的数据，普通帧为NULL，任务持有一个引用 */
 }server_connect_t;
 
 /*
@@ -84,17 +319,20 @@ typedef struct server_connect
 
 /*
     function    服务器对象初始化
-    in          p_server                        指向服务器对象
-                server_thread_pool_size         服务器线程池线程数量
-                server_thread_task_queue_size   服务器线程池任务队列大小
+    in          p_server        指向服务器对象
+                p_config        服务器配置
+    out
+    ret         errCode
+*/
+ERR_CODE server_init(IN OUT server_t *p_server, IN const server_config_t *p_config);
+
+/*
+    function    运行服务器，1~N-1号reactor在新线程中运行，0号reactor在调用线程中运行，收到退出信号后返回
+    in          p_server        指向服务器对象
     out
     ret         errCode
 */
-ERR_CODE server_init(
-    IN OUT server_t *p_server, 
-    int server_thread_pool_size, 
-    int server_thread_task_queue_size
-);
+ERR_CODE server_run(IN server_t *p_server);
 
 /*
     function    服务器对象销毁
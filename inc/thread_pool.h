@@ -6,35 +6,92 @@
 */
 
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include "debug_log.h"
+#include "mpsc_queue.h"
+
+/*
+    Defines
+*/
+
+#define THREAD_POOL_CACHE_LINE          (64)  /* 缓存行大小，任务槽与队列下标按缓存行对齐避免伪共享 */
+#define THREAD_POOL_STRAND_BATCH        (32)  /* 串行执行器一次最多连续执行的任务数，超过后重新排队，避免饿死其他执行器 */
 
 /*
     Typedefs    
 */
 
+/* 调度模式 */
+typedef enum
+{
+    THREAD_POOL_MODE_SHARED = 0,    /* 所有线程共享一个任务队列 */
+    THREAD_POOL_MODE_STEALING,      /* 每个线程一个任务双端队列，空闲线程从其他线程窃取 */
+}thread_pool_mode_t;
+
 /* 任务 */
 typedef struct task_s
 {
     void (*task_func)(void *arg);  /* 任务函数 */
     void *arg;                     /* 任务函数参数 */
-    struct task_s* next;          /* 下一个任务指针 */
 }task_t;
 
+/* 任务槽，任务直接存放在槽中，不再为每个任务申请内存 */
+typedef struct task_slot_s
+{
+    atomic_ulong seq;       /* 槽序号：等于入队下标时可写入，等于入队下标+1时可取出 */
+    task_t task;            /* 任务 */
+}__attribute__((aligned(THREAD_POOL_CACHE_LINE))) task_slot_t;
+
+/* Chase-Lev任务双端队列：所属线程在bottom端无锁压入与弹出，其他线程在top端CAS窃取 */
+typedef struct task_deque_s
+{
+    atomic_long top __attribute__((aligned(THREAD_POOL_CACHE_LINE)));     /* 窃取端下标 */
+    atomic_long bottom __attribute__((aligned(THREAD_POOL_CACHE_LINE)));  /* 所属线程端下标 */
+    task_t *tasks;          /* 任务数组，容量为2的幂 */
+    long mask;              /* 容量掩码 */
+}__attribute__((aligned(THREAD_POOL_CACHE_LINE))) task_deque_t;
+
 typedef struct thread_pool_s
 {
     pthread_t *pthreads;  /* 线程数组 */
     int free_thread_count;     /* 线程数量 */
 
-    task_t *task_queue;         /* 任务队列 */
-    int task_queue_size;        /* 任务队列大小 */
+    thread_pool_mode_t mode;    /* 调度模式 */
+    task_deque_t *deques;       /* 窃取模式下每个线程的任务双端队列 */
+    atomic_int worker_seq;      /* 线程启动时领取自己的编号 */
 
-    int shutdown;           /* 销毁标志 */
+    task_slot_t *task_queue;    /* 任务队列，预分配的有界无锁多生产者多消费者环形数组；窃取模式下接收池外线程提交的任务 */
+    int task_queue_size;        /* 任务队列大小，向上取整为2的幂 */
 
-    pthread_mutex_t *mutex;    /* 线程池锁 */
+    atomic_int shutdown;    /* 销毁标志 */
 
-    pthread_cond_t *cond;       /* 线程池任务条件变量 */
+    sem_t *sem;             /* 空闲线程在此等待唤醒 */
+    atomic_int idle_count;  /* 正在或即将等待唤醒的空闲线程数，提交任务时据此决定唤醒几个线程 */
+
+    /* 入队与出队下标分别独占缓存行，生产者与消费者互不干扰 */
+    atomic_ulong enqueue_pos __attribute__((aligned(THREAD_POOL_CACHE_LINE)));  /* 下一个入队下标 */
+    atomic_ulong dequeue_pos __attribute__((aligned(THREAD_POOL_CACHE_LINE)));  /* 下一个出队下标 */
 }thread_pool_t;
 
+/* 串行执行器中的任务节点，嵌入到任务参数中，提交时不申请内存 */
+typedef struct thread_strand_task_s
+{
+    mpsc_node_t node;       /* 队列节点，必须为首个成员 */
+    task_t task;            /* 任务 */
+}thread_strand_task_t;
+
+/*
+    串行执行器：提交到同一执行器的任务按提交顺序逐个执行，不会并发，
+    不同执行器的任务仍在线程池中并行执行
+*/
+typedef struct thread_strand_s
+{
+    thread_pool_t *p_pool;  /* 执行任务的线程池 */
+    mpsc_queue_t queue;     /* 待执行任务，任意线程无锁提交，只由当前执行者取出 */
+    atomic_int pending;     /* 已提交未执行完的任务数，由0变1的提交者负责调度执行 */
+}thread_strand_t;
+
 /*
     Function declarations
 */
@@ -50,6 +107,18 @@ typedef struct thread_pool_s
 */
 ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queue_size);
 
+/*
+    function    按指定调度模式初始化线程池
+    in
+                p_pool              线程池指针
+                thread_count        工作线程数量
+                task_queue_size     任务队列大小，窃取模式下也是每个线程双端队列的大小
+                mode                调度模式
+    out
+    ret         errCode
+*/
+ERR_CODE thread_pool_init_mode(thread_pool_t *p_pool, int thread_count, int task_queue_size, thread_pool_mode_t mode);
+
 /*
     function    线程池销毁
     in
@@ -60,14 +129,59 @@ ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queu
 ERR_CODE thread_pool_destroy(thread_pool_t *p_pool);
 
 /*
-    function    线程池添加任务
+    function    线程池添加任务，不阻塞；窃取模式下池内线程提交的任务压入自己的双端队列
     in
                 p_pool              线程池指针
                 task_func           任务函数
                 arg                 任务函数参数
     out
-    ret         errCode
+    ret         errCode，队列已满时返回ERR_THREAD_POOL_FULL，任务未被接收，由调用者决定丢弃或自行执行
 */
 ERR_CODE thread_pool_add_task(thread_pool_t *p_pool, void (*task_func)(void *arg), void *arg);
 
+/*
+    function    线程池批量添加任务，不阻塞；一次占用共享队列中的连续槽位，按需要的线程数唤醒
+    in
+                p_pool              线程池指针
+                p_tasks             任务数组
+                count               任务数量
+    out         p_added             实际添加的任务数，为p_tasks的前缀，可为NULL
+    ret         errCode，队列已满时返回ERR_THREAD_POOL_FULL，未添加的任务由调用者决定丢弃或自行执行
+*/
+ERR_CODE thread_pool_add_tasks(thread_pool_t *p_pool, const task_t *p_tasks, int count, int *p_added);
+
+/*
+    function    串行执行器初始化
+    in
+                p_strand            串行执行器指针
+                p_pool              执行任务的线程池
+    out
+    ret         errCode
+*/
+ERR_CODE thread_strand_init(thread_strand_t *p_strand, thread_pool_t *p_pool);
+
+/*
+    function    向串行执行器提交任务，不阻塞；执行器空闲时将其调度到线程池，线程池队列满时在调用线程中执行
+    in
+                p_strand            串行执行器指针
+                p_node              任务节点，任务执行完之前调用者不能释放
+                task_func           任务函数
+                arg                 任务函数参数
+    out
+    ret         errCode
+*/
+ERR_CODE thread_strand_add_task(thread_strand_t *p_strand, thread_strand_task_t *p_node, void (*task_func)(void *arg), void *arg);
+
+/*
+    function    向串行执行器加入任务但不调度，用于批量提交
+    in
+                p_strand            串行执行器指针
+                p_node              任务节点，任务执行完之前调用者不能释放
+                task_func           任务函数
+                arg                 任务函数参数
+    out         p_run               执行器由空闲转为活跃时，需要提交到线程池的执行任务
+    ret         1 调用者需要提交p_run（提交失败时应在调用线程中执行），0 执行器已在执行
+*/
+int thread_strand_push(thread_strand_t *p_strand, thread_strand_task_t *p_node, void (*task_func)(void *arg), void *arg, task_t *p_run);
+
 #endif
\ No newline at end of file
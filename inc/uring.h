@@ -0,0 +1,147 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+    Include files
+*/
+
+#include <linux/io_uring.h>
+
+#include "debug_log.h"
+
+/*
+    Typedefs
+*/
+
+/*
+    io_uring实例：直接使用系统调用与共享内存环，不依赖liburing，
+    提交队列与完成队列都只由创建它的reactor线程访问
+*/
+typedef struct uring_s
+{
+    int ring_fd;                    /* io_uring文件描述符 */
+    unsigned *sq_head;              /* 提交队列头，内核修改 */
+    unsigned *sq_tail;              /* 提交队列尾，用户修改 */
+    unsigned sq_mask;               /* 提交队列下标掩码 */
+    unsigned sq_entries;            /* 提交队列长度 */
+    unsigned *sq_array;             /* 提交队列下标数组 */
+    unsigned *sq_flags;             /* 提交队列标志，内核修改 */
+    unsigned sqe_tail;              /* 已填写的提交项，提交时写入sq_tail */
+    struct io_uring_sqe *sqes;      /* 提交项数组 */
+    unsigned *cq_head;              /* 完成队列头，用户修改 */
+    unsigned *cq_tail;              /* 完成队列尾，内核修改 */
+    unsigned cq_mask;               /* 完成队列下标掩码 */
+    struct io_uring_cqe *cqes;      /* 完成项数组 */
+    void *sq_ptr;                   /* 提交队列映射 */
+    size_t sq_len;
+    void *cq_ptr;                   /* 完成队列映射，内核支持单次映射时与sq_ptr相同 */
+    size_t cq_len;
+    size_t sqes_len;                /* 提交项数组映射长度 */
+}uring_t;
+
+/* 注册到io_uring的接收缓冲区环，内核在数据到达时自行挑选缓冲区 */
+typedef struct uring_buf_ring_s
+{
+    struct io_uring_buf_ring *p_ring;   /* 缓冲区描述环，与内核共享 */
+    size_t ring_len;                /* 描述环映射长度 */
+    char *bufs;                     /* 缓冲区内存 */
+    int buf_size;                   /* 单个缓冲区大小 */
+    unsigned entries;               /* 缓冲区数量，2的幂 */
+    unsigned short tail;            /* 描述环尾，归还缓冲区时递增 */
+    int bgid;                       /* 缓冲区组编号，提交接收时通过buf_group引用 */
+}uring_buf_ring_t;
+
+/*
+    Function declarations
+*/
+
+/*
+    function    创建io_uring实例并映射提交与完成队列，内核不支持所需特性时失败
+    in          p_ring          io_uring实例指针
+                entries         提交队列长度，完成队列为其4倍
+    out
+    ret         errCode
+*/
+ERR_CODE uring_init(IN uring_t *p_ring, IN unsigned entries);
+
+/*
+    function    销毁io_uring实例，内核取消所有在途请求
+    in          p_ring          io_uring实例指针
+    out
+    ret
+*/
+void uring_destroy(IN uring_t *p_ring);
+
+/*
+    function    获取一个空闲提交项，内容已清零，提交队列满时返回NULL，调用者先提交再重试
+    in          p_ring          io_uring实例指针
+    out
+    ret         提交项指针
+*/
+struct io_uring_sqe *uring_get_sqe(IN uring_t *p_ring);
+
+/*
+    function    提交所有已填写的提交项，并等待至少wait_nr个完成项或超时
+    in          p_ring          io_uring实例指针
+                wait_nr         等待的完成项数量，0表示只提交不等待
+                timeout_ms      等待超时，毫秒，-1表示一直等待
+    out
+    ret         errCode，超时与被信号打断也返回ERR_NO_ERROR
+*/
+ERR_CODE uring_submit_and_wait(IN uring_t *p_ring, IN unsigned wait_nr, IN int timeout_ms);
+
+/*
+    function    查看下一个完成项，处理完后调用uring_cqe_seen
+    in          p_ring          io_uring实例指针
+    out
+    ret         完成项指针，没有完成项时返回NULL
+*/
+struct io_uring_cqe *uring_peek_cqe(IN uring_t *p_ring);
+
+/*
+    function    归还已处理的完成项
+    in          p_ring          io_uring实例指针
+    out
+    ret
+*/
+void uring_cqe_seen(IN uring_t *p_ring);
+
+/*
+    function    创建接收缓冲区环并注册到io_uring
+    in          p_ring          io_uring实例指针
+                p_buf_ring      缓冲区环指针
+                bgid            缓冲区组编号
+                entries         缓冲区数量，2的幂
+                buf_size        单个缓冲区大小
+    out
+    ret         errCode
+*/
+ERR_CODE uring_buf_ring_init(IN uring_t *p_ring, IN uring_buf_ring_t *p_buf_ring, IN int bgid, IN unsigned entries, IN int buf_size);
+
+/*
+    function    释放接收缓冲区环，在io_uring销毁后调用
+    in          p_buf_ring      缓冲区环指针
+    out
+    ret
+*/
+void uring_buf_ring_destroy(IN uring_buf_ring_t *p_buf_ring);
+
+/*
+    function    取得内核选中的缓冲区
+    in          p_buf_ring      缓冲区环指针
+                bid             完成项中的缓冲区编号
+    out
+    ret         缓冲区指针
+*/
+char *uring_buf_ring_get(IN uring_buf_ring_t *p_buf_ring, IN unsigned bid);
+
+/*
+    function    数据取走后把缓冲区归还给内核
+    in          p_buf_ring      缓冲区环指针
+                bid             缓冲区编号
+    out
+    ret
+*/
+void uring_buf_ring_recycle(IN uring_buf_ring_t *p_buf_ring, IN unsigned bid);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+    Include files
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+
+/*
+    Defines
+*/
+
+#define BENCH_TOTAL             (10000) /* 默认连接总数 */
+#define BENCH_CONCURRENCY       (256)   /* 默认同时处于握手中的连接数 */
+#define BENCH_EVENT_SIZE        (256)   /* epoll事件数量 */
+#define BENCH_IDLE_MS           (2000)  /* 观察者连续无新通知的等待时间，超时即结束 */
+#define BENCH_OBSERVER_BUF      (64 * 1024)  /* 观察者接收缓冲区大小 */
+
+/*
+    Typedefs
+*/
+
+/* 压测状态 */
+typedef struct bench_s
+{
+    struct sockaddr_in addr;    /* 服务器地址 */
+    int epoll_fd;               /* epoll文件描述符 */
+    int observer_fd;            /* 观察者连接，统计服务器广播的上线通知 */
+    char observer_buf[BENCH_OBSERVER_BUF];  /* 观察者未解析的字节 */
+    int observer_len;           /* 观察者未解析的字节数 */
+    int total;                  /* 连接总数 */
+    int concurrency;            /* 同时处于握手中的连接数上限 */
+    int started;                /* 已发起的连接数 */
+    int inflight;               /* 握手中的连接数 */
+    int connected;              /* 握手成功并发出上线通知的连接数 */
+    int failed;                 /* 握手失败的连接数 */
+    int observed;               /* 观察者收到的上线通知数，即服务器已接受并处理的连接数 */
+    double start;               /* 开始时间，秒 */
+    double connect_done;        /* 最后一个连接握手完成的时间 */
+    double observe_done;        /* 最后一个上线通知到达的时间 */
+}bench_t;
+
+/*
+    Variables
+*/
+
+static bench_t bench = {};
+
+/*
+    Function definitions
+*/
+
+/*
+    function    获取单调时钟时间
+    in
+    out
+    ret         秒
+*/
+static double bench_now(void)
+{
+    struct timespec ts = {};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+    function    发起一个非阻塞连接，握手完成时epoll报告可写
+    in          p_bench     压测状态
+    out
+    ret         errCode
+*/
+static ERR_CODE bench_connect_start(IN bench_t *p_bench)
+{
+    struct epoll_event ev = {};
+    int fd = -1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(-1 == fd)
+    {
+        perror("socket");
+        return ERR_CLIENT_INIT;
+    }
+
+    if(0 != connect(fd, (struct sockaddr *)&(p_bench->addr), sizeof(p_bench->addr)) && EINPROGRESS != errno)
+    {
+        close(fd);
+        p_bench->failed++;
+        p_bench->started++;
+        return ERR_NO_ERROR;
+    }
+
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd;
+    if(-1 == epoll_ctl(p_bench->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        perror("epoll ctl add");
+        close(fd);
+        return ERR_CLIENT_INIT;
+    }
+
+    p_bench->started++;
+    p_bench->inflight++;
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    连接握手结束，成功时发出上线通知后关闭，服务器处理后会广播给观察者
+    in          p_bench     压测状态
+                fd          连接描述符
+    out
+    ret
+*/
+static void bench_connect_done(IN bench_t *p_bench, IN int fd)
+{
+    char frame[MSG_FRAME_LEGACY_HEADER_SIZE] = {};
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    p_bench->inflight--;
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if(0 != err || MSG_FRAME_LEGACY_HEADER_SIZE != msg_frame_encode(0, MSG_TYPE_USER_ONLINE, NULL, 0, frame, sizeof(frame)) ||
+        MSG_FRAME_LEGACY_HEADER_SIZE != send(fd, frame, sizeof(frame), MSG_NOSIGNAL))
+    {
+        p_bench->failed++;
+    }
+    else
+    {
+        p_bench->connected++;
+        p_bench->connect_done = bench_now();
+    }
+
+    epoll_ctl(p_bench->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+/*
+    function    读取观察者连接，统计上线通知
+    in          p_bench     压测状态
+    out
+    ret         errCode，服务器关闭连接时返回ERR_CLIENT_RECEIVE
+*/
+static ERR_CODE bench_observer_read(IN bench_t *p_bench)
+{
+    msg_t msg = {};
+    ssize_t n = 0;
+    int offset = 0;
+    int consumed = 0;
+
+    while(1)
+    {
+        n = recv(p_bench->observer_fd, p_bench->observer_buf + p_bench->observer_len,
+                 sizeof(p_bench->observer_buf) - p_bench->observer_len, 0);
+        if(0 == n)
+        {
+            return ERR_CLIENT_RECEIVE;
+        }
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            if(EAGAIN == errno || EWOULDBLOCK == errno)  break;
+            return ERR_CLIENT_RECEIVE;
+        }
+        p_bench->observer_len += n;
+
+        offset = 0;
+        while(0 < (consumed = msg_frame_decode(p_bench->observer_buf + offset, p_bench->observer_len - offset, &msg)))
+        {
+            offset += consumed;
+            if(MSG_TYPE_USER_ONLINE == msg.header.protocol)
+            {
+                p_bench->observed++;
+                p_bench->observe_done = bench_now();
+            }
+        }
+        if(consumed < 0)
+        {
+            return ERR_CLIENT_RECEIVE;
+        }
+        memmove(p_bench->observer_buf, p_bench->observer_buf + offset, p_bench->observer_len - offset);
+        p_bench->observer_len -= offset;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    建立观察者连接并注册到epoll
+    in          p_bench     压测状态
+    out
+    ret         errCode
+*/
+static ERR_CODE bench_observer_init(IN bench_t *p_bench)
+{
+    struct epoll_event ev = {};
+
+    p_bench->observer_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    PFM_ENSURE_RET(-1 != p_bench->observer_fd, ERR_CLIENT_INIT);
+    if(0 != connect(p_bench->observer_fd, (struct sockaddr *)&(p_bench->addr), sizeof(p_bench->addr)))
+    {
+        perror("connect");
+        return ERR_CLIENT_INIT;
+    }
+    PFM_ENSURE_RET(ERR_NO_ERROR == msg_frame_send(p_bench->observer_fd, 0, MSG_TYPE_USER_REGISTER, "bench", 5), ERR_CLIENT_INIT);
+    fcntl(p_bench->observer_fd, F_SETFL, O_NONBLOCK);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = p_bench->observer_fd;
+    PFM_ENSURE_RET(-1 != epoll_ctl(p_bench->epoll_fd, EPOLL_CTL_ADD, p_bench->observer_fd, &ev), ERR_CLIENT_INIT);
+
+    /* 等待服务器登记观察者，之后的上线通知才会被广播给它 */
+    usleep(100 * 1000);
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    执行压测：保持concurrency个连接处于握手中，直到发起total个连接并且观察者不再收到通知
+    in          p_bench     压测状态
+    out
+    ret         errCode
+*/
+static ERR_CODE bench_run(IN bench_t *p_bench)
+{
+    struct epoll_event events[BENCH_EVENT_SIZE] = {};
+    double last_progress = 0;
+    int n = 0;
+    int i = 0;
+
+    p_bench->start = bench_now();
+    last_progress = p_bench->start;
+
+    while(1)
+    {
+        while(p_bench->started < p_bench->total && p_bench->inflight < p_bench->concurrency)
+        {
+            PFM_ENSURE_RET(ERR_NO_ERROR == bench_connect_start(p_bench), ERR_CLIENT_INIT);
+        }
+
+        if(p_bench->started == p_bench->total && 0 == p_bench->inflight &&
+            (p_bench->observed >= p_bench->connected || bench_now() - last_progress > BENCH_IDLE_MS / 1000.0))
+        {
+            break;
+        }
+
+        n = epoll_wait(p_bench->epoll_fd, events, BENCH_EVENT_SIZE, 100);
+        for(i = 0; i < n; ++i)
+        {
+            if(events[i].data.fd == p_bench->observer_fd)
+            {
+                PFM_ENSURE_RET(ERR_NO_ERROR == bench_observer_read(p_bench), ERR_CLIENT_RECEIVE);
+            }
+            else
+            {
+                bench_connect_done(p_bench, events[i].data.fd);
+            }
+            last_progress = bench_now();
+        }
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    Main
+*/
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = SERVER_PORT;
+    int opt = 0;
+    double connect_time = 0;
+    double observe_time = 0;
+
+    bench.total = BENCH_TOTAL;
+    bench.concurrency = BENCH_CONCURRENCY;
+
+    /* -n N：连接总数；-c N：并发握手数；-a addr：服务器地址；-p port：服务器端口 */
+    while(-1 != (opt = getopt(argc, argv, "n:c:a:p:")))
+    {
+        switch(opt)
+        {
+            case 'n':   bench.total = atoi(optarg);         break;
+            case 'c':   bench.concurrency = atoi(optarg);   break;
+            case 'a':   host = optarg;                      break;
+            case 'p':   port = atoi(optarg);                break;
+            default:
+            {
+                fprintf(stderr, "usage: %s [-n total] [-c concurrency] [-a addr] [-p port]\n", argv[0]);
+                return ERR_BAD_PARAM;
+            }
+        }
+    }
+    PFM_ENSURE_RET(0 < bench.total && 0 < bench.concurrency, ERR_BAD_PARAM);
+
+    bench.addr.sin_family = AF_INET;
+    bench.addr.sin_port = htons(port);
+    PFM_ENSURE_RET(1 == inet_pton(AF_INET, host, &bench.addr.sin_addr), ERR_BAD_PARAM);
+
+    bench.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    PFM_ENSURE_RET(-1 != bench.epoll_fd, ERR_CLIENT_INIT);
+    PFM_ENSURE_RET(ERR_NO_ERROR == bench_observer_init(&bench), ERR_CLIENT_INIT);
+    PFM_ENSURE_RET(ERR_NO_ERROR == bench_run(&bench), ERR_CLIENT_RECEIVE);
+
+    connect_time = bench.connect_done - bench.start;
+    observe_time = bench.observe_done - bench.start;
+    printf("connections %d, concurrency %d, connected %d, failed %d\n", bench.total, bench.concurrency, bench.connected, bench.failed);
+    printf("handshakes  %.0f conn/s (%.3f s)\n", connect_time > 0 ? bench.connected / connect_time : 0, connect_time);
+    printf("accepted    %.0f conn/s (%.3f s), %d of %d processed by server\n",
+           observe_time > 0 ? bench.observed / observe_time : 0, observe_time, bench.observed, bench.connected);
+
+    close(bench.observer_fd);
+    close(bench.epoll_fd);
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "client.h"
 #include "server.h"
@@ -51,15 +52,10 @@ static void signal_handler(int signum)
 */
 ERR_CODE client_online(IN client_t *p_client)
 {
-    msg_t msg = {};
-
     PFM_ENSURE_RET(NULL != p_client, ERR_BAD_PARAM);
 
-    msg.protocol = MSG_TYPE_USER_ONLINE;
-    msg.length = 0;  // 上线消息不需要数据
-
-    // 发送上线消息
-    if (send(p_client->socket_fd, (void*)&msg, sizeof(msg_t), 0) == -1) {
+    // 发送上线消息，上线消息不需要数据
+    if (ERR_NO_ERROR != msg_frame_send(p_client->socket_fd, atomic_load(&p_client->version), MSG_TYPE_USER_ONLINE, NULL, 0)) {
         perror("send");
         DBG_ERR("send failed");
         return ERR_CLIENT_INPUT;
@@ -78,15 +74,10 @@ ERR_CODE client_online(IN client_t *p_client)
 */
 ERR_CODE client_offline(IN client_t *p_client)
 {
-    msg_t msg = {};
-
     PFM_ENSURE_RET(NULL != p_client, ERR_BAD_PARAM);
 
-    msg.protocol = MSG_TYPE_USER_OFFLINE;
-    msg.length = 0;  // 下线消息不需要数据
-
-    // 发送下线消息
-    if (send(p_client->socket_fd, (void*)&msg, sizeof(msg_t), 0) == -1) {
+    // 发送下线消息，下线消息不需要数据
+    if (ERR_NO_ERROR != msg_frame_send(p_client->socket_fd, atomic_load(&p_client->version), MSG_TYPE_USER_OFFLINE, NULL, 0)) {
         perror("send");
         DBG_ERR("send failed");
         return ERR_CLIENT_INPUT;
@@ -178,17 +169,17 @@ ERR_CODE client_destroy(client_t *p_client)
 */
 ERR_CODE client_register(IN client_t *p_client, IN const char *user_name)
 {
-    msg_t msg = {};
+    char data[USER_NAME_SIZE + MSG_CAPS_SIZE] = {};
+    int name_len = 0;
 
     PFM_ENSURE_RET(NULL != p_client, ERR_BAD_PARAM);
     PFM_ENSURE_RET(NULL != user_name && USER_NAME_SIZE > strlen(user_name), ERR_BAD_PARAM);
 
-    msg.protocol = MSG_TYPE_USER_REGISTER;  // 设置消息类型为用户注册
-    msg.length = strlen(user_name);
-    memcpy(msg.data, user_name, msg.length);
-
-    // 发送注册消息
-    if (send(p_client->socket_fd, (void*)&msg, sizeof(msg_t), 0) == -1) {
+    // 注册消息以旧格式发送，数据为"用户名\0能力块"，服务器应答握手后才发送版本帧
+    name_len = strlen(user_name);
+    memcpy(data, user_name, name_len);
+    msg_caps_encode(MSG_FRAME_VERSION, MSG_CAPS_SUPPORTED, data + name_len + 1);
+    if (ERR_NO_ERROR != msg_frame_send(p_client->socket_fd, 0, MSG_TYPE_USER_REGISTER, data, name_len + 1 + MSG_CAPS_SIZE)) {
         perror("send");
         DBG_ERR("send failed");
         return ERR_CLIENT_INPUT;
@@ -201,6 +192,56 @@ ERR_CODE client_register(IN client_t *p_client, IN const char *user_name)
     return ERR_NO_ERROR;
 }
 
+/*
+    function    分享文件：文件内容由内核从文件直接发送到socket，服务器暂存一次后转发给其他支持流式帧的客户端
+    in          p_client                        指向客户端对象
+                path                            文件路径
+    out
+    ret         errCode，只有发送失败返回错误，文件不可读等问题只提示用户
+*/
+ERR_CODE client_send_file(IN client_t *p_client, IN const char *path)
+{
+    struct stat st = {};
+    const char *name = NULL;
+    int name_len = 0;
+    int fd = -1;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    PFM_ENSURE_RET(NULL != p_client && NULL != path, ERR_BAD_PARAM);
+
+    if (0 == (atomic_load(&p_client->caps) & MSG_CAPS_STREAM)) {
+        printf(DBG_FMT_RED"server does not support file transfer\r\n"DBG_FMT_END);
+        return ERR_NO_ERROR;
+    }
+
+    // 只发送文件名，不发送路径
+    name = strrchr(path, '/');
+    name = (NULL != name) ? name + 1 : path;
+    name_len = strlen(name);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd || 0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == name_len || MSG_FILE_NAME_MAX < name_len ||
+        st.st_size > MSG_FRAME_STREAM_MAX - (USER_NAME_SIZE + 2) - name_len - 1) {
+        printf(DBG_FMT_RED"cannot share %s\r\n"DBG_FMT_END, path);
+        if (-1 != fd) {
+            close(fd);
+        }
+        return ERR_NO_ERROR;
+    }
+
+    // 数据为"文件名\0文件内容"
+    ret = msg_frame_send_file(p_client->socket_fd, atomic_load(&p_client->version), MSG_TYPE_FILE, name, name_len + 1, fd, st.st_size);
+    close(fd);
+    if (ERR_NO_ERROR != ret) {
+        perror("sendfile");
+        DBG_ERR("send file %s failed", path);
+        return ERR_CLIENT_INPUT;
+    }
+
+    DBG("shared file %s, %ld bytes", path, (long)st.st_size);
+    return ERR_NO_ERROR;
+}
+
 /*
     function    客户端输入消息
     in          p_client                        指向客户端对象
@@ -209,8 +250,9 @@ ERR_CODE client_register(IN client_t *p_client, IN const char *user_name)
 */
 ERR_CODE client_input(IN client_t *p_client)
 {
-    char buffer[BUFFER_SIZE - BUFFER_HEADER_SIZE] = {0};
-    msg_t msg = {};
+    static char buffer[CLIENT_INPUT_SIZE + 1] = {0};
+    int length = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
 
     PFM_ENSURE_RET(NULL != p_client, ERR_BAD_PARAM);
 
@@ -224,12 +266,40 @@ ERR_CODE client_input(IN client_t *p_client)
         buffer[len - 1] = '\0';  // 去掉换行符
     }
 
-    msg.protocol = MSG_TYPE_MSG;  // 设置消息类型
-    msg.length = strlen(buffer);
-    memcpy(msg.data, buffer, msg.length);
+    // "/join 房间名"、"/leave 房间名"加入或离开房间，"#房间名 消息"向房间发送消息，"@用户名 消息"私聊，"/send 路径"分享文件，其余为公共消息
+    msg_type_t protocol = MSG_TYPE_MSG;
+    char *data = buffer;
+    if (0 == strncmp(buffer, "/send ", 6)) {
+        return client_send_file(p_client, buffer + 6);
+    } else if (0 == strncmp(buffer, "/join ", 6)) {
+        protocol = MSG_TYPE_ROOM_JOIN;
+        data = buffer + 6;
+    } else if (0 == strncmp(buffer, "/leave ", 7)) {
+        protocol = MSG_TYPE_ROOM_LEAVE;
+        data = buffer + 7;
+    } else if ('#' == buffer[0]) {
+        protocol = MSG_TYPE_ROOM_MSG;
+        data = buffer + 1;
+    } else if ('@' == buffer[0]) {
+        protocol = MSG_TYPE_DIRECT;
+        data = buffer + 1;
+    }
+
+    // 超长的公共消息在服务器支持时作为流式帧发送，其余截断
+    length = strlen(data);
+    if (length > MSG_FRAME_DATA_MAX &&
+        !(MSG_TYPE_MSG == protocol && (atomic_load(&p_client->caps) & MSG_CAPS_STREAM))) {
+        printf(DBG_FMT_RED"message truncated to %d bytes\r\n"DBG_FMT_END, MSG_FRAME_DATA_MAX);
+        length = MSG_FRAME_DATA_MAX;
+    }
 
-    // 发送消息
-    if (send(p_client->socket_fd, (void*)&msg, sizeof(msg_t), 0) == -1) {
+    // 发送消息，只发送帧头和实际长度的数据；服务器支持压缩时较长的消息压缩后发送
+    if (atomic_load(&p_client->caps) & MSG_CAPS_COMPRESS) {
+        ret = msg_frame_send_compressed(p_client->socket_fd, atomic_load(&p_client->version), protocol, data, length);
+    } else {
+        ret = msg_frame_send(p_client->socket_fd, atomic_load(&p_client->version), protocol, data, length);
+    }
+    if (ERR_NO_ERROR != ret) {
         perror("send");
         DBG_ERR("send failed");
         return ERR_CLIENT_INPUT;
@@ -238,6 +308,129 @@ ERR_CODE client_input(IN client_t *p_client)
     return ERR_NO_ERROR;
 }
 
+/*
+    function    写满len字节，处理EINTR与部分写
+    in          fd                              文件描述符
+                buf                             数据
+                len                             数据长度
+    out
+    ret         errCode
+*/
+static ERR_CODE client_write_all(IN int fd, IN const char *buf, IN int len)
+{
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            return ERR_FILE_WRITE;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    分块接收流式帧其余的数据并写入out_fd，写失败后丢弃剩余数据，保持与服务器的帧同步
+    in          p_client                        指向客户端对象
+                left                            剩余的字节数
+                out_fd                          输出文件描述符，-1表示丢弃
+    out
+    ret         errCode
+*/
+static ERR_CODE client_stream_recv(IN client_t *p_client, IN int left, IN int out_fd)
+{
+    static char chunk[CLIENT_STREAM_CHUNK];     /* 只由接收线程使用 */
+    int n = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    while (left > 0) {
+        n = left < (int)sizeof(chunk) ? left : (int)sizeof(chunk);
+        ret = msg_frame_recv_data(p_client->socket_fd, chunk, n);
+        if (ERR_NO_ERROR != ret) {
+            return ret;
+        }
+        if (-1 != out_fd && ERR_NO_ERROR != client_write_all(out_fd, chunk, n)) {
+            perror("write");
+            out_fd = -1;
+        }
+        left -= n;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    接收文件分享，保存到CLIENT_DOWNLOAD_DIR目录，与已有文件重名时在文件名后加编号；
+                以'.'开头的文件名被拒绝，其他用户不能借此在接收者的目录中放置隐藏文件
+    in          p_client                        指向客户端对象
+                p_msg                           已收到的帧头与前MSG_FRAME_DATA_MAX字节数据，数据为"[用户名] 文件名\0文件内容"
+    out
+    ret         errCode
+*/
+static ERR_CODE client_file_recv(IN client_t *p_client, IN msg_t *p_msg)
+{
+    char path[MSG_FILE_NAME_MAX + 16] = {};
+    const char *p_nul = NULL;
+    const char *name = NULL;
+    int have = p_msg->header.length < MSG_FRAME_DATA_MAX ? p_msg->header.length : MSG_FRAME_DATA_MAX;
+    int head_len = 0;
+    int dir_fd = -1;
+    int fd = -1;
+    int i = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    p_nul = memchr(p_msg->data, '\0', have);
+    if (NULL != p_nul) {
+        head_len = p_nul - p_msg->data + 1;
+
+        // 跳过"[用户名] "前缀，只取路径的最后一级，不会写到下载目录之外；空名、"."、".."与隐藏文件都以'.'开头或为空
+        name = strstr(p_msg->data, "] ");
+        name = (NULL != name) ? name + 2 : p_msg->data;
+        name = (NULL != strrchr(name, '/')) ? strrchr(name, '/') + 1 : name;
+        if ('\0' != name[0] && '.' != name[0]) {
+            // 下载目录本身是符号链接时拒绝，文件用O_EXCL创建，不会跟随已有的符号链接
+            if (-1 == mkdir(CLIENT_DOWNLOAD_DIR, 0700) && EEXIST != errno) {
+                perror("mkdir");
+            }
+            dir_fd = open(CLIENT_DOWNLOAD_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (-1 != dir_fd) {
+            for (i = 0; i < CLIENT_FILE_RENAME_MAX && -1 == fd; ++i) {
+                if (0 == i) {
+                    snprintf(path, sizeof(path), "%.*s", MSG_FILE_NAME_MAX, name);
+                } else {
+                    snprintf(path, sizeof(path), "%.*s.%d", MSG_FILE_NAME_MAX, name, i);
+                }
+                fd = openat(dir_fd, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+                if (-1 == fd && EEXIST != errno) {
+                    break;
+                }
+            }
+            close(dir_fd);
+        }
+        if (-1 != fd && ERR_NO_ERROR != client_write_all(fd, p_msg->data + head_len, have - head_len)) {
+            perror("write");
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    ret = client_stream_recv(p_client, p_msg->header.length - have, fd);
+    if (-1 != fd) {
+        close(fd);
+        printf(DBG_FMT_GREEN"%s (%d bytes) saved as %s/%s\r\n"DBG_FMT_END, p_msg->data, p_msg->header.length - head_len,
+               CLIENT_DOWNLOAD_DIR, path);
+    } else {
+        printf(DBG_FMT_RED"%s discarded\r\n"DBG_FMT_END, NULL != p_nul ? p_msg->data : "bad file share");
+    }
+
+    return ret;
+}
+
 /*
     function    客户端接受消息
     in          p_client                        指向客户端对象
@@ -247,23 +440,26 @@ ERR_CODE client_input(IN client_t *p_client)
 ERR_CODE client_receive(IN client_t *p_client)
 {
     msg_t msg = {};
-    ssize_t bytes_received = 0;
+    uint8_t version = 0;
+    uint8_t caps = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
 
     PFM_ENSURE_RET(NULL != p_client, ERR_BAD_PARAM);
 
-    bytes_received = recv(p_client->socket_fd, (void*)&msg, sizeof(msg_t), 0);
-    if (bytes_received == -1) {
+    ret = msg_frame_recv(p_client->socket_fd, &msg);
+    if (ERR_PROTOCOL_CLOSED == ret) {
+        DBG_ERR("server closed connection");
+        PFM_ENSURE_RET(ERR_NO_ERROR == client_destroy(p_client), ERR_CLIENT_INIT);  /* 销毁客户端 */
+        return ERR_CLIENT_RECEIVE;
+    } else if (ERR_NO_ERROR != ret) {
         perror("recv");
         DBG_ERR("recv failed");
         return ERR_CLIENT_RECEIVE;
-    } else if (bytes_received == 0) {
-        DBG_ERR("server closed connection");
-        PFM_ENSURE_RET(ERR_NO_ERROR == client_destroy(p_client), ERR_CLIENT_INIT);  /* 销毁客户端 */
     }
 
     DBG("client received message from server: %s", msg.data);
 
-    switch(msg.protocol)
+    switch(msg.header.protocol)
     {
         case MSG_TYPE_USER_OFFLINE:
         {
@@ -277,7 +473,50 @@ ERR_CODE client_receive(IN client_t *p_client)
         }
         case MSG_TYPE_MSG:
         {
-            printf("%s\r\n", msg.data);
+            printf("%s", msg.data);
+            if (msg.header.length > MSG_FRAME_DATA_MAX) {   /* 超长消息边收边输出 */
+                fflush(stdout);
+                ret = client_stream_recv(p_client, msg.header.length - MSG_FRAME_DATA_MAX, STDOUT_FILENO);
+            }
+            printf("\r\n");
+            break;
+        }
+        case MSG_TYPE_FILE:
+        {
+            ret = client_file_recv(p_client, &msg);
+            break;
+        }
+        case MSG_TYPE_ROOM_JOIN:
+        {
+            printf(DBG_FMT_GREEN"#%s\r\n"DBG_FMT_END, msg.data);
+            break;
+        }
+        case MSG_TYPE_ROOM_LEAVE:
+        {
+            printf(DBG_FMT_RED"#%s\r\n"DBG_FMT_END, msg.data);
+            break;
+        }
+        case MSG_TYPE_ROOM_MSG:
+        {
+            printf("#%s\r\n", msg.data);
+            break;
+        }
+        case MSG_TYPE_DIRECT:
+        {
+            printf("@%s\r\n", msg.data);
+            break;
+        }
+        case MSG_TYPE_USER_REGISTER:    /* 握手应答或注册被拒绝 */
+        {
+            if (msg.header.flags & MSG_FLAG_HANDSHAKE) {
+                if (msg_caps_decode(msg.data, msg.header.length, &version, &caps)) {
+                    atomic_store(&p_client->caps, caps & MSG_CAPS_SUPPORTED);
+                    atomic_store(&p_client->version, version <= MSG_FRAME_VERSION ? version : MSG_FRAME_VERSION);
+                    DBG("server accepted frame version %d, caps 0x%02x", version, caps);
+                }
+                break;
+            }
+            printf(DBG_FMT_RED"%s\r\n"DBG_FMT_END, msg.data);
             break;
         }
         default:
@@ -286,7 +525,7 @@ ERR_CODE client_receive(IN client_t *p_client)
         }
     }
 
-    return ERR_NO_ERROR;
+    return (ERR_NO_ERROR == ret) ? ERR_NO_ERROR : ERR_CLIENT_RECEIVE;
 }
 
 static void* thread_worker(void *arg)
@@ -0,0 +1,240 @@
+/*
+    Include files
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "protocol.h"
+
+/*
+    Function definitions
+*/
+
+/*
+    function    初始化消息历史，缓冲区在首次追加时申请
+    in          p_history       指向消息历史
+                max_count       保留的帧数上限，0表示不保留历史
+                cap             缓冲区字节数上限
+    out
+    ret         errCode
+*/
+ERR_CODE history_init(IN history_t *p_history, IN int max_count, IN int cap)
+{
+    PFM_ENSURE_RET(NULL != p_history, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 <= max_count && 0 <= cap, ERR_BAD_PARAM);
+
+    memset(p_history, 0, sizeof(history_t));
+    p_history->max_count = max_count;
+    p_history->cap = cap;
+    pthread_mutex_init(&(p_history->mutex), NULL);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    销毁消息历史，释放缓冲区
+    in          p_history       指向消息历史
+    out
+    ret
+*/
+void history_destroy(IN history_t *p_history)
+{
+    if(NULL == p_history)
+    {
+        return;
+    }
+
+    free(p_history->arena);
+    p_history->arena = NULL;
+    p_history->head = 0;
+    p_history->len = 0;
+    p_history->count = 0;
+    pthread_mutex_destroy(&(p_history->mutex));
+}
+
+/*
+    function    从环形缓冲区offset处拷贝出len字节，跨越缓冲区末尾时分两段
+    in          p_history       指向消息历史
+                offset          起始偏移
+                len             字节数
+    out         dst             目标地址
+    ret
+*/
+static void history_copy_out(IN history_t *p_history, IN int offset, IN int len, OUT char *dst)
+{
+    int first = p_history->cap - offset;
+
+    if(len <= first)
+    {
+        memcpy(dst, p_history->arena + offset, len);
+        return;
+    }
+    memcpy(dst, p_history->arena + offset, first);
+    memcpy(dst + first, p_history->arena, len - first);
+}
+
+/*
+    function    把len字节拷贝到环形缓冲区offset处，跨越缓冲区末尾时分两段
+    in          p_history       指向消息历史
+                offset          起始偏移
+                src             源地址
+                len             字节数
+    out
+    ret
+*/
+static void history_copy_in(IN history_t *p_history, IN int offset, IN const char *src, IN int len)
+{
+    int first = p_history->cap - offset;
+
+    if(len <= first)
+    {
+        memcpy(p_history->arena + offset, src, len);
+        return;
+    }
+    memcpy(p_history->arena + offset, src, first);
+    memcpy(p_history->arena, src + first, len - first);
+}
+
+/*
+    function    淘汰最早的一帧，帧长从帧头中读出，帧头格式可变，只拷贝出帧头可能占用的字节
+    in          p_history       指向消息历史，调用者持有锁
+    out
+    ret
+*/
+static void history_evict(IN history_t *p_history)
+{
+    char header[MSG_FRAME_HEADER_MAX] = {};
+    msg_header_t frame_header = {};
+    int frame_len = 0;
+
+    history_copy_out(p_history, p_history->head, p_history->len < MSG_FRAME_HEADER_MAX ? p_history->len : MSG_FRAME_HEADER_MAX, header);
+    frame_len = msg_frame_header_decode(header, p_history->len, &frame_header);
+    if(frame_len <= 0)
+    {
+        /* 只保存完整的帧，不会发生，出错时清空历史而不是越界 */
+        p_history->head = 0;
+        p_history->len = 0;
+        p_history->count = 0;
+        return;
+    }
+
+    p_history->head = (p_history->head + frame_len) % p_history->cap;
+    p_history->len -= frame_len;
+    p_history->count--;
+}
+
+/*
+    function    追加一帧，按需淘汰最早的帧，超过缓冲区大小的帧不保存
+    in          p_history       指向消息历史
+                iov             帧的各段
+                iov_count       段数
+                len             帧字节数
+    out
+    ret         errCode
+*/
+static ERR_CODE history_append_iov(IN history_t *p_history, IN const struct iovec *iov, IN int iov_count, IN int len)
+{
+    int offset = 0;
+    int i = 0;
+
+    if(0 == p_history->max_count || len > p_history->cap)
+    {
+        return ERR_NO_ERROR;
+    }
+
+    pthread_mutex_lock(&(p_history->mutex));
+
+    if(NULL == p_history->arena)
+    {
+        p_history->arena = (char *)malloc(p_history->cap);
+        if(NULL == p_history->arena)
+        {
+            pthread_mutex_unlock(&(p_history->mutex));
+            DBG_ERR("malloc for history arena");
+            return ERR_NO_MEMORY;
+        }
+    }
+
+    while(0 < p_history->count && (p_history->count >= p_history->max_count || p_history->len + len > p_history->cap))
+    {
+        history_evict(p_history);
+    }
+
+    /* 帧紧接在最新一帧之后，分段缓冲区逐段拷贝 */
+    offset = (p_history->head + p_history->len) % p_history->cap;
+    for(i = 0; i < iov_count; ++i)
+    {
+        history_copy_in(p_history, offset, (const char *)iov[i].iov_base, iov[i].iov_len);
+        offset = (offset + iov[i].iov_len) % p_history->cap;
+    }
+    p_history->len += len;
+    p_history->count++;
+
+    pthread_mutex_unlock(&(p_history->mutex));
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    追加一帧，按需淘汰最早的帧，超过缓冲区大小的帧不保存
+    in          p_history       指向消息历史
+                p_buf           已编码的完整帧，可为分段缓冲区
+    out
+    ret         errCode
+*/
+ERR_CODE history_append(IN history_t *p_history, IN msg_buf_t *p_buf)
+{
+    struct iovec iov[MSG_BUF_SEG_MAX + 1];
+    int iov_count = 0;
+
+    PFM_ENSURE_RET(NULL != p_history && NULL != p_buf, ERR_BAD_PARAM);
+
+    iov_count = msg_buf_iov(p_buf, 0, iov, MSG_BUF_SEG_MAX + 1);
+    return history_append_iov(p_history, iov, iov_count, p_buf->len);
+}
+
+/*
+    function    追加一段连续内存中的完整帧，用于从日志恢复历史
+    in          p_history       指向消息历史
+                frame           已编码的完整帧
+                len             帧字节数
+    out
+    ret         errCode
+*/
+ERR_CODE history_append_frame(IN history_t *p_history, IN const char *frame, IN int len)
+{
+    struct iovec iov = {};
+
+    PFM_ENSURE_RET(NULL != p_history && NULL != frame && MSG_FRAME_LEGACY_HEADER_SIZE <= len, ERR_BAD_PARAM);
+
+    iov.iov_base = (void *)frame;
+    iov.iov_len = len;
+    return history_append_iov(p_history, &iov, 1, len);
+}
+
+/*
+    function    把保存的所有帧按顺序拷贝到一个缓冲区，回放时一次发送
+    in          p_history       指向消息历史
+    out
+    ret         缓冲区指针，没有历史或申请失败返回NULL
+*/
+msg_buf_t *history_snapshot(IN history_t *p_history)
+{
+    msg_buf_t *p_buf = NULL;
+
+    PFM_ENSURE_RET(NULL != p_history, NULL);
+
+    pthread_mutex_lock(&(p_history->mutex));
+    if(0 < p_history->count)
+    {
+        p_buf = msg_buf_new(p_history->len);
+        if(NULL != p_buf)
+        {
+            history_copy_out(p_history, p_history->head, p_history->len, p_buf->data);
+        }
+    }
+    pthread_mutex_unlock(&(p_history->mutex));
+
+    return p_buf;
+}
@@ -0,0 +1,91 @@
+/*
+    Include files
+*/
+
+#include <sched.h>
+
+#include "mpsc_queue.h"
+
+/*
+    Function definitions
+*/
+
+/*
+    function    队列初始化
+    in          p_queue         队列指针
+    out
+    ret         errCode
+*/
+ERR_CODE mpsc_queue_init(IN mpsc_queue_t *p_queue)
+{
+    PFM_ENSURE_RET(NULL != p_queue, ERR_BAD_PARAM);
+
+    atomic_init(&(p_queue->stub.next), NULL);
+    atomic_init(&(p_queue->head), &(p_queue->stub));
+    p_queue->tail = &(p_queue->stub);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    入队，任意线程可调用，无锁
+    in          p_queue         队列指针
+                p_node          待入队节点
+    out
+    ret
+*/
+void mpsc_queue_push(IN mpsc_queue_t *p_queue, IN mpsc_node_t *p_node)
+{
+    mpsc_node_t *p_prev = NULL;
+
+    atomic_store_explicit(&(p_node->next), NULL, memory_order_relaxed);
+
+    /* 交换后节点即属于队列，再把前驱链接到该节点 */
+    p_prev = atomic_exchange_explicit(&(p_queue->head), p_node, memory_order_acq_rel);
+    atomic_store_explicit(&(p_prev->next), p_node, memory_order_release);
+}
+
+/*
+    function    出队，只能由唯一的消费者线程调用
+    in          p_queue         队列指针
+    out
+    ret         出队的节点，队列为空时返回NULL
+*/
+mpsc_node_t *mpsc_queue_pop(IN mpsc_queue_t *p_queue)
+{
+    mpsc_node_t *p_tail = p_queue->tail;
+    mpsc_node_t *p_next = atomic_load_explicit(&(p_tail->next), memory_order_acquire);
+
+    /* 跳过哨兵节点 */
+    if(&(p_queue->stub) == p_tail)
+    {
+        if(NULL == p_next)
+        {
+            return NULL;
+        }
+        p_queue->tail = p_next;
+        p_tail = p_next;
+        p_next = atomic_load_explicit(&(p_tail->next), memory_order_acquire);
+    }
+
+    if(NULL != p_next)
+    {
+        p_queue->tail = p_next;
+        return p_tail;
+    }
+
+    /* tail已是最后一个节点时，重新放入哨兵使其可以出队 */
+    if(p_tail == atomic_load_explicit(&(p_queue->head), memory_order_acquire))
+    {
+        mpsc_queue_push(p_queue, &(p_queue->stub));
+    }
+
+    /* 生产者已交换head但尚未链接前驱，等待其完成链接，窗口只有几条指令 */
+    while(NULL == (p_next = atomic_load_explicit(&(p_tail->next), memory_order_acquire)))
+    {
+        sched_yield();
+    }
+
+    p_queue->tail = p_next;
+    return p_tail;
+}
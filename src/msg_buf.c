@@ -0,0 +1,387 @@
+/*
+    Include files
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msg_buf.h"
+
+/*
+    Function definitions
+*/
+
+/*
+    function    取缓冲区的第i段数据：-1为data或文件缓冲区本身，其余为各分段
+    in          p_buf           缓冲区指针
+                i               段编号
+    out         p_base          内存中的数据，数据在文件中时为NULL
+                p_fd            数据所在的文件，数据在内存中时为-1
+                p_file_offset   数据在文件中的偏移
+    ret         该段字节数
+*/
+static int msg_buf_region(IN msg_buf_t *p_buf, IN int i, OUT char **p_base, OUT int *p_fd, OUT off_t *p_file_offset)
+{
+    msg_buf_t *p_seg_buf = NULL;
+
+    *p_base = NULL;
+    *p_fd = -1;
+    *p_file_offset = 0;
+    if(i < 0)
+    {
+        if(0 <= p_buf->file_fd)
+        {
+            *p_fd = p_buf->file_fd;
+            return p_buf->len;
+        }
+        *p_base = p_buf->data;
+        return p_buf->data_len;
+    }
+
+    p_seg_buf = p_buf->segs[i].p_buf;
+    if(0 <= p_seg_buf->file_fd)
+    {
+        *p_fd = p_seg_buf->file_fd;
+        *p_file_offset = p_buf->segs[i].offset;
+    }
+    else
+    {
+        *p_base = p_seg_buf->data + p_buf->segs[i].offset;
+    }
+    return p_buf->segs[i].len;
+}
+
+/*
+    function    申请消息缓冲区，引用计数为1
+    in          len             数据长度
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+msg_buf_t *msg_buf_new(IN int len)
+{
+    msg_buf_t *p_buf = NULL;
+    int i = 0;
+
+    PFM_ENSURE_RET(0 <= len, NULL);
+
+    p_buf = (msg_buf_t *)malloc(sizeof(msg_buf_t) + len);
+    if(NULL == p_buf)
+    {
+        DBG_ERR("malloc for msg buf");
+        return NULL;
+    }
+    atomic_init(&p_buf->refcnt, 1);
+    p_buf->len = len;
+    p_buf->data_len = len;
+    p_buf->seg_count = 0;
+    p_buf->file_fd = -1;
+    for(i = 0; i < MSG_BUF_VARIANT_MAX; ++i)
+    {
+        atomic_init(&p_buf->variants[i], NULL);
+    }
+
+    return p_buf;
+}
+
+/*
+    function    申请分段缓冲区，由data与其后的分段按顺序组成，分段只引用不拷贝
+    in          data            位于分段之前的数据，拷贝到缓冲区中
+                data_len        data长度
+                segs            分段，被引用的缓冲区各增加一个引用
+                seg_count       分段数量
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+msg_buf_t *msg_buf_gather(IN const char *data, IN int data_len, IN const msg_seg_t *segs, IN int seg_count)
+{
+    msg_buf_t *p_buf = NULL;
+    int i = 0;
+
+    PFM_ENSURE_RET(0 <= seg_count && MSG_BUF_SEG_MAX >= seg_count, NULL);
+    for(i = 0; i < seg_count; ++i)
+    {
+        PFM_ENSURE_RET(NULL != segs[i].p_buf && 0 == segs[i].p_buf->seg_count, NULL);
+        PFM_ENSURE_RET(0 <= segs[i].offset && 0 <= segs[i].len && segs[i].offset + segs[i].len <= segs[i].p_buf->len, NULL);
+    }
+
+    p_buf = msg_buf_new(data_len);
+    PFM_ENSURE_RET(NULL != p_buf, NULL);
+
+    if(data_len > 0)
+    {
+        memcpy(p_buf->data, data, data_len);
+    }
+    for(i = 0; i < seg_count; ++i)
+    {
+        p_buf->segs[i] = segs[i];
+        msg_buf_ref(segs[i].p_buf);
+        p_buf->len += segs[i].len;
+    }
+    p_buf->seg_count = seg_count;
+
+    return p_buf;
+}
+
+/*
+    function    申请文件缓冲区，数据留在文件中不读入内存，作为分段被引用，发送时由内核从文件直接发送
+    in          fd              文件描述符，由缓冲区接管，最后一个引用释放时关闭
+                len             文件字节数
+    out
+    ret         缓冲区指针，失败返回NULL，此时fd未关闭
+*/
+msg_buf_t *msg_buf_file(IN int fd, IN int len)
+{
+    msg_buf_t *p_buf = NULL;
+
+    PFM_ENSURE_RET(0 <= fd && 0 <= len, NULL);
+
+    p_buf = msg_buf_new(0);
+    PFM_ENSURE_RET(NULL != p_buf, NULL);
+
+    p_buf->len = len;
+    p_buf->file_fd = fd;
+
+    return p_buf;
+}
+
+/*
+    function    用缓冲区从offset开始的数据填写iovec，遇到文件中的数据即停止
+    in          p_buf           缓冲区指针
+                offset          起始偏移
+                max             iovec数组容量
+    out         iov             iovec数组
+    ret         填写的iovec数量，容量不足时只填写前max个
+*/
+int msg_buf_iov(IN msg_buf_t *p_buf, IN int offset, OUT struct iovec *iov, IN int max)
+{
+    char *base = NULL;
+    off_t file_offset = 0;
+    int fd = -1;
+    int len = 0;
+    int count = 0;
+    int i = 0;
+
+    /* 依次为data与各分段，跳过offset之前已发送的部分 */
+    for(i = -1; i < p_buf->seg_count && count < max; ++i)
+    {
+        len = msg_buf_region(p_buf, i, &base, &fd, &file_offset);
+        if(offset >= len)
+        {
+            offset -= len;
+            continue;
+        }
+        if(0 <= fd)
+        {
+            break;  /* 文件中的数据由调用者另行发送 */
+        }
+
+        iov[count].iov_base = base + offset;
+        iov[count].iov_len = len - offset;
+        count++;
+        offset = 0;
+    }
+
+    return count;
+}
+
+/*
+    function    查询缓冲区在offset处的数据是否位于文件中
+    in          p_buf           缓冲区指针
+                offset          偏移
+    out         p_fd            数据所在的文件
+                p_file_offset   数据在文件中的偏移
+    ret         从offset开始连续位于该文件中的字节数，数据在内存中时返回0
+*/
+int msg_buf_file_at(IN msg_buf_t *p_buf, IN int offset, OUT int *p_fd, OUT off_t *p_file_offset)
+{
+    char *base = NULL;
+    int len = 0;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_buf && NULL != p_fd && NULL != p_file_offset, 0);
+
+    for(i = -1; i < p_buf->seg_count; ++i)
+    {
+        len = msg_buf_region(p_buf, i, &base, p_fd, p_file_offset);
+        if(offset < len)
+        {
+            *p_file_offset += offset;
+            return (0 <= *p_fd) ? len - offset : 0;
+        }
+        offset -= len;
+    }
+
+    return 0;
+}
+
+/*
+    function    统计缓冲区中位于文件中的字节数，这部分数据不占用内存
+    in          p_buf           缓冲区指针
+    out
+    ret         字节数
+*/
+int msg_buf_file_len(IN msg_buf_t *p_buf)
+{
+    char *base = NULL;
+    off_t file_offset = 0;
+    int fd = -1;
+    int len = 0;
+    int total = 0;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_buf, 0);
+
+    for(i = -1; i < p_buf->seg_count; ++i)
+    {
+        len = msg_buf_region(p_buf, i, &base, &fd, &file_offset);
+        if(0 <= fd)
+        {
+            total += len;
+        }
+    }
+
+    return total;
+}
+
+/*
+    function    拷贝缓冲区从offset开始的数据，文件中的数据用pread读取
+    in          p_buf           缓冲区指针
+                offset          起始偏移
+                len             拷贝的字节数，超出缓冲区的部分不拷贝
+    out         buf             输出缓冲区
+    ret         拷贝的字节数，读文件失败返回-1
+*/
+int msg_buf_read(IN msg_buf_t *p_buf, IN int offset, OUT char *buf, IN int len)
+{
+    char *base = NULL;
+    off_t file_offset = 0;
+    int fd = -1;
+    int region_len = 0;
+    int n = 0;
+    int copied = 0;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_buf && NULL != buf && 0 <= offset, -1);
+
+    for(i = -1; i < p_buf->seg_count && copied < len; ++i)
+    {
+        region_len = msg_buf_region(p_buf, i, &base, &fd, &file_offset);
+        if(offset >= region_len)
+        {
+            offset -= region_len;
+            continue;
+        }
+
+        n = region_len - offset < len - copied ? region_len - offset : len - copied;
+        if(0 <= fd)
+        {
+            if(n != pread(fd, buf + copied, n, file_offset + offset))
+            {
+                DBG_ERR("pread %d bytes from file fd %d", n, fd);
+                return -1;
+            }
+        }
+        else
+        {
+            memcpy(buf + copied, base + offset, n);
+        }
+        copied += n;
+        offset = 0;
+    }
+
+    return copied;
+}
+
+/*
+    function    取缓冲区在slot处缓存的变体，不存在时用build生成并发布；并发生成时只保留先发布的一份，
+                所有接收者共享，每个广播对每种编码最多生成一次；build返回p_buf本身时缓存的变体就是原缓冲区
+    in          p_buf           缓冲区指针
+                slot            变体编号，小于MSG_BUF_VARIANT_MAX，含义由调用者约定
+                build           变体生成函数
+    out
+    ret         变体指针，不增加引用，在p_buf释放前有效；生成失败返回NULL
+*/
+msg_buf_t *msg_buf_variant(IN msg_buf_t *p_buf, IN int slot, IN msg_buf_build_t build)
+{
+    msg_buf_t *p_variant = NULL;
+    msg_buf_t *p_expected = NULL;
+
+    PFM_ENSURE_RET(NULL != p_buf && NULL != build && 0 <= slot && MSG_BUF_VARIANT_MAX > slot, NULL);
+
+    p_variant = atomic_load_explicit(&p_buf->variants[slot], memory_order_acquire);
+    if(NULL != p_variant)
+    {
+        return p_variant;
+    }
+
+    p_variant = build(p_buf);
+    if(NULL == p_variant)
+    {
+        return NULL;
+    }
+    if(!atomic_compare_exchange_strong_explicit(&p_buf->variants[slot], &p_expected, p_variant,
+                                                memory_order_acq_rel, memory_order_acquire))
+    {
+        if(p_variant != p_buf)
+        {
+            msg_buf_unref(p_variant);
+        }
+        p_variant = p_expected;
+    }
+
+    return p_variant;
+}
+
+/*
+    function    增加引用
+    in          p_buf           缓冲区指针
+    out
+    ret         缓冲区指针
+*/
+msg_buf_t *msg_buf_ref(IN msg_buf_t *p_buf)
+{
+    PFM_ENSURE_RET(NULL != p_buf, NULL);
+
+    atomic_fetch_add_explicit(&p_buf->refcnt, 1, memory_order_relaxed);
+
+    return p_buf;
+}
+
+/*
+    function    释放引用，最后一个引用释放时回收内存
+    in          p_buf           缓冲区指针
+    out
+    ret
+*/
+void msg_buf_unref(IN msg_buf_t *p_buf)
+{
+    msg_buf_t *p_variant = NULL;
+    int i = 0;
+
+    if(NULL == p_buf)
+    {
+        return;
+    }
+
+    if(1 == atomic_fetch_sub_explicit(&p_buf->refcnt, 1, memory_order_acq_rel))
+    {
+        for(i = 0; i < p_buf->seg_count; ++i)
+        {
+            msg_buf_unref(p_buf->segs[i].p_buf);
+        }
+        for(i = 0; i < MSG_BUF_VARIANT_MAX; ++i)
+        {
+            p_variant = atomic_load_explicit(&p_buf->variants[i], memory_order_relaxed);
+            if(p_variant != p_buf)
+            {
+                msg_buf_unref(p_variant);
+            }
+        }
+        if(0 <= p_buf->file_fd)
+        {
+            close(p_buf->file_fd);
+        }
+        free(p_buf);
+    }
+}
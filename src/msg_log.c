@@ -0,0 +1,729 @@
+/*
+    Include files
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "msg_log.h"
+#include "protocol.h"
+
+/*
+    Variables
+*/
+
+static uint32_t msg_log_crc_table[256];     /* CRC32查表，初始化时生成 */
+static pthread_once_t msg_log_crc_once = PTHREAD_ONCE_INIT;
+
+/*
+    Function definitions
+*/
+
+/*
+    function    生成CRC32（IEEE 802.3，反射多项式0xEDB88320）查表
+    in
+    out
+    ret
+*/
+static void msg_log_crc_table_init(void)
+{
+    uint32_t c = 0;
+    int i = 0;
+    int k = 0;
+
+    for(i = 0; i < 256; ++i)
+    {
+        c = (uint32_t)i;
+        for(k = 0; k < 8; ++k)
+        {
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        msg_log_crc_table[i] = c;
+    }
+}
+
+/*
+    function    在已有校验和上累加一段数据，分段缓冲区逐段调用
+    in          crc             已有校验和，首段传0
+                data            数据
+                len             字节数
+    out
+    ret         新的校验和
+*/
+static uint32_t msg_log_crc32(IN uint32_t crc, IN const void *data, IN size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    crc = ~crc;
+    while(len--)
+    {
+        crc = msg_log_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/*
+    function    按大端序写入32位整数
+    in          value           整数
+    out         buf             至少4字节
+    ret
+*/
+static void msg_log_put_u32(IN uint32_t value, OUT char *buf)
+{
+    buf[0] = (char)(value >> 24);
+    buf[1] = (char)(value >> 16);
+    buf[2] = (char)(value >> 8);
+    buf[3] = (char)value;
+}
+
+/*
+    function    按大端序读出64位整数
+    in          buf             至少8字节
+    out
+    ret         整数
+*/
+static uint64_t msg_log_get_u64(IN const unsigned char *buf)
+{
+    uint64_t value = 0;
+    int i = 0;
+
+    for(i = 0; i < 8; ++i)
+    {
+        value = (value << 8) | buf[i];
+    }
+    return value;
+}
+
+/*
+    function    打开指定序号的新段文件与索引文件，并同步目录使新文件本身可持久
+    in          p_log           指向消息日志
+                segment_id      段序号
+    out
+    ret         errCode
+*/
+static ERR_CODE msg_log_segment_open(IN msg_log_t *p_log, IN long segment_id)
+{
+    char path[MSG_LOG_PATH_SIZE + 32] = {};
+    int index_fd = -1;
+    int dir_fd = -1;
+    int fd = -1;
+
+    snprintf(path, sizeof(path), "%s/%016ld" MSG_LOG_SEGMENT_SUFFIX, p_log->dir, segment_id);
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if(-1 == fd)
+    {
+        DBG_ERR("open log segment %s: %s", path, strerror(errno));
+        return ERR_FILE_OPEN;
+    }
+
+    /* 索引只是加速恢复的提示，打开失败时恢复退化为从段首解析 */
+    snprintf(path, sizeof(path), "%s/%016ld" MSG_LOG_INDEX_SUFFIX, p_log->dir, segment_id);
+    index_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(-1 == index_fd)
+    {
+        DBG_ERR("open log index %s: %s", path, strerror(errno));
+    }
+
+    dir_fd = open(p_log->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(-1 != dir_fd)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    if(-1 != p_log->fd)
+    {
+        close(p_log->fd);
+    }
+    if(-1 != p_log->index_fd)
+    {
+        close(p_log->index_fd);
+    }
+    p_log->fd = fd;
+    p_log->index_fd = index_fd;
+    p_log->segment_id = segment_id;
+    p_log->segment_len = 0;
+    p_log->index_next = MSG_LOG_INDEX_INTERVAL;   /* 段首偏移0不需要索引项 */
+    DBG("open log segment %ld", segment_id);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    只读映射一个文件，空文件或失败时返回NULL
+    in          path            文件路径
+    out         p_len           文件字节数
+    ret         映射地址
+*/
+static const char *msg_log_map(IN const char *path, OUT long *p_len)
+{
+    struct stat st = {};
+    void *addr = NULL;
+    int fd = -1;
+
+    *p_len = 0;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(-1 == fd)
+    {
+        return NULL;
+    }
+    if(0 == fstat(fd, &st) && 0 < st.st_size)
+    {
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(MAP_FAILED == addr)
+        {
+            DBG_ERR("mmap %s: %s", path, strerror(errno));
+            addr = NULL;
+        }
+        else
+        {
+            *p_len = st.st_size;
+        }
+    }
+    close(fd);
+
+    return (const char *)addr;
+}
+
+/*
+    function    段序号升序比较，供qsort使用
+    in          a               段
+                b               段
+    out
+    ret         比较结果
+*/
+static int msg_log_segment_cmp(IN const void *a, IN const void *b)
+{
+    long id_a = ((const msg_log_segment_t *)a)->id;
+    long id_b = ((const msg_log_segment_t *)b)->id;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+/*
+    function    扫描日志目录，按序号升序映射已有的段与索引，只建立映射，不读取内容
+    in          p_log           指向消息日志，dir已设置
+    out
+    ret         errCode
+*/
+static ERR_CODE msg_log_segments_map(IN msg_log_t *p_log)
+{
+    char path[MSG_LOG_PATH_SIZE + 32] = {};
+    msg_log_segment_t *p_segments = NULL;
+    msg_log_segment_t *p_seg = NULL;
+    struct dirent *p_entry = NULL;
+    DIR *p_dir = NULL;
+    char *p_end = NULL;
+    long index_len = 0;
+    long id = 0;
+    int cap = 0;
+    int i = 0;
+
+    p_dir = opendir(p_log->dir);
+    if(NULL == p_dir)
+    {
+        return ERR_NO_ERROR;
+    }
+    while(NULL != (p_entry = readdir(p_dir)))
+    {
+        id = strtol(p_entry->d_name, &p_end, 10);
+        if(p_end == p_entry->d_name || 0 != strcmp(p_end, MSG_LOG_SEGMENT_SUFFIX) || 0 >= id)
+        {
+            continue;
+        }
+        if(p_log->segment_count == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            p_segments = (msg_log_segment_t *)realloc(p_log->segments, sizeof(msg_log_segment_t) * cap);
+            if(NULL == p_segments)
+            {
+                DBG_ERR("realloc for log segments");
+                closedir(p_dir);
+                return ERR_NO_MEMORY;
+            }
+            p_log->segments = p_segments;
+        }
+        memset(&(p_log->segments[p_log->segment_count]), 0, sizeof(msg_log_segment_t));
+        p_log->segments[p_log->segment_count++].id = id;
+    }
+    closedir(p_dir);
+
+    qsort(p_log->segments, p_log->segment_count, sizeof(msg_log_segment_t), msg_log_segment_cmp);
+    for(i = 0; i < p_log->segment_count; ++i)
+    {
+        p_seg = &(p_log->segments[i]);
+        snprintf(path, sizeof(path), "%s/%016ld" MSG_LOG_SEGMENT_SUFFIX, p_log->dir, p_seg->id);
+        p_seg->data = msg_log_map(path, &(p_seg->len));
+        snprintf(path, sizeof(path), "%s/%016ld" MSG_LOG_INDEX_SUFFIX, p_log->dir, p_seg->id);
+        p_seg->index = (const unsigned char *)msg_log_map(path, &index_len);
+        p_seg->index_count = index_len / MSG_LOG_INDEX_ENTRY_SIZE;
+
+        /* 崩溃时写了一半的索引项无法校验，整个索引丢弃，恢复时从段首解析 */
+        if(NULL != p_seg->index && 0 != index_len % MSG_LOG_INDEX_ENTRY_SIZE)
+        {
+            munmap((void *)p_seg->index, index_len);
+            p_seg->index = NULL;
+            p_seg->index_count = 0;
+        }
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    解除已有段与索引的映射
+    in          p_log           指向消息日志
+    out
+    ret
+*/
+static void msg_log_segments_unmap(IN msg_log_t *p_log)
+{
+    msg_log_segment_t *p_seg = NULL;
+    int i = 0;
+
+    for(i = 0; i < p_log->segment_count; ++i)
+    {
+        p_seg = &(p_log->segments[i]);
+        if(NULL != p_seg->data)     munmap((void *)p_seg->data, p_seg->len);
+        if(NULL != p_seg->index)    munmap((void *)p_seg->index, p_seg->index_count * MSG_LOG_INDEX_ENTRY_SIZE);
+    }
+    free(p_log->segments);
+    p_log->segments = NULL;
+    p_log->segment_count = 0;
+}
+
+/*
+    function    把一批记录写入当前段并fdatasync，段已满时先滚动到新段，一批记录不跨段
+    in          p_log           指向消息日志
+                data            一批完整的记录
+                len             字节数
+    out
+    ret         errCode
+*/
+static ERR_CODE msg_log_commit(IN msg_log_t *p_log, IN const char *data, IN int len)
+{
+    char entry[MSG_LOG_INDEX_ENTRY_SIZE] = {};
+    long start = 0;
+    ssize_t n = 0;
+    int done = 0;
+
+    if(0 < p_log->segment_len && p_log->segment_len + len > p_log->segment_max)
+    {
+        PFM_ENSURE_RET(ERR_NO_ERROR == msg_log_segment_open(p_log, p_log->segment_id + 1), ERR_FILE_OPEN);
+    }
+    start = p_log->segment_len;
+
+    while(done < len)
+    {
+        n = write(p_log->fd, data + done, len - done);
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            DBG_ERR("write log segment %ld: %s", p_log->segment_id, strerror(errno));
+            return ERR_FILE_WRITE;
+        }
+        done += n;
+    }
+    p_log->segment_len += len;
+
+    if(0 != fdatasync(p_log->fd))
+    {
+        DBG_ERR("fdatasync log segment %ld: %s", p_log->segment_id, strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    p_log->commit_count++;
+
+    /* 每批记录的起点都是记录边界，间隔足够大时记一个索引项；索引不单独同步，恢复时逐项校验 */
+    if(-1 != p_log->index_fd && start >= p_log->index_next)
+    {
+        msg_log_put_u32((uint32_t)((uint64_t)start >> 32), entry);
+        msg_log_put_u32((uint32_t)start, entry + 4);
+        if(MSG_LOG_INDEX_ENTRY_SIZE == write(p_log->index_fd, entry, MSG_LOG_INDEX_ENTRY_SIZE))
+        {
+            p_log->index_next = start + MSG_LOG_INDEX_INTERVAL;
+        }
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    写线程：等到有记录后再等满一个提交周期或缓冲区过半，交换双缓冲区，在锁外整批落盘
+    in          arg             指向消息日志
+    out
+    ret         NULL
+*/
+static void *msg_log_writer(IN void *arg)
+{
+    msg_log_t *p_log = (msg_log_t *)arg;
+    struct timespec deadline = {};
+    char *p_swap = NULL;
+    int len = 0;
+
+    pthread_mutex_lock(&(p_log->mutex));
+    while(1)
+    {
+        while(0 == p_log->pending_len && !p_log->stop)
+        {
+            pthread_cond_wait(&(p_log->cond), &(p_log->mutex));
+        }
+        if(0 == p_log->pending_len)
+        {
+            break;
+        }
+
+        /* 组提交：同一周期内到达的记录合并为一次写入 */
+        if(0 < p_log->commit_ms)
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)p_log->commit_ms * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while(!p_log->stop && p_log->pending_len < p_log->buf_cap / 2 &&
+                  ETIMEDOUT != pthread_cond_timedwait(&(p_log->cond), &(p_log->mutex), &deadline))
+            {
+            }
+        }
+
+        p_swap = p_log->writing;
+        p_log->writing = p_log->pending;
+        p_log->pending = p_swap;
+        len = p_log->pending_len;
+        p_log->pending_len = 0;
+        pthread_cond_broadcast(&(p_log->space_cond));
+        pthread_mutex_unlock(&(p_log->mutex));
+
+        if(ERR_NO_ERROR != msg_log_commit(p_log, p_log->writing, len))
+        {
+            DBG_ERR("log commit of %d bytes failed", len);
+        }
+
+        pthread_mutex_lock(&(p_log->mutex));
+    }
+    pthread_mutex_unlock(&(p_log->mutex));
+
+    return NULL;
+}
+
+/*
+    function    初始化消息日志：创建日志目录，打开序号最大的段之后的新段，启动写线程
+    in          p_log           指向消息日志
+                dir             日志目录，不存在时创建
+                segment_max     段文件字节数上限
+                buf_cap         待写缓冲区字节数，写线程落后时工作线程在此阻塞
+                commit_ms       提交周期，毫秒
+    out
+    ret         errCode
+*/
+ERR_CODE msg_log_init(IN msg_log_t *p_log, IN const char *dir, IN long segment_max, IN int buf_cap, IN int commit_ms)
+{
+    PFM_ENSURE_RET(NULL != p_log && NULL != dir, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 < segment_max && 0 < buf_cap && 0 <= commit_ms, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(MSG_LOG_PATH_SIZE > strlen(dir), ERR_BAD_PARAM);
+
+    pthread_once(&msg_log_crc_once, msg_log_crc_table_init);
+
+    memset(p_log, 0, sizeof(msg_log_t));
+    p_log->fd = -1;
+    p_log->index_fd = -1;
+    p_log->buf_cap = buf_cap;
+    p_log->commit_ms = commit_ms;
+    p_log->segment_max = segment_max;
+    strcpy(p_log->dir, dir);
+
+    if(0 != mkdir(dir, 0755) && EEXIST != errno)
+    {
+        DBG_ERR("mkdir log dir %s: %s", dir, strerror(errno));
+        return ERR_FILE_OPEN;
+    }
+    /* 已有的段只映射，恢复历史时才按需解析；新记录写入序号更大的新段 */
+    if(ERR_NO_ERROR != msg_log_segments_map(p_log) ||
+        ERR_NO_ERROR != msg_log_segment_open(p_log, p_log->segment_count ? p_log->segments[p_log->segment_count - 1].id + 1 : 1))
+    {
+        goto err;
+    }
+
+    p_log->pending = (char *)malloc(buf_cap);
+    p_log->writing = (char *)malloc(buf_cap);
+    if(NULL == p_log->pending || NULL == p_log->writing)
+    {
+        DBG_ERR("malloc for log buffers");
+        goto err;
+    }
+
+    pthread_mutex_init(&(p_log->mutex), NULL);
+    pthread_cond_init(&(p_log->cond), NULL);
+    pthread_cond_init(&(p_log->space_cond), NULL);
+    if(0 != pthread_create(&(p_log->thread), NULL, msg_log_writer, p_log))
+    {
+        DBG_ERR("create log writer thread");
+        pthread_mutex_destroy(&(p_log->mutex));
+        pthread_cond_destroy(&(p_log->cond));
+        pthread_cond_destroy(&(p_log->space_cond));
+        goto err;
+    }
+
+    DBG_ALZ("message log %s, %d existing segments mapped, segment %ld, commit every %d ms",
+            dir, p_log->segment_count, p_log->segment_id, commit_ms);
+    return ERR_NO_ERROR;
+
+err:
+    free(p_log->pending);
+    free(p_log->writing);
+    if(-1 != p_log->fd)         close(p_log->fd);
+    if(-1 != p_log->index_fd)   close(p_log->index_fd);
+    msg_log_segments_unmap(p_log);
+    memset(p_log, 0, sizeof(msg_log_t));
+    p_log->fd = -1;
+    p_log->index_fd = -1;
+
+    return ERR_FILE_OPEN;
+}
+
+/*
+    function    销毁消息日志：通知写线程把剩余记录落盘后退出，关闭段文件
+    in          p_log           指向消息日志
+    out
+    ret
+*/
+void msg_log_destroy(IN msg_log_t *p_log)
+{
+    if(NULL == p_log || NULL == p_log->pending)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(p_log->mutex));
+    p_log->stop = 1;
+    pthread_cond_signal(&(p_log->cond));
+    pthread_cond_broadcast(&(p_log->space_cond));
+    pthread_mutex_unlock(&(p_log->mutex));
+    pthread_join(p_log->thread, NULL);
+
+    DBG_ALZ("message log closed, %ld records in %ld commits, last segment %ld",
+            p_log->record_count, p_log->commit_count, p_log->segment_id);
+
+    close(p_log->fd);
+    if(-1 != p_log->index_fd)
+    {
+        close(p_log->index_fd);
+    }
+    msg_log_segments_unmap(p_log);
+    free(p_log->pending);
+    free(p_log->writing);
+    pthread_mutex_destroy(&(p_log->mutex));
+    pthread_cond_destroy(&(p_log->cond));
+    pthread_cond_destroy(&(p_log->space_cond));
+    memset(p_log, 0, sizeof(msg_log_t));
+    p_log->fd = -1;
+    p_log->index_fd = -1;
+}
+
+/*
+    function    追加一帧：计算校验和并拷贝到待写缓冲区后返回，不等待落盘
+    in          p_log           指向消息日志
+                p_buf           已编码的完整帧，可为分段缓冲区
+    out
+    ret         errCode
+*/
+ERR_CODE msg_log_append(IN msg_log_t *p_log, IN msg_buf_t *p_buf)
+{
+    struct iovec iov[MSG_BUF_SEG_MAX + 1];
+    char header[MSG_LOG_RECORD_HEADER_SIZE] = {};
+    uint32_t crc = 0;
+    int record_len = 0;
+    int iov_count = 0;
+    int offset = 0;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_log && NULL != p_buf, ERR_BAD_PARAM);
+
+    record_len = MSG_LOG_RECORD_HEADER_SIZE + p_buf->len;
+    PFM_ENSURE_RET(record_len <= p_log->buf_cap, ERR_BAD_PARAM);
+
+    /* 校验和在锁外计算，锁内只做拷贝 */
+    iov_count = msg_buf_iov(p_buf, 0, iov, MSG_BUF_SEG_MAX + 1);
+    for(i = 0; i < iov_count; ++i)
+    {
+        crc = msg_log_crc32(crc, iov[i].iov_base, iov[i].iov_len);
+    }
+    msg_log_put_u32((uint32_t)p_buf->len, header);
+    msg_log_put_u32(crc, header + 4);
+
+    pthread_mutex_lock(&(p_log->mutex));
+    while(p_log->pending_len + record_len > p_log->buf_cap && !p_log->stop)
+    {
+        pthread_cond_wait(&(p_log->space_cond), &(p_log->mutex));
+    }
+    if(p_log->stop)
+    {
+        pthread_mutex_unlock(&(p_log->mutex));
+        return ERR_FILE_WRITE;
+    }
+
+    offset = p_log->pending_len;
+    memcpy(p_log->pending + offset, header, MSG_LOG_RECORD_HEADER_SIZE);
+    offset += MSG_LOG_RECORD_HEADER_SIZE;
+    for(i = 0; i < iov_count; ++i)
+    {
+        memcpy(p_log->pending + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+
+    /* 缓冲区由空变为非空时唤醒写线程开始计时，过半时提前唤醒 */
+    if(0 == p_log->pending_len || (offset >= p_log->buf_cap / 2 && p_log->pending_len < p_log->buf_cap / 2))
+    {
+        pthread_cond_signal(&(p_log->cond));
+    }
+    p_log->pending_len = offset;
+    p_log->record_count++;
+    pthread_mutex_unlock(&(p_log->mutex));
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    解析段内[start, end)之间的记录，把匹配的帧依次放入环形的候选数组，只保留最后max_count条
+    in          p_seg           段
+                start           块起点，记录边界
+                end             块终点
+                match           匹配函数
+                arg             匹配函数参数
+                max_count       候选数组容量
+    out         frames          候选帧
+                lens            候选帧字节数
+                p_total         块内匹配的总条数，可能超过max_count
+    ret
+*/
+static void msg_log_chunk_scan(IN const msg_log_segment_t *p_seg, IN long start, IN long end, IN msg_log_match_t match, IN void *arg,
+                               IN int max_count, OUT const char **frames, OUT int *lens, OUT long *p_total)
+{
+    const unsigned char *p = NULL;
+    uint32_t frame_len = 0;
+    uint32_t crc = 0;
+    long offset = start;
+    long total = 0;
+
+    while(offset + MSG_LOG_RECORD_HEADER_SIZE <= end)
+    {
+        p = (const unsigned char *)p_seg->data + offset;
+        frame_len = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        crc = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+        if(frame_len < MSG_FRAME_LEGACY_HEADER_SIZE || frame_len > (uint32_t)(end - offset - MSG_LOG_RECORD_HEADER_SIZE))
+        {
+            DBG_ERR("log segment %ld truncated at offset %ld", p_seg->id, offset);
+            break;
+        }
+
+        /* 只校验匹配的记录，不匹配的记录只读记录头跳过 */
+        if(match((const char *)p + MSG_LOG_RECORD_HEADER_SIZE, (int)frame_len, arg))
+        {
+            if(crc != msg_log_crc32(0, p + MSG_LOG_RECORD_HEADER_SIZE, frame_len))
+            {
+                DBG_ERR("log segment %ld corrupted at offset %ld", p_seg->id, offset);
+                break;
+            }
+            frames[total % max_count] = (const char *)p + MSG_LOG_RECORD_HEADER_SIZE;
+            lens[total % max_count] = (int)frame_len;
+            total++;
+        }
+        offset += MSG_LOG_RECORD_HEADER_SIZE + frame_len;
+    }
+
+    *p_total = total;
+}
+
+/*
+    function    从启动前已有的段中找出最近max_count条匹配的记录：按稀疏索引把段切成小块，从最新的块向前逐块解析，
+                找够即停止，不必解析整个日志；长度越界或校验和不符的记录及其后的数据视为崩溃时未写完，予以忽略
+    in          p_log           指向消息日志
+                match           匹配函数
+                arg             匹配函数参数
+                max_scan        最多解析的字节数，更早的记录不再恢复
+                max_count       最多返回的记录数
+    out         frames          按时间顺序的帧，指向映射的页面，消息日志销毁前有效
+                lens            各帧字节数
+    ret         找到的记录数
+*/
+int msg_log_recover(IN msg_log_t *p_log, IN msg_log_match_t match, IN void *arg, IN long max_scan, IN int max_count,
+                    OUT const char **frames, OUT int *lens)
+{
+    const msg_log_segment_t *p_seg = NULL;
+    const char **chunk_frames = NULL;
+    int *chunk_lens = NULL;
+    long chunk_total = 0;
+    long scanned = 0;
+    long start = 0;
+    long end = 0;
+    long k = 0;
+    int found = 0;
+    int take = 0;
+    int i = 0;
+    int j = 0;
+
+    PFM_ENSURE_RET(NULL != p_log && NULL != match && NULL != frames && NULL != lens, 0);
+    if(0 >= max_count || 0 == p_log->segment_count)
+    {
+        return 0;
+    }
+
+    chunk_frames = (const char **)malloc(sizeof(const char *) * max_count);
+    chunk_lens = (int *)malloc(sizeof(int) * max_count);
+    if(NULL == chunk_frames || NULL == chunk_lens)
+    {
+        DBG_ERR("malloc for log recover");
+        free(chunk_frames);
+        free(chunk_lens);
+        return 0;
+    }
+
+    /* 结果从数组尾部向前填充，最后整体移到数组头部 */
+    for(i = p_log->segment_count - 1; i >= 0 && found < max_count && scanned < max_scan; --i)
+    {
+        p_seg = &(p_log->segments[i]);
+        if(NULL == p_seg->data)
+        {
+            continue;
+        }
+
+        /* 索引项k是第k+1块的起点，非法或不递增的索引项被跳过，相邻两块合并解析 */
+        end = p_seg->len;
+        for(k = p_seg->index_count - 1; k >= -1 && found < max_count && scanned < max_scan; --k)
+        {
+            start = (0 <= k) ? (long)msg_log_get_u64(p_seg->index + k * MSG_LOG_INDEX_ENTRY_SIZE) : 0;
+            if(start < 0 || start >= end)
+            {
+                continue;
+            }
+
+            msg_log_chunk_scan(p_seg, start, end, match, arg, max_count - found, chunk_frames, chunk_lens, &chunk_total);
+            take = (chunk_total < max_count - found) ? (int)chunk_total : max_count - found;
+            for(j = 0; j < take; ++j)
+            {
+                /* 候选数组中最早的一条位于chunk_total - take处 */
+                frames[max_count - found - take + j] = chunk_frames[(chunk_total - take + j) % (max_count - found)];
+                lens[max_count - found - take + j] = chunk_lens[(chunk_total - take + j) % (max_count - found)];
+            }
+            found += take;
+            scanned += end - start;
+            end = start;
+        }
+    }
+
+    memmove(frames, frames + max_count - found, sizeof(const char *) * found);
+    memmove(lens, lens + max_count - found, sizeof(int) * found);
+    free(chunk_frames);
+    free(chunk_lens);
+
+    DBG("log recover found %d records in %ld bytes", found, scanned);
+    return found;
+}
@@ -0,0 +1,297 @@
+/*
+    Include files
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "obj_pool.h"
+
+/*
+    Typedefs
+*/
+
+/* 线程本地缓存，每个线程为每个对象池槽位保留一个 */
+typedef struct obj_cache_s
+{
+    unsigned long gen;      /* 所属对象池代号，与对象池不一致时缓存作废 */
+    obj_free_t *head;       /* 本地空闲链表 */
+    int count;              /* 本地空闲对象数 */
+    long allocs;            /* 尚未汇总到对象池的分配次数 */
+    long frees;             /* 尚未汇总到对象池的释放次数 */
+}obj_cache_t;
+
+/* slab头部，对象紧随其后 */
+typedef struct obj_slab_s
+{
+    struct obj_slab_s *next;
+    long pad;               /* 保证对象起始地址按OBJ_POOL_ALIGN对齐 */
+}obj_slab_t;
+
+/*
+    Variables
+*/
+
+/* 对象池代号从1开始递增且不复用，销毁后重建的对象池不会误用旧线程缓存 */
+static atomic_ulong obj_pool_gen = 1;
+static __thread obj_cache_t tls_caches[OBJ_POOL_MAX];
+
+/*
+    Function definitions
+*/
+
+/*
+    function    对象池初始化
+    in          p_pool          对象池指针
+                name            对象池名称
+                obj_size        对象大小
+                slab_objs       每个slab中的对象数
+    out
+    ret         errCode
+*/
+ERR_CODE obj_pool_init(IN obj_pool_t *p_pool, IN const char *name, IN int obj_size, IN int slab_objs)
+{
+    PFM_ENSURE_RET(NULL != p_pool && 0 < obj_size && 0 < slab_objs, ERR_BAD_PARAM);
+
+    /* 空闲对象需要容纳两个链接指针 */
+    if(obj_size < (int)sizeof(obj_free_t))
+    {
+        obj_size = sizeof(obj_free_t);
+    }
+
+    p_pool->name = name;
+    p_pool->obj_size = (obj_size + OBJ_POOL_ALIGN - 1) & ~(OBJ_POOL_ALIGN - 1);
+    p_pool->slab_objs = slab_objs;
+    p_pool->gen = atomic_fetch_add(&obj_pool_gen, 1);
+    pthread_mutex_init(&(p_pool->mutex), NULL);
+    p_pool->depot = NULL;
+    p_pool->depot_batches = 0;
+    p_pool->slabs = NULL;
+    atomic_init(&(p_pool->slab_count), 0);
+    atomic_init(&(p_pool->alloc_count), 0);
+    atomic_init(&(p_pool->free_count), 0);
+    atomic_init(&(p_pool->transfer_count), 0);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    对象池销毁，释放所有slab，调用时不能再有线程使用对象池中的对象
+    in          p_pool          对象池指针
+    out
+    ret
+*/
+void obj_pool_destroy(IN obj_pool_t *p_pool)
+{
+    obj_slab_t *p_slab = NULL;
+
+    if(NULL == p_pool)
+    {
+        return;
+    }
+
+    while(p_pool->slabs)
+    {
+        p_slab = (obj_slab_t *)p_pool->slabs;
+        p_pool->slabs = p_slab->next;
+        free(p_slab);
+    }
+    p_pool->depot = NULL;
+    p_pool->depot_batches = 0;
+    pthread_mutex_destroy(&(p_pool->mutex));
+}
+
+/*
+    function    获取当前线程对应对象池的本地缓存，缓存属于已销毁的对象池时丢弃
+    in          p_pool          对象池指针
+    out
+    ret         本地缓存
+*/
+static obj_cache_t *obj_cache_get(IN obj_pool_t *p_pool)
+{
+    obj_cache_t *p_cache = &(tls_caches[p_pool->gen % OBJ_POOL_MAX]);
+
+    if(p_cache->gen != p_pool->gen)
+    {
+        memset(p_cache, 0, sizeof(obj_cache_t));
+        p_cache->gen = p_pool->gen;
+    }
+
+    return p_cache;
+}
+
+/*
+    function    把本地缓存中的分配释放计数汇总到对象池，调用者在批量转移时调用
+    in          p_pool          对象池指针
+                p_cache         本地缓存
+    out
+    ret
+*/
+static void obj_cache_flush_stats(IN obj_pool_t *p_pool, IN obj_cache_t *p_cache)
+{
+    atomic_fetch_add_explicit(&(p_pool->alloc_count), p_cache->allocs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(p_pool->free_count), p_cache->frees, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(p_pool->transfer_count), 1, memory_order_relaxed);
+    p_cache->allocs = 0;
+    p_cache->frees = 0;
+}
+
+/*
+    function    本地缓存为空时补充对象，优先从仓库取一批，仓库为空时申请新slab
+    in          p_pool          对象池指针
+                p_cache         本地缓存
+    out
+    ret         errCode
+*/
+static ERR_CODE obj_cache_refill(IN obj_pool_t *p_pool, IN obj_cache_t *p_cache)
+{
+    obj_free_t *p_batch = NULL;
+    obj_slab_t *p_slab = NULL;
+    char *p_obj = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&(p_pool->mutex));
+    p_batch = p_pool->depot;
+    if(p_batch)
+    {
+        p_pool->depot = p_batch->next_batch;
+        p_pool->depot_batches--;
+    }
+    pthread_mutex_unlock(&(p_pool->mutex));
+
+    obj_cache_flush_stats(p_pool, p_cache);
+
+    if(p_batch)
+    {
+        p_cache->head = p_batch;
+        p_cache->count = OBJ_POOL_BATCH;
+        return ERR_NO_ERROR;
+    }
+
+    p_slab = (obj_slab_t *)malloc(sizeof(obj_slab_t) + (size_t)p_pool->obj_size * p_pool->slab_objs);
+    if(NULL == p_slab)
+    {
+        DBG_ERR("malloc for %s slab", p_pool->name);
+        return ERR_NO_MEMORY;
+    }
+
+    /* 新slab整体切分进本地缓存，多出的部分在释放时按批归还仓库 */
+    p_obj = (char *)(p_slab + 1);
+    for(i = p_pool->slab_objs - 1; i >= 0; --i)
+    {
+        obj_free_t *p_free = (obj_free_t *)(p_obj + (size_t)i * p_pool->obj_size);
+        p_free->next = p_cache->head;
+        p_cache->head = p_free;
+    }
+    p_cache->count += p_pool->slab_objs;
+
+    pthread_mutex_lock(&(p_pool->mutex));
+    p_slab->next = (obj_slab_t *)p_pool->slabs;
+    p_pool->slabs = p_slab;
+    pthread_mutex_unlock(&(p_pool->mutex));
+    atomic_fetch_add_explicit(&(p_pool->slab_count), 1, memory_order_relaxed);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    分配一个对象，内容未初始化
+    in          p_pool          对象池指针
+    out
+    ret         对象指针，内存不足时返回NULL
+*/
+void *obj_pool_alloc(IN obj_pool_t *p_pool)
+{
+    obj_cache_t *p_cache = NULL;
+    obj_free_t *p_free = NULL;
+
+    PFM_ENSURE_RET(NULL != p_pool, NULL);
+
+    p_cache = obj_cache_get(p_pool);
+    if(NULL == p_cache->head && ERR_NO_ERROR != obj_cache_refill(p_pool, p_cache))
+    {
+        return NULL;
+    }
+
+    p_free = p_cache->head;
+    p_cache->head = p_free->next;
+    p_cache->count--;
+    p_cache->allocs++;
+
+    return p_free;
+}
+
+/*
+    function    释放一个对象，可在任意线程释放
+    in          p_pool          对象池指针
+                p_obj           对象指针，可为NULL
+    out
+    ret
+*/
+void obj_pool_free(IN obj_pool_t *p_pool, IN void *p_obj)
+{
+    obj_cache_t *p_cache = NULL;
+    obj_free_t *p_free = (obj_free_t *)p_obj;
+    obj_free_t *p_batch = NULL;
+    obj_free_t *p_tail = NULL;
+    int i = 0;
+
+    if(NULL == p_pool || NULL == p_obj)
+    {
+        return;
+    }
+
+    p_cache = obj_cache_get(p_pool);
+    p_free->next = p_cache->head;
+    p_cache->head = p_free;
+    p_cache->count++;
+    p_cache->frees++;
+
+    /* 本地缓存超过两批时归还一批，避免只释放不分配的线程无限囤积对象 */
+    if(p_cache->count <= 2 * OBJ_POOL_BATCH)
+    {
+        return;
+    }
+
+    p_batch = p_cache->head;
+    p_tail = p_batch;
+    for(i = 1; i < OBJ_POOL_BATCH; ++i)
+    {
+        p_tail = p_tail->next;
+    }
+    p_cache->head = p_tail->next;
+    p_cache->count -= OBJ_POOL_BATCH;
+    p_tail->next = NULL;
+
+    pthread_mutex_lock(&(p_pool->mutex));
+    p_batch->next_batch = p_pool->depot;
+    p_pool->depot = p_batch;
+    p_pool->depot_batches++;
+    pthread_mutex_unlock(&(p_pool->mutex));
+
+    obj_cache_flush_stats(p_pool, p_cache);
+}
+
+/*
+    function    获取对象池统计
+    in          p_pool          对象池指针
+    out         p_stats         统计
+    ret
+*/
+void obj_pool_stats(IN obj_pool_t *p_pool, OUT obj_pool_stats_t *p_stats)
+{
+    if(NULL == p_pool || NULL == p_stats)
+    {
+        return;
+    }
+
+    p_stats->slab_count = atomic_load_explicit(&(p_pool->slab_count), memory_order_relaxed);
+    p_stats->obj_total = p_stats->slab_count * p_pool->slab_objs;
+    p_stats->alloc_count = atomic_load_explicit(&(p_pool->alloc_count), memory_order_relaxed);
+    p_stats->free_count = atomic_load_explicit(&(p_pool->free_count), memory_order_relaxed);
+    p_stats->transfer_count = atomic_load_explicit(&(p_pool->transfer_count), memory_order_relaxed);
+
+    pthread_mutex_lock(&(p_pool->mutex));
+    p_stats->depot_objs = p_pool->depot_batches * OBJ_POOL_BATCH;
+    pthread_mutex_unlock(&(p_pool->mutex));
+}
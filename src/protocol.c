@@ -0,0 +1,564 @@
+/*
+    Include files
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <zlib.h>
+
+#include "protocol.h"
+
+/*
+    Function definitions
+*/
+
+/*
+    function    写满len字节，处理EINTR与部分写
+    in          fd      socket文件描述符
+                buf     待发送数据
+                len     数据长度
+    out
+    ret         errCode
+*/
+static ERR_CODE send_all(IN int fd, IN const char *buf, IN int len)
+{
+    ssize_t n = 0;
+
+    while(len > 0)
+    {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            return ERR_PROTOCOL_IO;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    读满len字节，处理EINTR与部分读
+    in          fd      socket文件描述符
+                len     需要读取的长度
+    out         buf     接收缓冲区
+    ret         errCode
+*/
+static ERR_CODE recv_all(IN int fd, OUT char *buf, IN int len)
+{
+    ssize_t n = 0;
+
+    while(len > 0)
+    {
+        n = recv(fd, buf, len, 0);
+        if(0 == n)
+        {
+            return ERR_PROTOCOL_CLOSED;
+        }
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            return ERR_PROTOCOL_IO;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    编码帧头，数据由调用者另行接在帧头之后，可用于分段发送
+    in          version         帧格式版本，0为旧格式，旧格式不携带flags
+                protocol        协议类型
+                flags           帧标志
+                length          消息数据长度
+    out         buf             帧头输出缓冲区，至少MSG_FRAME_HEADER_MAX字节
+    ret         帧头长度，失败返回-1
+*/
+int msg_frame_header_encode(IN uint8_t version, IN msg_type_t protocol, IN uint8_t flags, IN int length, OUT char *buf)
+{
+    int pos = 0;
+
+    PFM_ENSURE_RET(NULL != buf, -1);
+    PFM_ENSURE_RET(MSG_FRAME_VERSION >= version, -1);
+    PFM_ENSURE_RET(0 <= length && (MSG_FRAME_DATA_MAX >= length ||
+                   (0 < version && MSG_FRAME_STREAMABLE(protocol) && MSG_FRAME_STREAM_MAX >= length)), -1);
+
+    if(0 == version)
+    {
+        buf[0] = (char)protocol;
+        buf[1] = (char)((length >> 16) & 0xff);
+        buf[2] = (char)((length >> 8) & 0xff);
+        buf[3] = (char)(length & 0xff);
+        return MSG_FRAME_LEGACY_HEADER_SIZE;
+    }
+
+    buf[pos++] = (char)(MSG_FRAME_VERSIONED | version);
+    buf[pos++] = (char)protocol;
+    buf[pos++] = (char)flags;
+
+    /* 长度按7位一组从高到低输出，除最后一组外最高位置1 */
+    if(length >= (1 << 21))     buf[pos++] = (char)(0x80 | ((length >> 21) & 0x7f));
+    if(length >= (1 << 14))     buf[pos++] = (char)(0x80 | ((length >> 14) & 0x7f));
+    if(length >= (1 << 7))      buf[pos++] = (char)(0x80 | ((length >> 7) & 0x7f));
+    buf[pos++] = (char)(length & 0x7f);
+
+    return pos;
+}
+
+/*
+    function    编码帧，帧头后紧跟length字节数据
+    in          version         帧格式版本，0为旧格式
+                protocol        协议类型
+                data            消息数据，length为0时可为NULL
+                length          消息数据长度
+                size            输出缓冲区大小
+    out         buf             帧输出缓冲区
+    ret         帧长度，失败返回-1
+*/
+int msg_frame_encode(IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length, OUT char *buf, IN int size)
+{
+    char header[MSG_FRAME_HEADER_MAX] = {};
+    int header_len = 0;
+
+    PFM_ENSURE_RET(NULL != buf, -1);
+    PFM_ENSURE_RET(0 == length || NULL != data, -1);
+
+    header_len = msg_frame_header_encode(version, protocol, 0, length, header);
+    PFM_ENSURE_RET(0 < header_len && header_len + length <= size, -1);
+
+    memcpy(buf, header, header_len);
+    if(length > 0)
+    {
+        memcpy(buf + header_len, data, length);
+    }
+
+    return header_len + length;
+}
+
+/*
+    function    从字节流中解析一帧的帧头，两种格式均可解析，不拷贝数据，数据位于buf + header_len；
+                只读取帧头，判断整帧是否到齐只比较长度；帧头完整而数据不足时也填写帧头
+    in          buf             字节流
+                len             字节流长度
+    out         p_header        帧头，帧头不完整时不修改
+    ret         >0 整帧字节数，0 数据不足一帧，-1 帧非法
+*/
+int msg_frame_header_decode(IN const char *buf, IN int len, OUT msg_header_t *p_header)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    msg_header_t header = {};
+    int pos = 0;
+
+    PFM_ENSURE_RET(NULL != buf && NULL != p_header, -1);
+
+    if(len < 1)
+    {
+        return 0;
+    }
+
+    if(0 == (p[0] & MSG_FRAME_VERSIONED))
+    {
+        if(len < MSG_FRAME_LEGACY_HEADER_SIZE)
+        {
+            return 0;
+        }
+        header.protocol = (msg_type_t)p[0];
+        header.length = (p[1] << 16) | (p[2] << 8) | p[3];
+        header.header_len = MSG_FRAME_LEGACY_HEADER_SIZE;
+    }
+    else
+    {
+        header.version = p[0] & ~MSG_FRAME_VERSIONED;
+        if(0 == header.version)
+        {
+            DBG_ERR("bad frame version byte 0x%02x", p[0]);
+            return -1;
+        }
+
+        /* 更高版本的帧头前三个字节与长度编码保持不变，数据按本端理解的版本处理 */
+        for(pos = 3; ; ++pos)
+        {
+            /* 先判断长度字段是否超长，第4个字节仍带续位时立即判为非法，调用者不会再为帧头多读一个字节 */
+            if(pos - 3 >= MSG_FRAME_VARINT_MAX)
+            {
+                DBG_ERR("frame length varint too long");
+                return -1;
+            }
+            if(pos >= len)
+            {
+                return 0;
+            }
+            header.length = (header.length << 7) | (p[pos] & 0x7f);
+            if(0 == (p[pos] & 0x80))
+            {
+                break;
+            }
+        }
+        header.protocol = (msg_type_t)p[1];
+        header.flags = p[2];
+        header.header_len = pos + 1;
+    }
+
+    /* 只有版本帧的公共消息与文件可以是流式帧，压缩帧不能是流式帧 */
+    if(header.length > MSG_FRAME_DATA_MAX &&
+        (0 == header.version || !MSG_FRAME_STREAMABLE(header.protocol) || (header.flags & MSG_FLAG_COMPRESSED)))
+    {
+        DBG_ERR("frame length %d exceeds %d", header.length, MSG_FRAME_DATA_MAX);
+        return -1;
+    }
+
+    *p_header = header;
+    if(len < header.header_len + header.length)
+    {
+        return 0;
+    }
+    return header.header_len + header.length;
+}
+
+/*
+    function    从字节流中解码一帧
+    in          buf             字节流
+                len             字节流长度
+    out         p_msg           解码后的消息，data以'\0'结尾
+    ret         >0 消费的字节数，0 数据不足一帧，-1 帧非法
+*/
+int msg_frame_decode(IN const char *buf, IN int len, OUT msg_t *p_msg)
+{
+    msg_header_t header = {};
+    int frame_len = 0;
+
+    PFM_ENSURE_RET(NULL != buf && NULL != p_msg, -1);
+
+    frame_len = msg_frame_header_decode(buf, len, &header);
+    if(header.length > MSG_FRAME_DATA_MAX)
+    {
+        DBG_ERR("stream frame of %d bytes cannot be decoded in memory", header.length);
+        return -1;
+    }
+    if(frame_len <= 0)
+    {
+        return frame_len;
+    }
+    p_msg->header = header;
+
+    if(header.flags & MSG_FLAG_COMPRESSED)
+    {
+        p_msg->header.length = msg_data_decompress(buf + header.header_len, header.length, p_msg->data, MSG_FRAME_DATA_MAX);
+        PFM_ENSURE_RET(0 <= p_msg->header.length, -1);
+        p_msg->header.flags &= ~MSG_FLAG_COMPRESSED;
+    }
+    else
+    {
+        memcpy(p_msg->data, buf + header.header_len, header.length);
+    }
+    p_msg->data[p_msg->header.length] = '\0';
+
+    return frame_len;
+}
+
+/*
+    function    压缩消息数据
+    in          data            消息数据
+                length          数据长度
+                size            输出缓冲区大小
+    out         buf             压缩后的数据
+    ret         压缩后的长度，压缩失败或不比原数据短时返回-1，调用者应发送原数据
+*/
+int msg_data_compress(IN const char *data, IN int length, OUT char *buf, IN int size)
+{
+    uLongf out_len = size;
+
+    PFM_ENSURE_RET(NULL != data && NULL != buf && 0 <= length && 0 <= size, -1);
+
+    /* 输出缓冲区不足说明压缩后不会更短，Z_BUF_ERROR与其他失败一样按不压缩处理 */
+    if(Z_OK != compress2((Bytef *)buf, &out_len, (const Bytef *)data, length, MSG_COMPRESS_LEVEL) || (int)out_len >= length)
+    {
+        return -1;
+    }
+
+    return (int)out_len;
+}
+
+/*
+    function    解压压缩帧的数据
+    in          data            压缩后的数据
+                length          压缩后的长度
+                size            输出缓冲区大小，解压后超过该大小视为帧非法
+    out         buf             解压后的数据
+    ret         解压后的长度，失败返回-1
+*/
+int msg_data_decompress(IN const char *data, IN int length, OUT char *buf, IN int size)
+{
+    uLongf out_len = size;
+    int ret = 0;
+
+    PFM_ENSURE_RET(NULL != data && NULL != buf && 0 <= length && 0 <= size, -1);
+
+    ret = uncompress((Bytef *)buf, &out_len, (const Bytef *)data, length);
+    if(Z_OK != ret)
+    {
+        DBG_ERR("decompress %d bytes failed: %d", length, ret);
+        return -1;
+    }
+
+    return (int)out_len;
+}
+
+/*
+    function    编码能力块
+    in          version         帧格式版本
+                caps            能力位
+    out         buf             至少MSG_CAPS_SIZE字节
+    ret         能力块长度
+*/
+int msg_caps_encode(IN uint8_t version, IN uint8_t caps, OUT char *buf)
+{
+    PFM_ENSURE_RET(NULL != buf, -1);
+
+    buf[0] = (char)version;
+    buf[1] = (char)caps;
+
+    return MSG_CAPS_SIZE;
+}
+
+/*
+    function    解析能力块，只取已知的前MSG_CAPS_SIZE字节，能力块可能随版本增长
+    in          buf             能力块
+                len             能力块长度
+    out         p_version       帧格式版本
+                p_caps          能力位
+    ret         1 成功，0 长度不足
+*/
+int msg_caps_decode(IN const char *buf, IN int len, OUT uint8_t *p_version, OUT uint8_t *p_caps)
+{
+    PFM_ENSURE_RET(NULL != buf && NULL != p_version && NULL != p_caps, 0);
+
+    if(len < MSG_CAPS_SIZE)
+    {
+        return 0;
+    }
+    *p_version = (uint8_t)buf[0];
+    *p_caps = (uint8_t)buf[1];
+
+    return 1;
+}
+
+/*
+    function    解析注册帧数据"用户名\0能力块"，没有能力块时按旧客户端处理
+    in          data            注册帧数据
+                length          数据长度
+    out         p_name_len      用户名长度
+                p_version       对端支持的最高帧格式版本，旧客户端为0
+                p_caps          对端能力位，旧客户端为0
+    ret         1 带能力块，0 旧格式注册
+*/
+int msg_register_decode(IN const char *data, IN int length, OUT int *p_name_len, OUT uint8_t *p_version, OUT uint8_t *p_caps)
+{
+    const char *p_nul = NULL;
+
+    PFM_ENSURE_RET(NULL != data && NULL != p_name_len && NULL != p_version && NULL != p_caps, 0);
+
+    *p_version = 0;
+    *p_caps = 0;
+    p_nul = (const char *)memchr(data, '\0', length);
+    if(NULL == p_nul)
+    {
+        *p_name_len = length;
+        return 0;
+    }
+
+    *p_name_len = p_nul - data;
+    return msg_caps_decode(p_nul + 1, length - *p_name_len - 1, p_version, p_caps);
+}
+
+/*
+    function    阻塞发送一帧
+    in          fd              socket文件描述符
+                version         帧格式版本，0为旧格式
+                protocol        协议类型
+                data            消息数据
+                length          消息数据长度
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length)
+{
+    char frame[MSG_FRAME_SIZE_MAX] = {};
+    int frame_len = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    PFM_ENSURE_RET(-1 != fd, ERR_BAD_PARAM);
+
+    /* 流式帧不拷贝数据，帧头与数据分两次发送 */
+    if(length > MSG_FRAME_DATA_MAX)
+    {
+        frame_len = msg_frame_header_encode(version, protocol, 0, length, frame);
+        PFM_ENSURE_RET(0 < frame_len && NULL != data, ERR_PROTOCOL_FRAME);
+
+        ret = send_all(fd, frame, frame_len);
+        return (ERR_NO_ERROR == ret) ? send_all(fd, data, length) : ret;
+    }
+
+    frame_len = msg_frame_encode(version, protocol, data, length, frame, sizeof(frame));
+    PFM_ENSURE_RET(0 < frame_len, ERR_PROTOCOL_FRAME);
+
+    return send_all(fd, frame, frame_len);
+}
+
+/*
+    function    阻塞发送一帧，数据不少于MSG_COMPRESS_MIN且压缩后更短时发送压缩帧，只用于对端声明了MSG_CAPS_COMPRESS的版本帧；
+                流式帧与其余情况同msg_frame_send
+    in          fd              socket文件描述符
+                version         帧格式版本
+                protocol        协议类型
+                data            消息数据
+                length          消息数据长度
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send_compressed(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length)
+{
+    char packed[MSG_FRAME_DATA_MAX] = {};
+    char frame[MSG_FRAME_SIZE_MAX] = {};
+    int packed_len = -1;
+    int header_len = 0;
+
+    PFM_ENSURE_RET(-1 != fd, ERR_BAD_PARAM);
+
+    if(0 < version && MSG_COMPRESS_MIN <= length && MSG_FRAME_DATA_MAX >= length)
+    {
+        packed_len = msg_data_compress(data, length, packed, sizeof(packed));
+    }
+    if(packed_len < 0)
+    {
+        return msg_frame_send(fd, version, protocol, data, length);
+    }
+
+    header_len = msg_frame_header_encode(version, protocol, MSG_FLAG_COMPRESSED, packed_len, frame);
+    PFM_ENSURE_RET(0 < header_len, ERR_PROTOCOL_FRAME);
+    memcpy(frame + header_len, packed, packed_len);
+
+    return send_all(fd, frame, header_len + packed_len);
+}
+
+/*
+    function    阻塞发送一个流式帧，帧数据由data与文件内容组成，文件内容由内核直接从文件发送到socket
+    in          fd              socket文件描述符
+                version         帧格式版本，必须为版本帧
+                protocol        协议类型
+                data            位于文件内容之前的数据
+                length          data长度
+                file_fd         文件描述符，从文件当前位置开始发送
+                file_len        发送的文件字节数
+    out
+    ret         errCode
+*/
+ERR_CODE msg_frame_send_file(IN int fd, IN uint8_t version, IN msg_type_t protocol, IN const char *data, IN int length,
+                             IN int file_fd, IN int file_len)
+{
+    char frame[MSG_FRAME_SIZE_MAX] = {};
+    int frame_len = 0;
+    ssize_t n = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    PFM_ENSURE_RET(-1 != fd && -1 != file_fd && 0 < version, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 <= length && MSG_FRAME_DATA_MAX >= length && 0 <= file_len, ERR_BAD_PARAM);
+
+    frame_len = msg_frame_header_encode(version, protocol, 0, length + file_len, frame);
+    PFM_ENSURE_RET(0 < frame_len, ERR_PROTOCOL_FRAME);
+    if(length > 0)
+    {
+        memcpy(frame + frame_len, data, length);
+    }
+
+    ret = send_all(fd, frame, frame_len + length);
+    while(ERR_NO_ERROR == ret && file_len > 0)
+    {
+        n = sendfile(fd, file_fd, NULL, file_len);
+        if(n <= 0)
+        {
+            if(n < 0 && EINTR == errno)    continue;
+            return ERR_PROTOCOL_IO;     /* 文件在发送过程中被截短时帧已无法补全 */
+        }
+        file_len -= n;
+    }
+
+    return ret;
+}
+
+/*
+    function    阻塞接收一帧，压缩帧解压后返回；流式帧只接收前MSG_FRAME_DATA_MAX字节数据，其余由调用者用msg_frame_recv_data分块接收
+    in          fd              socket文件描述符
+    out         p_msg           接收到的消息，data以'\0'结尾
+    ret         errCode，对端关闭返回ERR_PROTOCOL_CLOSED
+*/
+ERR_CODE msg_frame_recv(IN int fd, OUT msg_t *p_msg)
+{
+    char frame[MSG_FRAME_HEADER_MAX] = {};
+    char packed[MSG_FRAME_DATA_MAX] = {};
+    msg_header_t header = {};
+    int have = 0;
+    int data_len = 0;
+    int frame_len = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    PFM_ENSURE_RET(-1 != fd && NULL != p_msg, ERR_BAD_PARAM);
+
+    /* 帧头长度可变：先读最短的帧头，长度字段未结束时逐字节补齐 */
+    ret = recv_all(fd, frame, MSG_FRAME_LEGACY_HEADER_SIZE);
+    have = MSG_FRAME_LEGACY_HEADER_SIZE;
+    while(ERR_NO_ERROR == ret && 0 == (frame_len = msg_frame_header_decode(frame, have, &header)) && 0 == header.header_len &&
+          have < MSG_FRAME_HEADER_MAX)
+    {
+        ret = recv_all(fd, frame + have, 1);
+        have++;
+    }
+    if(ERR_NO_ERROR != ret)
+    {
+        return ret;
+    }
+    if(frame_len < 0 || 0 == header.header_len)
+    {
+        return ERR_PROTOCOL_FRAME;
+    }
+
+    /* 帧头完整后一次读完数据，此时已读的字节恰为帧头 */
+    data_len = header.length < MSG_FRAME_DATA_MAX ? header.length : MSG_FRAME_DATA_MAX;
+    ret = recv_all(fd, (header.flags & MSG_FLAG_COMPRESSED) ? packed : p_msg->data, data_len);
+    if(ERR_NO_ERROR != ret)
+    {
+        return ret;
+    }
+    p_msg->header = header;
+
+    if(header.flags & MSG_FLAG_COMPRESSED)
+    {
+        data_len = msg_data_decompress(packed, data_len, p_msg->data, MSG_FRAME_DATA_MAX);
+        PFM_ENSURE_RET(0 <= data_len, ERR_PROTOCOL_FRAME);
+        p_msg->header.length = data_len;
+        p_msg->header.flags &= ~MSG_FLAG_COMPRESSED;
+    }
+    p_msg->data[data_len] = '\0';
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    阻塞接收流式帧其余的数据
+    in          fd              socket文件描述符
+                len             接收的字节数
+    out         buf             接收缓冲区
+    ret         errCode，对端关闭返回ERR_PROTOCOL_CLOSED
+*/
+ERR_CODE msg_frame_recv_data(IN int fd, OUT char *buf, IN int len)
+{
+    PFM_ENSURE_RET(-1 != fd && NULL != buf && 0 <= len, ERR_BAD_PARAM);
+
+    return recv_all(fd, buf, len);
+}
@@ -2,15 +2,22 @@
     Include files
 */
 
+#define _GNU_SOURCE     /* accept4、memfd_create */
+
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 
 #include "server.h"
 
@@ -32,477 +39,3702 @@ static server_t server = {};
 */
 static void signal_handler(int signum)
 {
+    uint64_t one = 1;
+    int i = 0;
+
     if(signum == SIGINT)
     {
-        /* 信号处理函数避免printf等不可重入函数/异步信号不安全函数 */
+        /* 信号处理函数避免printf等不可重入函数/异步信号不安全函数，只设置退出标志并唤醒所有reactor */
         //DBG("Received signal %d, shutting down server...", signum);
-        server_destory(&server);
-        exit(0);
+        atomic_store(&server.shutdown, 1);
+        for(i = 0; i < server.reactor_count; ++i)
+        {
+            if(-1 != server.reactors[i].wake_fd)
+            {
+                (void)!write(server.reactors[i].wake_fd, &one, sizeof(one));
+            }
+        }
     }
 }
 
 /*
-    function    向连接链表中新增连接，用于提交给线程池
-    in          s_c     指向服务器连接参数
+    function    初始化房间注册表
+    in          p_server    指向服务器对象
     out
-    ret
+    ret         errCode
 */
-static void connect_list_add(void *s_c)
+static ERR_CODE room_table_init(IN server_t *p_server)
 {
-    connect_t *new_connect = NULL;
-    server_connect_t *arg = (server_connect_t *)s_c;
-    server_t *p_server = arg->p_server;
-    int client_fd = arg->connect_fd;
+    room_table_t *p_table = &(p_server->rooms);
 
-    /* 分配新的连接结构 */
-    new_connect = (connect_t *)malloc(sizeof(connect_t));
-    if(NULL == new_connect)
+    p_table->buckets = (room_t **)calloc(SERVER_ROOM_BUCKETS, sizeof(room_t *));
+    if(NULL == p_table->buckets)
     {
-        DBG_ERR("malloc for new connect");
-        return;
+        DBG_ERR("calloc for room table");
+        return ERR_NO_MEMORY;
     }
-    memset(new_connect, 0, sizeof(connect_t));
+    p_table->room_count = 0;
+    pthread_mutex_init(&(p_table->mutex), NULL);
 
-    /* 初始化新连接 */
-    new_connect->fd = client_fd;
-    new_connect->next = NULL;
-
-    pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
+    return ERR_NO_ERROR;
+}
 
-    /* 将新连接添加到服务器连接列表 */
-    if(NULL == p_server->connect_head.next)
-    {
-        p_server->connect_head.next = new_connect;  /* 第一个连接 */
-    }
-    else
+/*
+    function    释放房间引用，最后一个引用释放时回收房间
+    in          p_room      指向房间
+    out
+    ret
+*/
+static void room_put(IN room_t *p_room)
+{
+    if(1 != atomic_fetch_sub_explicit(&(p_room->refs), 1, memory_order_acq_rel))
     {
-        connect_t *ptr = p_server->connect_head.next;
-        while(ptr->next)  /* 找到最后一个连接 */
-        {
-            ptr = ptr->next;
-        }
-        ptr->next = new_connect;  /* 添加到最后 */
+        return;
     }
-    p_server->connect_count++;  /* 增加连接计数 */
 
-    pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
-
-    DBG_ALZ("add new connect fd %d to server, total connects: %d", client_fd, p_server->connect_count);
-
-    return;
+    pthread_mutex_destroy(&(p_room->mutex));
+    history_destroy(&(p_room->history));
+    free(p_room->members);      /* 房间为空时才会移出注册表，成员数组已在离开时释放 */
+    free(p_room);
 }
 
 /*
-    function    从连接链表中删除连接，用于提交给线程池
-    in          s_c     指向服务器连接参数
+    function    销毁房间注册表，在所有连接释放后调用，此时注册表应已为空
+    in          p_server    指向服务器对象
     out
     ret
 */
-static void connect_list_del(void *s_c)
+static void room_table_destroy(IN server_t *p_server)
 {
-    server_connect_t *arg = (server_connect_t *)s_c;
-    server_t *p_server = arg->p_server;
-    int connect_fd = arg->connect_fd;
-    connect_t *ptr = NULL;
-    connect_t *prev = NULL;
+    room_table_t *p_table = &(p_server->rooms);
+    room_t *p_room = NULL;
+    int i = 0;
+    int r = 0;
 
-    pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
+    if(NULL == p_table->buckets)
+    {
+        return;
+    }
 
-    /* 从连接链表中删除 */
-    ptr = p_server->connect_head.next;
-    prev = &p_server->connect_head;  /* 头节点的前一个指针 */
-    while(ptr)
+    for(i = 0; i < SERVER_ROOM_BUCKETS; ++i)
     {
-        if(ptr->fd == connect_fd)  /* 找到要删除的连接 */
+        while(NULL != (p_room = p_table->buckets[i]))
         {
-            prev->next = ptr->next;  /* 删除当前连接 */
-            free(ptr);               /* 释放内存 */
-            p_server->connect_count--;  /* 减少连接计数 */
-            DBG("removed client %d from server, total connects: %d", connect_fd, p_server->connect_count);
-            break;
+            p_table->buckets[i] = p_room->next;
+            for(r = 0; r < p_server->reactor_count; ++r)
+            {
+                free(p_room->members[r].fds);
+            }
+            room_put(p_room);
         }
-        prev = ptr;  /* 移动到下一个连接 */
-        ptr = ptr->next;
     }
 
-    pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
+    free(p_table->buckets);
+    p_table->buckets = NULL;
+    p_table->room_count = 0;
+    pthread_mutex_destroy(&(p_table->mutex));
 }
 
 /*
-    function    从连接链表中查找指定节点，返回指针
-    in          connect_fd   要查找的连接文件描述符
+    function    计算房间名、用户名的哈希值，FNV-1a
+    in          name        名字
+                len         名字长度
     out
-    ret         ptr
+    ret         哈希值
 */
-connect_t* connect_list_find(IN server_t *p_server, IN int connect_fd)
+static unsigned int name_hash(IN const char *name, IN int len)
 {
-    connect_t *ptr = NULL;
+    unsigned int hash = 2166136261u;
+    int i = 0;
 
-    PFM_ENSURE_RET(NULL != p_server, NULL);
-    PFM_ENSURE_RET(-1 != connect_fd, NULL);
+    for(i = 0; i < len; ++i)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
 
-    pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
+/*
+    function    在连接已加入的房间中按名字查找
+    in          p_info      指向连接冷数据
+                name        房间名
+                len         房间名长度
+    out
+    ret         房间指针，未加入返回NULL
+*/
+static room_t *connect_room_find(IN connect_info_t *p_info, IN const char *name, IN int len)
+{
+    int i = 0;
 
-    ptr = server.connect_head.next;  /* 从头节点开始查找 */
-    while(ptr)
+    for(i = 0; i < p_info->room_count; ++i)
     {
-        if(ptr->fd == connect_fd)  /* 找到匹配的连接 */
+        if(0 == strncmp(p_info->rooms[i]->name, name, len) && '\0' == p_info->rooms[i]->name[len])
         {
-            pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
-            return ptr;
+            return p_info->rooms[i];
         }
-        ptr = ptr->next;  /* 移动到下一个连接 */
     }
 
-    pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
-
-    DBG_ERR("connect fd %d not found in server", connect_fd);
-    return NULL;  /* 没有找到 */
+    return NULL;
 }
 
 /*
-    function    处理客户端消息
-    in          s_c     指向服务器连接参数
+    function    连接离开房间，房间为空时移出注册表
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                p_room      连接已加入的房间
     out
     ret
 */
-static void handle_client_msg(void *s_c)
+static void room_leave(IN server_t *p_server, IN connect_t *p_connect, IN room_t *p_room)
 {
-    server_connect_t *arg = (server_connect_t *)s_c;
-    server_t *p_server = arg->p_server;
-    int connect_fd = arg->connect_fd;
-    connect_t *p_connect = NULL;
-    connect_t *ptr = NULL;
-    msg_t msg = {};
-    char buffer_tmp[BUFFER_SIZE*2] = {};
+    room_table_t *p_table = &(p_server->rooms);
+    connect_info_t *p_info = &(p_server->connect_infos[p_connect->fd]);
+    room_members_t *p_members = NULL;
+    room_t **pp_room = NULL;
+    int removed = 0;
+    int i = 0;
 
-    PFM_ENSURE_RET(NULL != p_server, );
-    PFM_ENSURE_RET(-1 != connect_fd, );
+    pthread_mutex_lock(&(p_table->mutex));
 
-    /* 查找连接 */
-    p_connect = connect_list_find(p_server, connect_fd);
-    if(NULL == p_connect)
+    /* 成员数组无序，与末尾交换后删除 */
+    pthread_mutex_lock(&(p_room->mutex));
+    p_members = &(p_room->members[p_connect->reactor_id]);
+    for(i = 0; i < p_members->count; ++i)
     {
-        DBG_ERR("connect fd %d not found in server", connect_fd);
-        return;
+        if(p_members->fds[i] == p_connect->fd)
+        {
+            p_members->fds[i] = p_members->fds[--p_members->count];
+            p_room->member_count--;
+            break;
+        }
+    }
+    if(0 == p_members->count)
+    {
+        free(p_members->fds);
+        p_members->fds = NULL;
+        p_members->cap = 0;
     }
+    removed = (0 == p_room->member_count);
+    pthread_mutex_unlock(&(p_room->mutex));
 
-    switch(p_connect->msg.protocol)
+    if(removed)
     {
-        case MSG_TYPE_USER_REGISTER:    /* 处理用户注册 */
+        for(pp_room = &(p_table->buckets[name_hash(p_room->name, strlen(p_room->name)) & (SERVER_ROOM_BUCKETS - 1)]); *pp_room != p_room; pp_room = &((*pp_room)->next));
+        *pp_room = p_room->next;
+        p_table->room_count--;
+    }
+
+    pthread_mutex_unlock(&(p_table->mutex));
+
+    for(i = 0; i < p_info->room_count; ++i)
+    {
+        if(p_info->rooms[i] == p_room)
         {
-            DBG("handle user register from fd %d: %s", connect_fd, p_connect->msg.data);
-            memcpy(p_connect->user_name, p_connect->msg.data, USER_NAME_SIZE);
+            p_info->rooms[i] = p_info->rooms[--p_info->room_count];
             break;
         }
-        case MSG_TYPE_MSG:  /* 处理普通消息 */
-        {
-            DBG("handle client msg from fd %d, user_name %s: %s", connect_fd, p_connect->user_name, p_connect->msg.data);
+    }
 
-            /* 封装消息 */
-            msg.protocol = MSG_TYPE_MSG;
-            snprintf(buffer_tmp, sizeof(buffer_tmp), "[%s] %s", p_connect->user_name, p_connect->msg.data);
-            memcpy(msg.data, buffer_tmp, BUFFER_SIZE-BUFFER_HEADER_SIZE-1);
-            msg.data[BUFFER_SIZE-BUFFER_HEADER_SIZE-1] = '\0';
-            msg.length = strlen(msg.data);
-            /* 广播给其他客户端 */
-            pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
-            ptr = p_server->connect_head.next;  /* 从头节点开始遍历 */
-            while(ptr)
-            {
-                if(ptr->fd != connect_fd)  /* 不发送给自己 */
-                {
-                    send(ptr->fd, (void*)&msg, sizeof(msg_t), 0);
-                }
-                ptr = ptr->next;
-            }
-            pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
-            break;
-        }
-        case MSG_TYPE_USER_OFFLINE: /* 处理下线消息 */
-        {
-            DBG("handle user offline from fd %d, %s", connect_fd, p_connect->user_name);
+    /* 在途邮件仍持有引用时，房间在邮件处理完后回收 */
+    if(removed)
+    {
+        room_put(p_room);
+    }
+}
 
-            /* 封装消息 */
-            msg.protocol = MSG_TYPE_USER_OFFLINE;
-            snprintf(buffer_tmp, sizeof(buffer_tmp), "[%s] offline", p_connect->user_name);
-            memcpy(msg.data, buffer_tmp, BUFFER_SIZE-BUFFER_HEADER_SIZE-1);
-            msg.data[BUFFER_SIZE-BUFFER_HEADER_SIZE-1] = '\0';
-            msg.length = strlen(msg.data);
+/*
+    function    初始化用户名索引
+    in          p_server    指向服务器对象
+    out
+    ret         errCode
+*/
+static ERR_CODE user_index_init(IN server_t *p_server)
+{
+    user_index_t *p_index = &(p_server->users);
 
-            pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
-            ptr = p_server->connect_head.next;  /* 从头节点开始遍历 */
-            while(ptr)
-            {
-                if(ptr->fd != connect_fd)  /* 不发送给自己 */
-                {
-                    send(ptr->fd, (void*)&msg, sizeof(msg_t), 0);
-                }
-                ptr = ptr->next;
-            }
-            pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
+    p_index->buckets = (connect_info_t **)calloc(SERVER_USER_BUCKETS, sizeof(connect_info_t *));
+    if(NULL == p_index->buckets)
+    {
+        DBG_ERR("calloc for user index");
+        return ERR_NO_MEMORY;
+    }
+    p_index->user_count = 0;
+    pthread_rwlock_init(&(p_index->lock), NULL);
 
-            break;
-        }
-        case MSG_TYPE_USER_ONLINE: /* 处理上线消息 */
-        {
-            DBG("handle user online from fd %d, %s", connect_fd, p_connect->user_name);
+    return ERR_NO_ERROR;
+}
 
-            /* 封装消息 */
-            msg.protocol = MSG_TYPE_USER_ONLINE;
-            snprintf(buffer_tmp, sizeof(buffer_tmp), "[%s] online", p_connect->user_name);
-            memcpy(msg.data, buffer_tmp, BUFFER_SIZE-BUFFER_HEADER_SIZE-1);
-            msg.data[BUFFER_SIZE-BUFFER_HEADER_SIZE-1] = '\0';
-            msg.length = strlen(msg.data);
+/*
+    function    销毁用户名索引，在所有连接释放后调用，用户名保存在连接冷数据中，不需逐个释放
+    in          p_server    指向服务器对象
+    out
+    ret
+*/
+static void user_index_destroy(IN server_t *p_server)
+{
+    user_index_t *p_index = &(p_server->users);
 
-            pthread_mutex_lock(&(p_server->mutex));  /* 锁定服务器互斥锁 */
-            ptr = p_server->connect_head.next;  /* 从头节点开始遍历 */
-            while(ptr)
-            {
-                if(ptr->fd != connect_fd)  /* 不发送给自己 */
-                {
-                    send(ptr->fd, (void*)&msg, sizeof(msg_t), 0);
-                }
-                ptr = ptr->next;
-            }
-            pthread_mutex_unlock(&(p_server->mutex));  /* 解锁服务器互斥锁 */
+    if(NULL == p_index->buckets)
+    {
+        return;
+    }
 
-            break;
-        }
-        default:
+    free(p_index->buckets);
+    p_index->buckets = NULL;
+    p_index->user_count = 0;
+    pthread_rwlock_destroy(&(p_index->lock));
+}
+
+/*
+    function    在哈希桶中查找用户名，调用者持有索引锁
+    in          p_index     指向用户名索引
+                bucket      哈希桶下标
+                name        用户名
+                len         用户名长度
+    out
+    ret         连接冷数据指针，不存在返回NULL
+*/
+static connect_info_t *user_index_find(IN user_index_t *p_index, IN unsigned int bucket, IN const char *name, IN int len)
+{
+    connect_info_t *p_info = NULL;
+
+    for(p_info = p_index->buckets[bucket]; NULL != p_info; p_info = p_info->name_next)
+    {
+        if(0 == strncmp(p_info->user_name, name, len) && '\0' == p_info->user_name[len])
         {
-            DBG_ERR("unknown message type %d from client fd %d", p_connect->msg.protocol, connect_fd);
-            break;
+            return p_info;
         }
     }
-    
-    free(s_c);  /* 释放服务器连接参数内存 */
-    return;
+
+    return NULL;
 }
 
-static ERR_CODE handler_new_connection(IN server_t *p_server, IN int socket_fd)
+/*
+    function    从用户名索引中删除连接，调用者持有写锁
+    in          p_index     指向用户名索引
+                p_info      指向已登记的连接冷数据
+    out
+    ret
+*/
+static void user_index_unlink(IN user_index_t *p_index, IN connect_info_t *p_info)
 {
-    struct sockaddr_in client_addr = {};
-    socklen_t addr_len = sizeof(client_addr);
-    int client_fd = 0;
-    struct epoll_event ev = {};
-    server_connect_t s_c = {};
+    connect_info_t **pp_info = NULL;
+    unsigned int bucket = name_hash(p_info->user_name, strlen(p_info->user_name)) & (SERVER_USER_BUCKETS - 1);
+
+    for(pp_info = &(p_index->buckets[bucket]); *pp_info != p_info; pp_info = &((*pp_info)->name_next));
+    *pp_info = p_info->name_next;
+    p_info->name_next = NULL;
+    p_info->indexed = 0;
+    p_index->user_count--;
+}
 
-    PFM_ENSURE_RET(NULL != p_server, ERR_BAD_PARAM);
-    PFM_ENSURE_RET(-1 != socket_fd, ERR_BAD_PARAM);
+/*
+    function    为连接登记用户名，用户名已被其他连接占用时拒绝，连接重复注册时替换原用户名
+    in          p_server    指向服务器对象
+                connect_fd  连接文件描述符
+                name        用户名
+                len         用户名长度
+    out
+    ret         errCode，用户名已被占用返回ERR_SERVER_USER_EXIST
+*/
+static ERR_CODE user_index_bind(IN server_t *p_server, IN int connect_fd, IN const char *name, IN int len)
+{
+    user_index_t *p_index = &(p_server->users);
+    connect_info_t *p_info = &(p_server->connect_infos[connect_fd]);
+    connect_info_t *p_owner = NULL;
+    unsigned int bucket = name_hash(name, len) & (SERVER_USER_BUCKETS - 1);
 
-    client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &addr_len);
-    if(-1 == client_fd)
-    {
-        DBG_ERR("accept new connection failed");
-        perror("accept");
-        goto err;
-    }
-    DBG_ALZ("accepted new connection from %s:%d, fd %d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), client_fd);
+    PFM_ENSURE_RET(0 <= len && USER_NAME_SIZE > len, ERR_BAD_PARAM);
 
-    /* 设置新连接为非阻塞 */
-    if(-1 == fcntl(client_fd, F_SETFL, O_NONBLOCK))
+    /* 用户名只在写锁下修改，查找者持读锁比较用户名 */
+    pthread_rwlock_wrlock(&(p_index->lock));
+
+    p_owner = user_index_find(p_index, bucket, name, len);
+    if(NULL != p_owner && p_owner != p_info)
     {
-        DBG_ERR("set client socket to non-blocking failed");
-        perror("fcntl set non-blocking");
-        goto err;
+        pthread_rwlock_unlock(&(p_index->lock));
+        return ERR_SERVER_USER_EXIST;
     }
-    DBG("set client socket %d to non-blocking", client_fd);
 
-    /* 将新连接添加到epoll */
-    ev.events = EPOLLIN | EPOLLET;  /* 可读事件 */
-    ev.data.fd = client_fd;  /* 新连接的文件描述符 */
-    if(-1 == epoll_ctl(p_server->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev))
+    if(p_info->indexed)
     {
-        DBG_ERR("add new connect fd %d to epoll failed", client_fd);
-        perror("epoll ctl add");
-        goto err;
+        user_index_unlink(p_index, p_info);
     }
-
-    s_c.p_server = p_server;
-    s_c.connect_fd = client_fd;
-    connect_list_add((void*)&s_c);
-
+    memcpy(p_info->user_name, name, len);
+    p_info->user_name[len] = '\0';
+    p_info->name_next = p_index->buckets[bucket];
+    p_index->buckets[bucket] = p_info;
+    p_info->indexed = 1;
+    p_index->user_count++;
+
+    pthread_rwlock_unlock(&(p_index->lock));
     return ERR_NO_ERROR;
-
-err:
-    DBG_ERR("handle new connection failed");
-    if(-1 != client_fd) close(client_fd);
-    return ERR_SERVER_NEW_CONNECT;
 }
 
-static ERR_CODE handler_read_event(IN server_t *p_server, IN int connect_fd)
+/*
+    function    从用户名索引中删除连接，连接释放时调用
+    in          p_server    指向服务器对象
+                connect_fd  连接文件描述符
+    out
+    ret
+*/
+static void user_index_unbind(IN server_t *p_server, IN int connect_fd)
 {
-    char buffer[BUFFER_SIZE] = {};
-    ssize_t bytes_read = 0;
-    connect_t *p_connect = NULL;
-    server_connect_t *s_c = NULL;
-    
-    PFM_ENSURE_RET(NULL != p_server, ERR_BAD_PARAM);
-    PFM_ENSURE_RET(-1 != connect_fd, ERR_BAD_PARAM);
+    user_index_t *p_index = &(p_server->users);
+    connect_info_t *p_info = &(p_server->connect_infos[connect_fd]);
 
-    bytes_read = read(connect_fd, buffer, sizeof(buffer) - 1);
-    if (bytes_read > 0)
+    if(!p_info->indexed)
     {
-        buffer[bytes_read] = '\0';
+        return;
+    }
 
-        p_connect = connect_list_find(p_server, connect_fd);  /* 确保连接存在 */
-        if(NULL != p_connect)
-        {
-            memset(&p_connect->msg, 0, sizeof(msg_t));  /* 清空缓冲区 */
-            memcpy(&p_connect->msg, buffer, sizeof(msg_t));
-        }
+    pthread_rwlock_wrlock(&(p_index->lock));
+    user_index_unlink(p_index, p_info);
+    pthread_rwlock_unlock(&(p_index->lock));
+}
 
-        s_c = (server_connect_t *)malloc(sizeof(server_connect_t));
+/*
+    function    尝试增加连接引用，引用已降为0的连接正在被释放，不能再持有
+    in          p_connect   指向连接
+    out
+    ret         1 成功，0 连接正在被释放
+*/
+static int connect_try_hold(IN connect_t *p_connect)
+{
+    int refs = atomic_load_explicit(&p_connect->refs, memory_order_relaxed);
 
-        if(NULL == s_c)
+    while(0 < refs)
+    {
+        if(atomic_compare_exchange_weak_explicit(&p_connect->refs, &refs, refs + 1, memory_order_acquire, memory_order_relaxed))
         {
-            DBG_ERR("malloc for server connect");
-            return ERR_NO_MEMORY;
+            return 1;
         }
-        memset(s_c, 0, sizeof(server_connect_t));
+    }
+
+    return 0;
+}
 
-        s_c->p_server = p_server;
-        s_c->connect_fd = connect_fd;
+/*
+    function    按用户名查找连接并持有其引用，查找只计算一次哈希，与在线用户数无关
+    in          p_server    指向服务器对象
+                name        用户名
+                len         用户名长度
+    out
+    ret         持有引用的连接，用户不在线返回NULL
+*/
+static connect_t *user_index_hold(IN server_t *p_server, IN const char *name, IN int len)
+{
+    user_index_t *p_index = &(p_server->users);
+    connect_info_t *p_info = NULL;
+    connect_t *p_connect = NULL;
 
-        /* 线程池处理数据 */
-        thread_pool_add_task(&(p_server->thread_pool), handle_client_msg, (void*)s_c);
-    }
-    else if (bytes_read == 0)       /* 客户端关闭连接 */
+    if(0 >= len || USER_NAME_SIZE <= len)
     {
-        close(connect_fd);
+        return NULL;
+    }
 
-        s_c = (server_connect_t *)malloc(sizeof(server_connect_t));
-        if(NULL == s_c)
+    pthread_rwlock_rdlock(&(p_index->lock));
+    p_info = user_index_find(p_index, name_hash(name, len) & (SERVER_USER_BUCKETS - 1), name, len);
+    if(NULL != p_info)
+    {
+        p_connect = &(p_server->connects[p_info - p_server->connect_infos]);
+        if(!connect_try_hold(p_connect))
         {
-            DBG_ERR("malloc for server connect");
-            return ERR_NO_MEMORY;
+            p_connect = NULL;
         }
-        memset(s_c, 0, sizeof(server_connect_t));
-        s_c->p_server = p_server;
-        s_c->connect_fd = connect_fd;
-        thread_pool_add_task(&(p_server->thread_pool), connect_list_del, (void *)&s_c);    /* 链表操作交给线程池处理 */
-        DBG_ALZ("client %d closed connection", connect_fd);
-    }
-    else
-    {
-        DBG_ERR("read from client %d failed", connect_fd);
     }
+    pthread_rwlock_unlock(&(p_index->lock));
 
-    return ERR_NO_ERROR;
+    return p_connect;
 }
 
 /*
-    function    服务器对象初始化
-    in          p_server                        指向服务器对象
-                server_thread_pool_size         服务器线程池线程数量
-                server_thread_task_queue_size   服务器线程池任务队列大小
+    function    初始化连接表，容量取RLIMIT_NOFILE与SERVER_CONNECT_TABLE_MAX的较小者
+    in          p_server    指向服务器对象
     out
     ret         errCode
 */
-ERR_CODE server_init(
-    IN OUT server_t *p_server, 
-    int server_thread_pool_size, 
-    int server_thread_task_queue_size
-)
+static ERR_CODE connect_table_init(IN server_t *p_server)
 {
-    int thread_pool_flag = 0;
-    struct sockaddr_in server_addr = {};
-    struct epoll_event ev = {};
-
-    PFM_ENSURE_RET(NULL != p_server, ERR_BAD_PARAM);
-    PFM_ENSURE_RET(0 < server_thread_pool_size && 0 < server_thread_task_queue_size, ERR_BAD_PARAM);
-
-    /* 初始化服务器线程池 */
-    PFM_ENSURE_RET(ERR_NO_ERROR == thread_pool_init(&(p_server->thread_pool), server_thread_pool_size, server_thread_task_queue_size), ERR_SERVER_INIT);
-    thread_pool_flag = 1;
-    DBG("server init thread pool with %d threads, %d tasks", server_thread_pool_size, server_thread_task_queue_size);
+    struct rlimit rl = {};
+    int i = 0;
 
-    /* 创建socket */
-    p_server->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if(-1 == p_server->socket_fd)
+    p_server->connect_max = SERVER_CONNECT_TABLE_MAX;
+    if(0 == getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < (rlim_t)p_server->connect_max)
     {
-        DBG_ERR("create socket failed");
-        perror("socket create");
-        goto err;
+        p_server->connect_max = (int)rl.rlim_cur;
     }
-    DBG("create socket %d", p_server->socket_fd);
-
-    /* 设置socket选项，允许地址重用 */
-    int opt = 1;
-    setsockopt(p_server->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    DBG("set socket %d option SO_REUSEADDR", p_server->socket_fd);
 
-    /* 设置socket为非阻塞 */
-    if(-1 == fcntl(p_server->socket_fd, F_SETFL, O_NONBLOCK))
+    p_server->connects = (connect_t *)calloc(p_server->connect_max, sizeof(connect_t));
+    p_server->connect_infos = (connect_info_t *)calloc(p_server->connect_max, sizeof(connect_info_t));
+    if(NULL == p_server->connects || NULL == p_server->connect_infos)
     {
-        DBG_ERR("set socket to non-blocking failed");
-        perror("fcntl set non-blocking");
-        goto err;
+        DBG_ERR("calloc for connect table");
+        free(p_server->connects);
+        free(p_server->connect_infos);
+        p_server->connects = NULL;
+        p_server->connect_infos = NULL;
+        return ERR_NO_MEMORY;
     }
-    DBG("set socket %d to non-blocking", p_server->socket_fd);
 
-    /* 绑定socket */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);        /* 绑定所有接口上 */
-    server_addr.sin_port = htons(SERVER_PORT);
-    if(0 != bind(p_server->socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+    for(i = 0; i < p_server->connect_max; ++i)
     {
-        DBG_ERR("bind socket failed");
-        perror("socket bind");
-        goto err;
+        p_server->connects[i].fd = i;
+        p_server->connects[i].upload_fd = -1;
+        pthread_mutex_init(&(p_server->connects[i].out_mutex), NULL);
+        thread_strand_init(&(p_server->connects[i].strand), &(p_server->thread_pool));
     }
-    DBG("server bind socket %d to %d", p_server->socket_fd, SERVER_PORT);
+    atomic_init(&(p_server->connect_count), 0);
 
-    /* 监听socket */
-    if(0 != listen(p_server->socket_fd, SERVER_CONNECT_SIZE))
+    DBG("connect table size %d", p_server->connect_max);
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    释放连接的读缓冲区与发送队列，关闭描述符并归还槽位
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+    out
+    ret
+*/
+static void connect_release(IN server_t *p_server, IN connect_t *p_connect)
+{
+    int connect_fd = p_connect->fd;
+
+    /* 先离开所有房间，之后房间消息不会再发送到该连接 */
+    while(0 < p_server->connect_infos[p_connect->fd].room_count)
     {
-        DBG_ERR("listen socket failed");
-        perror("socket listen");
-        goto err;
+        room_leave(p_server, p_connect, p_server->connect_infos[p_connect->fd].rooms[0]);
     }
-    DBG("server listen socket %d", p_server->socket_fd);
+    user_index_unbind(p_server, p_connect->fd);
 
-    /* 初始化epoll */
-    p_server->epoll_fd = epoll_create(10);
-    if(-1 == p_server->epoll_fd)
+    pthread_mutex_lock(&(p_connect->out_mutex));
+    while(p_connect->out_count > 0)
     {
-        DBG_ERR("create epoll failed");
-        perror("epoll create");
-        goto err;
+        msg_buf_unref(p_connect->out_ring[p_connect->out_first]);
+        p_connect->out_first = (p_connect->out_first + 1) % p_connect->out_cap;
+        p_connect->out_count--;
     }
-    DBG("create epoll fd %d", p_server->epoll_fd);
-
-    /* 将socket添加到epoll */
-    ev.events = EPOLLIN | EPOLLET;  /* 可读事件 */
-    ev.data.fd = p_server->socket_fd;  /* 监听socket的文件描述符 */
-    if(-1 == epoll_ctl(p_server->epoll_fd, EPOLL_CTL_ADD, p_server->socket_fd, &ev))
+    free(p_connect->out_ring);
+    p_connect->out_ring = NULL;
+    p_connect->out_cap = 0;
+    p_connect->out_first = 0;
+    p_connect->out_offset = 0;
+    p_connect->out_bytes = 0;
+    p_connect->out_file_bytes = 0;
+    p_connect->out_armed = 0;
+    p_connect->out_pending = 0;
+    p_connect->out_error = 0;
+    free(p_connect->out_iov);
+    p_connect->out_iov = NULL;
+    pthread_mutex_unlock(&(p_connect->out_mutex));
+
+    free(p_connect->read_buf);
+    p_connect->read_buf = NULL;
+    p_connect->read_len = 0;
+    p_connect->read_cap = 0;
+    if(0 <= p_connect->upload_fd)
     {
-        DBG_ERR("add socket to epoll failed");
-        perror("epoll ctl add");
-        goto err;
+        close(p_connect->upload_fd);    /* 上传到一半的流式帧 */
+        p_connect->upload_fd = -1;
+        atomic_fetch_sub_explicit(&(p_server->upload_count), 1, memory_order_relaxed);
     }
-    DBG("add socket %d to epoll fd %d", p_server->socket_fd, p_server->epoll_fd);
+    p_connect->upload_left = 0;
+    p_connect->upload_discard = 0;
+    msg_buf_unref(p_connect->p_upload_head);
+    p_connect->p_upload_head = NULL;
+    msg_buf_unref(p_server->connect_infos[p_connect->fd].p_prefix);
+    memset(&(p_server->connect_infos[p_connect->fd]), 0, sizeof(connect_info_t));
+
+    /* 先归还槽位再关闭描述符，关闭后accept可能立即复用该fd并由其他reactor占用槽位 */
+    atomic_store_explicit(&p_connect->state, CONNECT_STATE_FREE, memory_order_release);
+    close(connect_fd);
+}
 
-    /* 初始化互斥锁 */
-    pthread_mutex_init(&(p_server->mutex), NULL);
-    DBG("initialize server mutex");
+/*
+    function    销毁连接表，关闭所有未释放的连接，在线程池销毁后调用
+    in          p_server    指向服务器对象
+    out
+    ret
+*/
+static void connect_table_destroy(IN server_t *p_server)
+{
+    int i = 0;
+
+    if(NULL == p_server->connects)
+    {
+        return;
+    }
+
+    for(i = 0; i < p_server->connect_max; ++i)
+    {
+        if(CONNECT_STATE_FREE != atomic_load(&(p_server->connects[i].state)))
+        {
+            DBG("close connect fd %d", i);
+            connect_release(p_server, &(p_server->connects[i]));
+        }
+        pthread_mutex_destroy(&(p_server->connects[i].out_mutex));
+    }
+
+    free(p_server->connects);
+    free(p_server->connect_infos);
+    p_server->connects = NULL;
+    p_server->connect_infos = NULL;
+    atomic_store(&(p_server->connect_count), 0);
+    p_server->connect_max = 0;
+}
+
+/*
+    function    增加连接引用，在途任务持有引用期间描述符不会被关闭，槽位不会被复用
+    in          p_connect   指向连接
+    out
+    ret
+*/
+static void connect_hold(IN connect_t *p_connect)
+{
+    atomic_fetch_add_explicit(&p_connect->refs, 1, memory_order_relaxed);
+}
+
+/*
+    function    释放连接引用，最后一个引用释放时回收连接
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+    out
+    ret
+*/
+static void connect_put(IN server_t *p_server, IN connect_t *p_connect)
+{
+    if(1 == atomic_fetch_sub_explicit(&p_connect->refs, 1, memory_order_acq_rel))
+    {
+        connect_release(p_server, p_connect);
+    }
+}
+
+/*
+    function    扩容reactor的活跃连接数组，首次调用时分配
+    in          p_reactor   指向reactor
+    out
+    ret         errCode
+*/
+static ERR_CODE reactor_connect_fds_grow(IN reactor_t *p_reactor)
+{
+    int new_cap = p_reactor->connect_cap ? p_reactor->connect_cap * 2 : SERVER_EPOLL_EVENT_SIZE;
+    int *new_fds = NULL;
+
+    new_fds = (int *)realloc(p_reactor->connect_fds, sizeof(int) * new_cap);
+    if(NULL == new_fds)
+    {
+        DBG_ERR("realloc connect fds for reactor %d", p_reactor->id);
+        return ERR_NO_MEMORY;
+    }
+
+    p_reactor->connect_fds = new_fds;
+    p_reactor->connect_cap = new_cap;
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    向连接表中新增连接，连接归接受它的reactor所有，只在该reactor调用
+    in          p_reactor   接受连接的reactor
+                connect_fd  连接文件描述符
+    out
+    ret         连接指针，fd超出连接表容量、槽位尚未归还或内存不足时返回NULL
+*/
+static connect_t *connect_table_add(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    server_t *p_server = p_reactor->p_server;
+    connect_t *p_connect = NULL;
+    int total = 0;
+
+    if(connect_fd < 0 || connect_fd >= p_server->connect_max)
+    {
+        DBG_ERR("connect fd %d exceeds connect table size %d", connect_fd, p_server->connect_max);
+        return NULL;
+    }
+
+    if(p_reactor->connect_count == p_reactor->connect_cap &&
+        ERR_NO_ERROR != reactor_connect_fds_grow(p_reactor))
+    {
+        return NULL;
+    }
+
+    p_connect = &(p_server->connects[connect_fd]);
+    if(CONNECT_STATE_FREE != atomic_load_explicit(&p_connect->state, memory_order_acquire))
+    {
+        DBG_ERR("connect fd %d slot is still in use", connect_fd);
+        return NULL;
+    }
+
+    atomic_store_explicit(&p_connect->refs, 1, memory_order_relaxed);  /* 所属reactor持有的引用 */
+    atomic_store_explicit(&p_connect->version, 0, memory_order_relaxed);   /* 握手前按旧客户端处理 */
+    atomic_store_explicit(&p_connect->caps, 0, memory_order_relaxed);
+    p_connect->reactor_id = p_reactor->id;
+    p_connect->index = p_reactor->connect_count;
+    p_reactor->connect_fds[p_reactor->connect_count++] = connect_fd;
+    atomic_store_explicit(&p_connect->state, CONNECT_STATE_OPEN, memory_order_release);
+
+    total = atomic_fetch_add(&(p_server->connect_count), 1) + 1;
+    DBG_ALZ("add new connect fd %d to reactor %d, total connects: %d", connect_fd, p_reactor->id, total);
+
+    return p_connect;
+}
+
+/*
+    function    从所属reactor的活跃连接数组中删除连接并释放reactor持有的引用，只在所属reactor调用
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+    out
+    ret
+*/
+static void connect_table_del(IN server_t *p_server, IN connect_t *p_connect)
+{
+    reactor_t *p_reactor = &(p_server->reactors[p_connect->reactor_id]);
+    int last_fd = 0;
+    int total = 0;
+
+    /* 用末尾元素填补空位 */
+    last_fd = p_reactor->connect_fds[--p_reactor->connect_count];
+    p_reactor->connect_fds[p_connect->index] = last_fd;
+    p_server->connects[last_fd].index = p_connect->index;
+    atomic_store_explicit(&p_connect->state, CONNECT_STATE_CLOSING, memory_order_release);
+
+    total = atomic_fetch_sub(&(p_server->connect_count), 1) - 1;
+    DBG_ALZ("removed client %d from reactor %d, total connects: %d", p_connect->fd, p_reactor->id, total);
+
+    /* 工作线程与其他reactor访问连接前都持有引用，最后一个引用释放时才回收 */
+    connect_put(p_server, p_connect);
+}
+
+/*
+    function    按fd查找已建立的连接，O(1)
+    in          p_server     指向服务器对象
+                connect_fd   要查找的连接文件描述符
+    out
+    ret         连接指针，连接不存在时返回NULL
+*/
+static connect_t *connect_table_get(IN server_t *p_server, IN int connect_fd)
+{
+    connect_t *p_connect = NULL;
+
+    PFM_ENSURE_RET(NULL != p_server, NULL);
+
+    if(connect_fd < 0 || connect_fd >= p_server->connect_max)
+    {
+        return NULL;
+    }
+
+    p_connect = &(p_server->connects[connect_fd]);
+    if(CONNECT_STATE_OPEN != atomic_load_explicit(&p_connect->state, memory_order_acquire))
+    {
+        DBG_ERR("connect fd %d not found in server", connect_fd);
+        return NULL;
+    }
+
+    return p_connect;
+}
+
+/*
+    function    修改连接在epoll中的关注事件，是否关注EPOLLOUT
+    in          p_server    指向服务器对象
+                p_connect   指向连接，调用者持有out_mutex
+                armed       是否关注可写事件
+    out
+    ret
+*/
+static void connect_arm_write(IN server_t *p_server, IN connect_t *p_connect, IN int armed)
+{
+    struct epoll_event ev = {};
+
+    if(p_connect->out_armed == armed)
+    {
+        return;
+    }
+
+    ev.events = EPOLLIN | EPOLLET | (armed ? EPOLLOUT : 0);
+    ev.data.fd = p_connect->fd;
+    if(-1 == epoll_ctl(p_server->reactors[p_connect->reactor_id].epoll_fd, EPOLL_CTL_MOD, p_connect->fd, &ev))
+    {
+        DBG_ERR("modify epoll events of connect fd %d failed", p_connect->fd);
+        return;
+    }
+    p_connect->out_armed = armed;
+}
+
+/*
+    function    用发送队列中的待发送数据填写iovec，从队首未发送的部分开始
+    in          p_connect   指向连接，调用者持有out_mutex
+                max         iovec数组容量
+    out         iov         iovec数组
+                p_bytes     填写的总字节数
+    ret         填写的iovec数量
+*/
+static int connect_out_iov(IN connect_t *p_connect, OUT struct iovec *iov, IN int max, OUT size_t *p_bytes)
+{
+    msg_buf_t *p_buf = NULL;
+    int offset = p_connect->out_offset;
+    int count = 0;
+    int i = 0;
+
+    *p_bytes = 0;
+    for(i = 0; count < max && i < p_connect->out_count; ++i)
+    {
+        /* 分段缓冲区占用多个iovec，容量不足时本次只发送其前面的分段 */
+        p_buf = p_connect->out_ring[(p_connect->out_first + i) % p_connect->out_cap];
+        count += msg_buf_iov(p_buf, offset, iov + count, max - count);
+        offset = 0;     /* 只有队首可能部分发送 */
+
+        /* 文件中的数据不能放进iovec，之后的缓冲区等它用sendfile发完再发送 */
+        if(0 < msg_buf_file_len(p_buf))
+        {
+            break;
+        }
+    }
+
+    for(i = 0; i < count; ++i)
+    {
+        *p_bytes += iov[i].iov_len;
+    }
+
+    return count;
+}
+
+/*
+    function    发送队列前进n字节，发送完毕的缓冲区释放本连接持有的引用
+    in          p_connect   指向连接，调用者持有out_mutex
+                n           已发送的字节数
+                from_file   这n字节是否为用sendfile发送的文件数据
+    out
+    ret
+*/
+static void connect_out_advance(IN connect_t *p_connect, IN size_t n, IN int from_file)
+{
+    msg_buf_t *p_buf = NULL;
+    size_t remain = 0;
+
+    if(from_file)
+    {
+        p_connect->out_file_bytes -= n;
+    }
+    else
+    {
+        p_connect->out_bytes -= n;
+    }
+    while(n > 0 && p_connect->out_count > 0)
+    {
+        p_buf = p_connect->out_ring[p_connect->out_first];
+        remain = p_buf->len - p_connect->out_offset;
+        if(n < remain)
+        {
+            p_connect->out_offset += n;     /* 部分写 */
+            break;
+        }
+
+        /* 缓冲区发送完毕 */
+        n -= remain;
+        p_connect->out_first = (p_connect->out_first + 1) % p_connect->out_cap;
+        p_connect->out_count--;
+        p_connect->out_offset = 0;
+        msg_buf_unref(p_buf);
+    }
+}
+
+/*
+    function    队首数据位于文件中时用sendfile发送，由内核从文件直接拷贝到socket，不经过用户态缓冲区
+    in          p_connect   指向连接，调用者持有out_mutex
+    out         p_bytes     本次要发送的字节数
+    ret         sendfile的返回值
+*/
+static ssize_t connect_out_sendfile(IN connect_t *p_connect, OUT size_t *p_bytes)
+{
+    msg_buf_t *p_buf = p_connect->out_ring[p_connect->out_first];
+    off_t file_offset = 0;
+    int file_fd = -1;
+
+    *p_bytes = msg_buf_file_at(p_buf, p_connect->out_offset, &file_fd, &file_offset);
+    return sendfile(p_connect->fd, file_fd, &file_offset, *p_bytes);
+}
+
+/*
+    function    非阻塞发送连接发送队列中的数据，每次系统调用聚合发送队列中的多个缓冲区，直到队列为空或socket缓冲区已满；
+                队首数据在文件中时改用sendfile
+    in          p_connect   指向连接，调用者持有out_mutex
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_flush(IN connect_t *p_connect)
+{
+    struct iovec iov[SERVER_OUT_IOV_MAX];
+    struct msghdr msg = {};
+    size_t bytes = 0;
+    ssize_t n = 0;
+
+    while(p_connect->out_count > 0)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = connect_out_iov(p_connect, iov, SERVER_OUT_IOV_MAX, &bytes);
+        if(0 < msg.msg_iovlen)
+        {
+            n = sendmsg(p_connect->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        else
+        {
+            n = connect_out_sendfile(p_connect, &bytes);
+        }
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            if(EAGAIN == errno || EWOULDBLOCK == errno) break;  /* socket缓冲区已满，等待EPOLLOUT */
+
+            DBG_ERR("send to connect fd %d failed", p_connect->fd);
+            return ERR_PROTOCOL_IO;
+        }
+
+        connect_out_advance(p_connect, n, 0 == msg.msg_iovlen);
+        if((size_t)n < bytes)
+        {
+            break;  /* 部分写，剩余数据等待EPOLLOUT */
+        }
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    发送队列满时扩容，保持环形数组中元素的顺序
+    in          p_connect   指向连接，调用者持有out_mutex
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_out_ring_grow(IN connect_t *p_connect)
+{
+    int new_cap = p_connect->out_cap ? p_connect->out_cap * 2 : SERVER_OUT_QUEUE_SIZE;
+    msg_buf_t **new_ring = NULL;
+    int i = 0;
+
+    new_ring = (msg_buf_t **)malloc(sizeof(msg_buf_t *) * new_cap);
+    if(NULL == new_ring)
+    {
+        DBG_ERR("malloc for out ring");
+        return ERR_NO_MEMORY;
+    }
+
+    for(i = 0; i < p_connect->out_count; ++i)
+    {
+        new_ring[i] = p_connect->out_ring[(p_connect->out_first + i) % p_connect->out_cap];
+    }
+    free(p_connect->out_ring);
+
+    p_connect->out_ring = new_ring;
+    p_connect->out_cap = new_cap;
+    p_connect->out_first = 0;
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    引用缓冲区加入连接发送队列，不拷贝数据
+    in          p_server    指向服务器对象
+                p_connect   指向连接，调用者持有out_mutex
+                p_buf       共享的已编码帧
+                sent        该帧已直接发送的字节数
+    out
+    ret         errCode，积压超限或内存不足时返回ERR_PROTOCOL_IO
+*/
+static ERR_CODE connect_out_push(IN server_t *p_server, IN connect_t *p_connect, IN msg_buf_t *p_buf, IN int sent)
+{
+    int file_len = msg_buf_file_len(p_buf);
+    int mem_len = p_buf->len - file_len - sent;
+
+    /* 慢连接积压过多，断开连接而不是无限占用内存 */
+    if(p_connect->out_bytes + mem_len > SERVER_OUT_QUEUE_LIMIT)
+    {
+        DBG_ERR("out queue of connect fd %d exceeds %d bytes", p_connect->fd, SERVER_OUT_QUEUE_LIMIT);
+        return ERR_PROTOCOL_IO;
+    }
+
+    /* 暂存文件是memfd，同样占用内存，慢连接持有的引用使它们无法释放，按单独的上限计算 */
+    if(p_connect->out_file_bytes + file_len > p_server->out_file_limit)
+    {
+        DBG_ERR("pending files of connect fd %d exceed %d bytes", p_connect->fd, p_server->out_file_limit);
+        return ERR_PROTOCOL_IO;
+    }
+
+    if(p_connect->out_count == p_connect->out_cap &&
+        ERR_NO_ERROR != connect_out_ring_grow(p_connect))
+    {
+        return ERR_PROTOCOL_IO;
+    }
+
+    p_connect->out_ring[(p_connect->out_first + p_connect->out_count) % p_connect->out_cap] = msg_buf_ref(p_buf);
+    p_connect->out_count++;
+    p_connect->out_bytes += mem_len;
+    p_connect->out_file_bytes += file_len;
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    记录有数据待发送的连接，本轮事件处理完后统一发送
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+    out
+    ret         errCode
+*/
+static ERR_CODE reactor_send_pending_add(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    int new_cap = 0;
+    int *new_fds = NULL;
+
+    if(p_reactor->send_count == p_reactor->send_cap)
+    {
+        new_cap = p_reactor->send_cap ? p_reactor->send_cap * 2 : SERVER_EPOLL_EVENT_SIZE;
+        new_fds = (int *)realloc(p_reactor->send_fds, sizeof(int) * new_cap);
+        if(NULL == new_fds)
+        {
+            DBG_ERR("realloc send fds for reactor %d", p_reactor->id);
+            return ERR_NO_MEMORY;
+        }
+        p_reactor->send_fds = new_fds;
+        p_reactor->send_cap = new_cap;
+    }
+
+    p_reactor->send_fds[p_reactor->send_count++] = connect_fd;
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    把缓冲区中的帧改写为旧格式帧头：分段缓冲区只含一帧，重新编码data中的帧头，分段照旧引用；
+                普通缓冲区可含多帧（如历史回放），逐帧拷贝
+    in          p_buf       版本帧缓冲区
+    out
+    ret         旧格式缓冲区，失败返回NULL
+*/
+static msg_buf_t *frame_buf_legacy(IN msg_buf_t *p_buf)
+{
+    char head[MSG_FRAME_LEGACY_HEADER_SIZE + BUFFER_SIZE] = {};
+    msg_header_t header = {};
+    msg_buf_t *p_legacy = NULL;
+    int frame_len = 0;
+    int offset = 0;
+    int total = 0;
+
+    if(0 < p_buf->seg_count)
+    {
+        PFM_ENSURE_RET(0 < msg_frame_header_decode(p_buf->data, p_buf->len, &header), NULL);
+        PFM_ENSURE_RET(p_buf->data_len - header.header_len <= BUFFER_SIZE, NULL);
+        msg_frame_header_encode(0, header.protocol, 0, header.length, head);
+        memcpy(head + MSG_FRAME_LEGACY_HEADER_SIZE, p_buf->data + header.header_len, p_buf->data_len - header.header_len);
+        return msg_buf_gather(head, MSG_FRAME_LEGACY_HEADER_SIZE + p_buf->data_len - header.header_len, p_buf->segs, p_buf->seg_count);
+    }
+
+    for(offset = 0; offset < p_buf->len; offset += frame_len)
+    {
+        frame_len = msg_frame_header_decode(p_buf->data + offset, p_buf->len - offset, &header);
+        PFM_ENSURE_RET(0 < frame_len, NULL);
+        total += MSG_FRAME_LEGACY_HEADER_SIZE + header.length;
+    }
+
+    p_legacy = msg_buf_new(total);
+    PFM_ENSURE_RET(NULL != p_legacy, NULL);
+    for(offset = 0, total = 0; offset < p_buf->len; offset += frame_len)
+    {
+        frame_len = msg_frame_header_decode(p_buf->data + offset, p_buf->len - offset, &header);
+        total += msg_frame_encode(0, header.protocol, p_buf->data + offset + header.header_len, header.length,
+                                  p_legacy->data + total, p_legacy->len - total);
+    }
+
+    return p_legacy;
+}
+
+/*
+    function    将消息编码为一帧版本帧，存入引用计数的缓冲区
+    in          protocol    协议类型
+                flags       帧标志
+                data        消息数据
+                length      消息数据长度
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+static msg_buf_t *frame_buf_new(IN msg_type_t protocol, IN uint8_t flags, IN const char *data, IN int length)
+{
+    char header[MSG_FRAME_HEADER_MAX] = {};
+    msg_buf_t *p_buf = NULL;
+    int header_len = 0;
+
+    header_len = msg_frame_header_encode(MSG_FRAME_VERSION, protocol, flags, length, header);
+    PFM_ENSURE_RET(0 < header_len, NULL);
+
+    p_buf = msg_buf_new(header_len + length);
+    PFM_ENSURE_RET(NULL != p_buf, NULL);
+
+    memcpy(p_buf->data, header, header_len);
+    if(length > 0)
+    {
+        memcpy(p_buf->data + header_len, data, length);
+    }
+
+    return p_buf;
+}
+
+/*
+    function    判断缓冲区是否为流式帧：数据超过MSG_FRAME_DATA_MAX的公共消息或文件分享，只有支持流式帧的客户端能接收
+    in          p_buf       已编码的帧
+    out
+    ret         是返回1
+*/
+static int frame_buf_is_stream(IN msg_buf_t *p_buf)
+{
+    msg_header_t header = {};
+
+    msg_frame_header_decode(p_buf->data, p_buf->data_len, &header);
+    return 0 < header.header_len && (MSG_TYPE_FILE == header.protocol || MSG_FRAME_DATA_MAX < header.length);
+}
+
+/*
+    function    由流式帧生成普通帧：公共消息只保留前MSG_FRAME_DATA_MAX字节，文件分享改为一条说明文件名与大小的公共消息
+    in          p_buf       流式帧缓冲区
+    out
+    ret         普通帧缓冲区，失败返回NULL
+*/
+static msg_buf_t *frame_buf_brief(IN msg_buf_t *p_buf)
+{
+    char text[MSG_FRAME_DATA_MAX + 1] = {};
+    char brief[MSG_FRAME_DATA_MAX + 1] = {};
+    msg_header_t header = {};
+    int name_len = 0;
+    int len = 0;
+
+    msg_frame_header_decode(p_buf->data, p_buf->data_len, &header);
+    len = msg_buf_read(p_buf, header.header_len, text, header.length < MSG_FRAME_DATA_MAX ? header.length : MSG_FRAME_DATA_MAX);
+    PFM_ENSURE_RET(0 <= len, NULL);
+
+    if(MSG_TYPE_FILE != header.protocol)
+    {
+        return frame_buf_new(MSG_TYPE_MSG, 0, text, len);
+    }
+
+    /* 数据为"[用户名] 文件名\0文件内容" */
+    name_len = strnlen(text, len);
+    snprintf(brief, sizeof(brief), "%s (shared file, %d bytes)", text, header.length - name_len - 1);
+    return frame_buf_new(MSG_TYPE_MSG, 0, brief, strnlen(brief, MSG_FRAME_DATA_MAX));
+}
+
+/*
+    function    判断缓冲区是否值得压缩：只含一帧、不是流式帧也未压缩、数据不少于MSG_COMPRESS_MIN；
+                历史回放等多帧缓冲区是为单个连接生成的，压缩它们就成了按接收者压缩，不予压缩
+    in          p_buf       已编码的帧
+    out
+    ret         是返回1
+*/
+static int frame_buf_compressible(IN msg_buf_t *p_buf)
+{
+    msg_header_t header = {};
+
+    msg_frame_header_decode(p_buf->data, p_buf->data_len, &header);
+    return 0 < header.version && 0 == (header.flags & MSG_FLAG_COMPRESSED) &&
+           MSG_COMPRESS_MIN <= header.length && MSG_FRAME_DATA_MAX >= header.length &&
+           header.header_len + header.length == p_buf->len;
+}
+
+/*
+    function    由普通帧生成压缩帧，分段中的数据拷贝出来一起压缩，帧头保留原有的标志
+    in          p_buf       只含一帧的缓冲区
+    out
+    ret         压缩帧缓冲区，压缩后不更短时返回p_buf本身，失败返回NULL
+*/
+static msg_buf_t *frame_buf_compress(IN msg_buf_t *p_buf)
+{
+    char data[MSG_FRAME_DATA_MAX] = {};
+    char packed[MSG_FRAME_DATA_MAX] = {};
+    msg_header_t header = {};
+    int packed_len = 0;
+    int len = 0;
+
+    msg_frame_header_decode(p_buf->data, p_buf->data_len, &header);
+    len = msg_buf_read(p_buf, header.header_len, data, header.length);
+    PFM_ENSURE_RET(header.length == len, NULL);
+
+    packed_len = msg_data_compress(data, len, packed, sizeof(packed));
+    if(packed_len < 0)
+    {
+        return p_buf;
+    }
+
+    return frame_buf_new(header.protocol, header.flags | MSG_FLAG_COMPRESSED, packed, packed_len);
+}
+
+/*
+    function    向连接发送一帧：引用缓冲区入队，不拷贝数据也不发起系统调用，连接登记为待发送，本轮事件处理完后与同一轮的其他帧一次发出
+    in          p_reactor   连接所属的reactor
+                p_connect   指向连接
+                p_buf       共享的已编码帧，入队时增加引用
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_send(IN reactor_t *p_reactor, IN connect_t *p_connect, IN msg_buf_t *p_buf)
+{
+    msg_buf_t *p_compressed = NULL;
+
+    /* 不支持流式帧的客户端收到简短的普通帧，同样每个广播只生成一次 */
+    if(0 == (atomic_load_explicit(&p_connect->caps, memory_order_relaxed) & MSG_CAPS_STREAM) && frame_buf_is_stream(p_buf))
+    {
+        p_buf = msg_buf_variant(p_buf, SERVER_FRAME_VARIANT_BRIEF, frame_buf_brief);
+        PFM_ENSURE_RET(NULL != p_buf, ERR_NO_MEMORY);
+    }
+
+    /* 支持压缩的客户端收到压缩变体，由第一个这样的接收者压缩一次，其余接收者共享，压缩失败时照常发送原帧 */
+    if((atomic_load_explicit(&p_connect->caps, memory_order_relaxed) & MSG_CAPS_COMPRESS) && frame_buf_compressible(p_buf))
+    {
+        p_compressed = msg_buf_variant(p_buf, SERVER_FRAME_VARIANT_COMPRESSED, frame_buf_compress);
+        p_buf = (NULL != p_compressed) ? p_compressed : p_buf;
+    }
+
+    /* 旧客户端收到旧格式的变体，同一个广播帧只改写一次，所有旧客户端共享 */
+    if(0 == atomic_load_explicit(&p_connect->version, memory_order_relaxed))
+    {
+        p_buf = msg_buf_variant(p_buf, SERVER_FRAME_VARIANT_LEGACY, frame_buf_legacy);
+        PFM_ENSURE_RET(NULL != p_buf, ERR_NO_MEMORY);
+    }
+
+    pthread_mutex_lock(&(p_connect->out_mutex));
+
+    if(p_connect->out_error)
+    {
+        pthread_mutex_unlock(&(p_connect->out_mutex));
+        return ERR_PROTOCOL_IO;
+    }
+
+    if(ERR_NO_ERROR != connect_out_push(p_reactor->p_server, p_connect, p_buf, 0))
+    {
+        goto err;
+    }
+
+    /* 后端已接管发送时，由可写事件或发送完成继续发送 */
+    if(!p_connect->out_pending && !p_connect->out_armed)
+    {
+        if(ERR_NO_ERROR != reactor_send_pending_add(p_reactor, p_connect->fd))
+        {
+            goto err;
+        }
+        p_connect->out_pending = 1;
+    }
+
+    pthread_mutex_unlock(&(p_connect->out_mutex));
+    return ERR_NO_ERROR;
+
+err:
+    /* 由所属reactor在读到连接关闭后统一回收 */
+    p_connect->out_error = 1;
+    shutdown(p_connect->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&(p_connect->out_mutex));
+    return ERR_PROTOCOL_IO;
+}
+
+/*
+    function    发送本轮所有待发送连接的数据，每个连接把积压的所有帧聚合成一次发送
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void reactor_send_flush(IN reactor_t *p_reactor)
+{
+    server_t *p_server = p_reactor->p_server;
+    connect_t *p_connect = NULL;
+    int i = 0;
+
+    for(i = 0; i < p_reactor->send_count; ++i)
+    {
+        p_connect = &(p_server->connects[p_reactor->send_fds[i]]);
+
+        pthread_mutex_lock(&(p_connect->out_mutex));
+        p_connect->out_pending = 0;
+        if(CONNECT_STATE_OPEN == atomic_load_explicit(&p_connect->state, memory_order_acquire) &&
+            !p_connect->out_error && !p_connect->out_armed && 0 < p_connect->out_count)
+        {
+            p_reactor->p_backend->connect_flush(p_reactor, p_connect);
+        }
+        pthread_mutex_unlock(&(p_connect->out_mutex));
+    }
+
+    p_reactor->send_count = 0;
+}
+
+/*
+    function    向reactor的邮箱投递一封邮件，由该reactor发送给自己的连接
+    in          p_reactor   指向reactor
+                p_buf       已编码的帧，邮件增加一个引用
+                p_room      目标房间，NULL表示该reactor的全部连接，邮件增加一个引用
+                p_target    单播的目标连接，NULL表示广播，邮件接管调用者持有的引用
+                exclude_fd  不接收的连接，-1表示全部发送
+    out
+    ret         errCode
+*/
+static ERR_CODE reactor_mail_post(IN reactor_t *p_reactor, IN msg_buf_t *p_buf, IN room_t *p_room, IN connect_t *p_target, IN int exclude_fd)
+{
+    server_t *p_server = p_reactor->p_server;
+    reactor_mail_t *p_mail = NULL;
+    uint64_t one = 1;
+
+    p_mail = (reactor_mail_t *)obj_pool_alloc(&(p_server->mail_pool));
+    if(NULL == p_mail)
+    {
+        DBG_ERR("alloc for reactor %d mail", p_reactor->id);
+        return ERR_NO_MEMORY;
+    }
+    p_mail->p_buf = msg_buf_ref(p_buf);
+    p_mail->p_room = p_room;
+    p_mail->p_target = p_target;
+    if(NULL != p_room)
+    {
+        atomic_fetch_add_explicit(&(p_room->refs), 1, memory_order_relaxed);
+    }
+    p_mail->exclude_fd = exclude_fd;
+    mpsc_queue_push(&(p_reactor->mailbox), &(p_mail->node));
+
+    /* 邮箱已有未处理的唤醒时不再写eventfd */
+    if(0 == atomic_exchange(&(p_reactor->mail_signaled), 1))
+    {
+        (void)!write(p_reactor->wake_fd, &one, sizeof(one));
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    向除exclude_fd外的所有连接广播一帧：向每个reactor的邮箱投递一封邮件，由各reactor发送给自己的连接，所有接收者共享同一个缓冲区
+    in          p_server    指向服务器对象
+                exclude_fd  不接收广播的连接，-1表示全部发送
+                p_buf       已编码的帧
+    out
+    ret
+*/
+static void server_broadcast(IN server_t *p_server, IN int exclude_fd, IN msg_buf_t *p_buf)
+{
+    int i = 0;
+
+    for(i = 0; i < p_server->reactor_count; ++i)
+    {
+        reactor_mail_post(&(p_server->reactors[i]), p_buf, NULL, NULL, exclude_fd);
+    }
+}
+
+/*
+    function    向房间中除exclude_fd外的成员发送一帧：只向有成员的reactor投递邮件，开销与房间成员数成正比
+    in          p_server    指向服务器对象
+                p_room      目标房间
+                exclude_fd  不接收的连接，-1表示全部发送
+                p_buf       已编码的帧
+                record      是否记入房间消息历史
+    out
+    ret
+*/
+static void room_broadcast(IN server_t *p_server, IN room_t *p_room, IN int exclude_fd, IN msg_buf_t *p_buf, IN int record)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&(p_room->mutex));
+    if(record)
+    {
+        history_append(&(p_room->history), p_buf);
+    }
+    for(i = 0; i < p_server->reactor_count; ++i)
+    {
+        if(0 < p_room->members[i].count)
+        {
+            reactor_mail_post(&(p_server->reactors[i]), p_buf, p_room, NULL, exclude_fd);
+        }
+    }
+    pthread_mutex_unlock(&(p_room->mutex));
+}
+
+/*
+    function    向单个连接发送一帧：投递到该连接所属reactor的邮箱，由该reactor发送
+    in          p_server    指向服务器对象
+                p_connect   目标连接，调用者持有其引用，由本函数接管
+                p_buf       已编码的帧
+    out
+    ret
+*/
+static void connect_post(IN server_t *p_server, IN connect_t *p_connect, IN msg_buf_t *p_buf)
+{
+    if(ERR_NO_ERROR != reactor_mail_post(&(p_server->reactors[p_connect->reactor_id]), p_buf, NULL, p_connect, -1))
+    {
+        connect_put(p_server, p_connect);
+    }
+}
+
+/*
+    function    匹配日志中的公共消息
+    in          frame       已编码的帧
+                len         帧字节数
+                arg         未使用
+    out
+    ret         匹配返回1
+*/
+static int log_match_msg(IN const char *frame, IN int len, IN void *arg)
+{
+    msg_header_t header = {};
+
+    (void)arg;
+    return 0 < msg_frame_header_decode(frame, len, &header) && MSG_TYPE_MSG == header.protocol;
+}
+
+/*
+    function    匹配日志中某个房间的消息，帧数据以"房间名 "开头
+    in          frame       已编码的帧
+                len         帧字节数
+                arg         房间名
+    out
+    ret         匹配返回1
+*/
+static int log_match_room(IN const char *frame, IN int len, IN void *arg)
+{
+    const char *name = (const char *)arg;
+    int name_len = strlen(name);
+    msg_header_t header = {};
+
+    return 0 < msg_frame_header_decode(frame, len, &header) && MSG_TYPE_ROOM_MSG == header.protocol && name_len < header.length &&
+           0 == memcmp(frame + header.header_len, name, name_len) && ' ' == frame[header.header_len + name_len];
+}
+
+/*
+    function    从日志映射的页面中取出最近的匹配帧填入消息历史，调用者保证此时历史中还没有新消息
+    in          p_server    指向服务器对象
+                p_history   要恢复的消息历史
+                match       匹配函数
+                arg         匹配函数参数
+    out
+    ret
+*/
+static void history_recover(IN server_t *p_server, IN history_t *p_history, IN msg_log_match_t match, IN void *arg)
+{
+    const char **frames = NULL;
+    int *lens = NULL;
+    int count = 0;
+    int i = 0;
+
+    if(!p_server->log_enabled || 0 == p_server->history_count)
+    {
+        return;
+    }
+
+    frames = (const char **)malloc(sizeof(const char *) * p_server->history_count);
+    lens = (int *)malloc(sizeof(int) * p_server->history_count);
+    if(NULL != frames && NULL != lens)
+    {
+        count = msg_log_recover(&(p_server->log), match, arg, SERVER_LOG_RECOVER_BYTES, p_server->history_count, frames, lens);
+        for(i = 0; i < count; ++i)
+        {
+            history_append_frame(p_history, frames[i], lens[i]);
+        }
+    }
+    free(frames);
+    free(lens);
+}
+
+/*
+    function    首次使用公共消息历史前从日志恢复，只执行一次，之后只有一次原子读
+    in          p_server    指向服务器对象
+    out
+    ret
+*/
+static void server_history_recover(IN server_t *p_server)
+{
+    if(atomic_load_explicit(&p_server->history_recovered, memory_order_acquire))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(p_server->mutex));
+    if(!atomic_load_explicit(&p_server->history_recovered, memory_order_relaxed))
+    {
+        history_recover(p_server, &(p_server->history), log_match_msg, NULL);
+        atomic_store_explicit(&p_server->history_recovered, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&(p_server->mutex));
+}
+
+/*
+    function    在注册表哈希桶中按名字查找房间，调用者持有注册表锁
+    in          p_table     房间注册表
+                bucket      哈希桶编号
+                name        房间名
+                len         房间名长度
+    out
+    ret         房间指针，不存在时返回NULL
+*/
+static room_t *room_table_find(IN room_table_t *p_table, IN unsigned int bucket, IN const char *name, IN int len)
+{
+    room_t *p_room = NULL;
+
+    for(p_room = p_table->buckets[bucket]; NULL != p_room; p_room = p_room->next)
+    {
+        if(0 == strncmp(p_room->name, name, len) && '\0' == p_room->name[len])
+        {
+            break;
+        }
+    }
+
+    return p_room;
+}
+
+/*
+    function    创建房间并从日志恢复房间消息历史，房间尚未发布，不持有任何锁
+    in          p_server    指向服务器对象
+                name        房间名
+                len         房间名长度
+    out
+    ret         房间指针，持有一个引用，内存不足时返回NULL
+*/
+static room_t *room_create(IN server_t *p_server, IN const char *name, IN int len)
+{
+    room_t *p_room = NULL;
+
+    p_room = (room_t *)calloc(1, sizeof(room_t));
+    if(NULL != p_room)
+    {
+        p_room->members = (room_members_t *)calloc(p_server->reactor_count, sizeof(room_members_t));
+    }
+    if(NULL == p_room || NULL == p_room->members)
+    {
+        DBG_ERR("calloc for room %.*s", len, name);
+        free(p_room);
+        return NULL;
+    }
+    memcpy(p_room->name, name, len);
+    atomic_init(&(p_room->refs), 1);    /* 发布后即为注册表持有的引用 */
+    pthread_mutex_init(&(p_room->mutex), NULL);
+    history_init(&(p_room->history), p_server->history_count, p_server->history_bytes);
+    history_recover(p_server, &(p_room->history), log_match_room, p_room->name);   /* 发布前恢复，此前没有房间消息 */
+
+    return p_room;
+}
+
+/*
+    function    连接加入房间，房间不存在时创建，连接登记在其所属reactor的成员数组中，并回放房间消息历史
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                name        房间名
+                len         房间名长度
+    out
+    ret         房间指针，已加入时返回已有房间，失败返回NULL
+*/
+static room_t *room_join(IN server_t *p_server, IN connect_t *p_connect, IN const char *name, IN int len)
+{
+    room_table_t *p_table = &(p_server->rooms);
+    connect_info_t *p_info = &(p_server->connect_infos[p_connect->fd]);
+    room_t *p_room = NULL;
+    room_t *p_new = NULL;
+    room_members_t *p_members = NULL;
+    msg_buf_t *p_replay = NULL;
+    int *new_fds = NULL;
+    int new_cap = 0;
+    room_t **pp_room = NULL;
+    unsigned int bucket = 0;
+
+    PFM_ENSURE_RET(0 < len && ROOM_NAME_SIZE > len && NULL == memchr(name, ' ', len), NULL);
+
+    p_room = connect_room_find(p_info, name, len);
+    if(NULL != p_room)
+    {
+        return p_room;
+    }
+    if(SERVER_ROOM_PER_CONNECT <= p_info->room_count)
+    {
+        DBG_ERR("connect fd %d joined too many rooms", p_connect->fd);
+        return NULL;
+    }
+
+    bucket = name_hash(name, len) & (SERVER_ROOM_BUCKETS - 1);
+    pthread_mutex_lock(&(p_table->mutex));
+    p_room = room_table_find(p_table, bucket, name, len);
+    if(NULL == p_room)
+    {
+        /* 恢复历史要解析日志，在注册表锁外创建，重新加锁后只做哈希桶插入 */
+        pthread_mutex_unlock(&(p_table->mutex));
+        p_new = room_create(p_server, name, len);
+        if(NULL == p_new)
+        {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&(p_table->mutex));
+        p_room = room_table_find(p_table, bucket, name, len);   /* 其他连接可能已创建同名房间 */
+        if(NULL == p_room)
+        {
+            p_room = p_new;
+            p_new = NULL;
+            p_room->next = p_table->buckets[bucket];
+            p_table->buckets[bucket] = p_room;
+            p_table->room_count++;
+        }
+    }
+
+    pthread_mutex_lock(&(p_room->mutex));
+    p_members = &(p_room->members[p_connect->reactor_id]);
+    if(p_members->count == p_members->cap)
+    {
+        new_cap = p_members->cap ? p_members->cap * 2 : SERVER_ROOM_MEMBERS_SIZE;
+        new_fds = (int *)realloc(p_members->fds, sizeof(int) * new_cap);
+        if(NULL == new_fds)
+        {
+            DBG_ERR("realloc for room %s members", p_room->name);
+            pthread_mutex_unlock(&(p_room->mutex));
+
+            /* 刚创建的空房间移出注册表 */
+            if(0 == p_room->member_count)
+            {
+                for(pp_room = &(p_table->buckets[bucket]); *pp_room != p_room; pp_room = &((*pp_room)->next));
+                *pp_room = p_room->next;
+                p_table->room_count--;
+                room_put(p_room);
+            }
+            pthread_mutex_unlock(&(p_table->mutex));
+            if(NULL != p_new)
+            {
+                room_put(p_new);
+            }
+            return NULL;
+        }
+        p_members->fds = new_fds;
+        p_members->cap = new_cap;
+    }
+    p_members->fds[p_members->count++] = p_connect->fd;
+    p_room->member_count++;
+
+    /* 在房间锁内投递回放，之后的房间消息都排在回放之后；调用者持有连接引用，投递失败时释放引用不会回收连接 */
+    p_replay = history_snapshot(&(p_room->history));
+    if(NULL != p_replay)
+    {
+        connect_hold(p_connect);
+        connect_post(p_server, p_connect, p_replay);
+        msg_buf_unref(p_replay);
+    }
+    pthread_mutex_unlock(&(p_room->mutex));
+
+    pthread_mutex_unlock(&(p_table->mutex));
+
+    /* 竞争中落选的房间从未发布，直接回收 */
+    if(NULL != p_new)
+    {
+        room_put(p_new);
+    }
+
+    p_info->rooms[p_info->room_count++] = p_room;
+    return p_room;
+}
+
+/*
+    function    把邮件中的帧发送给本reactor上的房间成员
+    in          p_reactor   指向reactor
+                p_mail      房间邮件
+    out
+    ret
+*/
+static void reactor_room_send(IN reactor_t *p_reactor, IN reactor_mail_t *p_mail)
+{
+    server_t *p_server = p_reactor->p_server;
+    room_members_t *p_members = NULL;
+    int i = 0;
+
+    /* 房间成员只会是本reactor的连接，成员离开须获取房间锁，遍历期间成员不会被释放 */
+    pthread_mutex_lock(&(p_mail->p_room->mutex));
+    p_members = &(p_mail->p_room->members[p_reactor->id]);
+    for(i = 0; i < p_members->count; ++i)
+    {
+        if(p_members->fds[i] != p_mail->exclude_fd)
+        {
+            connect_send(p_reactor, &(p_server->connects[p_members->fds[i]]), p_mail->p_buf);
+        }
+    }
+    pthread_mutex_unlock(&(p_mail->p_room->mutex));
+}
+
+/*
+    function    取出reactor邮箱中的所有邮件，发送给本reactor的连接，只在该reactor调用
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void reactor_mailbox_drain(IN reactor_t *p_reactor)
+{
+    server_t *p_server = p_reactor->p_server;
+    reactor_mail_t *p_mail = NULL;
+    int i = 0;
+
+    /* 先清除标志再取邮件，取邮件期间新投递的邮件会再次唤醒 */
+    atomic_store(&(p_reactor->mail_signaled), 0);
+
+    while(NULL != (p_mail = (reactor_mail_t *)mpsc_queue_pop(&(p_reactor->mailbox))))
+    {
+        if(NULL != p_mail->p_target)
+        {
+            /* 邮件持有目标连接的引用，槽位不会被其他连接复用 */
+            if(CONNECT_STATE_OPEN == atomic_load_explicit(&(p_mail->p_target->state), memory_order_acquire))
+            {
+                connect_send(p_reactor, p_mail->p_target, p_mail->p_buf);
+            }
+            connect_put(p_server, p_mail->p_target);
+        }
+        else if(NULL != p_mail->p_room)
+        {
+            reactor_room_send(p_reactor, p_mail);
+            room_put(p_mail->p_room);
+        }
+        else
+        {
+            for(i = 0; i < p_reactor->connect_count; ++i)
+            {
+                if(p_reactor->connect_fds[i] != p_mail->exclude_fd)  /* 不发送给自己 */
+                {
+                    connect_send(p_reactor, &(p_server->connects[p_reactor->connect_fds[i]]), p_mail->p_buf);
+                }
+            }
+        }
+        msg_buf_unref(p_mail->p_buf);
+        obj_pool_free(&(p_server->mail_pool), p_mail);
+    }
+}
+
+/*
+    function    生成连接的"[用户名] "前缀，之后每条消息只引用不再格式化
+    in          p_info      指向连接冷数据
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_prefix_render(IN connect_info_t *p_info)
+{
+    msg_buf_t *p_prefix = NULL;
+    int name_len = strnlen(p_info->user_name, USER_NAME_SIZE);
+
+    p_prefix = msg_buf_new(name_len + 3);
+    PFM_ENSURE_RET(NULL != p_prefix, ERR_NO_MEMORY);
+
+    p_prefix->data[0] = '[';
+    memcpy(p_prefix->data + 1, p_info->user_name, name_len);
+    p_prefix->data[name_len + 1] = ']';
+    p_prefix->data[name_len + 2] = ' ';
+
+    msg_buf_unref(p_info->p_prefix);
+    p_info->p_prefix = p_prefix;
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    将前缀与消息数据组成一帧，只编码帧头，前缀与消息数据作为分段引用，不拷贝
+    in          protocol    协议类型
+                tag         位于前缀之前的数据，随帧头一起拷贝，可为NULL
+                tag_len     tag长度
+                p_prefix    前缀
+                p_payload   消息数据
+                offset      消息数据的起始偏移，超出帧长度上限的部分被截断
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+static msg_buf_t *frame_buf_gather(IN msg_type_t protocol, IN const char *tag, IN int tag_len,
+                                   IN msg_buf_t *p_prefix, IN msg_buf_t *p_payload, IN int offset)
+{
+    char head[MSG_FRAME_HEADER_MAX + ROOM_NAME_SIZE + 1] = {};
+    msg_seg_t segs[2] = {{p_prefix, 0, p_prefix->len}, {p_payload, offset, p_payload->len - offset}};
+    int header_len = 0;
+    int length = 0;
+
+    PFM_ENSURE_RET(0 <= tag_len && (int)sizeof(head) - MSG_FRAME_HEADER_MAX >= tag_len, NULL);
+
+    if(tag_len + segs[0].len + segs[1].len > MSG_FRAME_DATA_MAX)
+    {
+        segs[1].len = MSG_FRAME_DATA_MAX - tag_len - segs[0].len;
+    }
+    length = tag_len + segs[0].len + segs[1].len;
+
+    header_len = msg_frame_header_encode(MSG_FRAME_VERSION, protocol, 0, length, head);
+    PFM_ENSURE_RET(0 < header_len, NULL);
+    if(tag_len > 0)
+    {
+        memcpy(head + header_len, tag, tag_len);
+    }
+    return msg_buf_gather(head, header_len + tag_len, segs, 2);
+}
+
+/*
+    function    将前缀、文件名与暂存文件组成一个流式帧，帧头、前缀与文件名拷贝到data中，暂存文件作为分段引用，发送时由sendfile发出
+    in          protocol    协议类型
+                p_prefix    前缀
+                name        文件名，连同结束符一起拷贝，公共消息为NULL
+                name_len    name长度，含结束符
+                p_file      暂存文件
+    out
+    ret         缓冲区指针，失败返回NULL
+*/
+static msg_buf_t *frame_buf_stream(IN msg_type_t protocol, IN msg_buf_t *p_prefix, IN const char *name, IN int name_len,
+                                   IN msg_buf_t *p_file)
+{
+    char head[MSG_FRAME_HEADER_MAX + USER_NAME_SIZE + 3 + MSG_FILE_NAME_MAX + 1] = {};
+    msg_seg_t seg = {p_file, 0, p_file->len};
+    int header_len = 0;
+
+    PFM_ENSURE_RET(0 <= name_len && MSG_FILE_NAME_MAX + 1 >= name_len && (int)sizeof(head) - MSG_FRAME_HEADER_MAX - name_len >= p_prefix->len, NULL);
+
+    header_len = msg_frame_header_encode(MSG_FRAME_VERSION, protocol, 0, p_prefix->len + name_len + p_file->len, head);
+    PFM_ENSURE_RET(0 < header_len, NULL);
+    memcpy(head + header_len, p_prefix->data, p_prefix->len);
+    if(name_len > 0)
+    {
+        memcpy(head + header_len + p_prefix->len, name, name_len);
+    }
+    return msg_buf_gather(head, header_len + p_prefix->len + name_len, &seg, 1);
+}
+
+/*
+    function    处理客户端消息
+    in          s_c     指向服务器连接参数
+    out
+    ret
+*/
+static void handle_client_msg(void *s_c)
+{
+    server_connect_t *arg = (server_connect_t *)s_c;
+    server_t *p_server = arg->p_server;
+    int connect_fd = arg->connect_fd;
+    connect_t *p_connect = NULL;
+    connect_info_t *p_info = NULL;
+    char buffer_tmp[BUFFER_SIZE*2] = {};
+    msg_buf_t *p_buf = NULL;
+    room_t *p_room = NULL;
+    connect_t *p_target = NULL;
+    char *p_space = NULL;
+    uint8_t version = 0;
+    uint8_t caps = 0;
+    int length = 0;
+
+    PFM_ENSURE_RET(NULL != p_server, );
+    PFM_ENSURE_RET(-1 != connect_fd, );
+
+    /* 任务持有连接引用，连接即使已被关闭，槽位也不会被复用 */
+    p_connect = &(p_server->connects[connect_fd]);
+    p_info = &(p_server->connect_infos[connect_fd]);
+
+    switch(arg->protocol)
+    {
+        case MSG_TYPE_USER_REGISTER:    /* 处理用户注册 */
+        {
+            DBG("handle user register from fd %d: %s", connect_fd, arg->p_payload->data);
+
+            /* 数据为"用户名\0能力块"时应答握手：先记录协商结果再投递应答，应答与之后的帧都以版本帧发出 */
+            if(msg_register_decode(arg->p_payload->data, arg->p_payload->len, &length, &version, &caps) && 0 < version)
+            {
+                version = version < MSG_FRAME_VERSION ? version : MSG_FRAME_VERSION;
+                caps &= p_server->compress ? MSG_CAPS_SUPPORTED : (MSG_CAPS_SUPPORTED & ~MSG_CAPS_COMPRESS);
+                atomic_store_explicit(&p_connect->caps, caps, memory_order_relaxed);
+                atomic_store_explicit(&p_connect->version, version, memory_order_relaxed);
+
+                msg_caps_encode(version, caps, buffer_tmp);
+                p_buf = frame_buf_new(MSG_TYPE_USER_REGISTER, MSG_FLAG_HANDSHAKE, buffer_tmp, MSG_CAPS_SIZE);
+                if(NULL != p_buf)
+                {
+                    connect_hold(p_connect);
+                    connect_post(p_server, p_connect, p_buf);
+                    msg_buf_unref(p_buf);
+                    p_buf = NULL;
+                }
+                DBG("fd %d negotiated frame version %d, caps 0x%02x", connect_fd, version, caps);
+            }
+            length = length < USER_NAME_SIZE ? length : USER_NAME_SIZE - 1;
+            if(ERR_NO_ERROR != user_index_bind(p_server, connect_fd, arg->p_payload->data, length))
+            {
+                /* 用户名已被占用，只通知注册者 */
+                DBG_ERR("user name %.*s from fd %d already exists", length, arg->p_payload->data, connect_fd);
+                snprintf(buffer_tmp, sizeof(buffer_tmp), "user name %.*s is taken", length, arg->p_payload->data);
+                p_buf = frame_buf_new(MSG_TYPE_USER_REGISTER, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+                connect_hold(p_connect);
+                p_target = p_connect;
+                break;
+            }
+            connect_prefix_render(p_info);
+
+            /* 回放公共消息历史，所有帧一次发送 */
+            server_history_recover(p_server);
+            p_buf = history_snapshot(&(p_server->history));
+            if(NULL != p_buf)
+            {
+                connect_hold(p_connect);
+                p_target = p_connect;
+            }
+            break;
+        }
+        case MSG_TYPE_MSG:  /* 处理普通消息 */
+        {
+            DBG("handle client msg from fd %d, user_name %s: %s", connect_fd, p_info->user_name, arg->p_payload->data);
+
+            /* 未注册的连接首次发言时生成空用户名的前缀 */
+            if(NULL == p_info->p_prefix && ERR_NO_ERROR != connect_prefix_render(p_info))
+            {
+                break;
+            }
+
+            /* 封装消息：帧头 + 前缀 + 消息数据；超长消息的数据在暂存文件中 */
+            if(NULL != arg->p_file)
+            {
+                p_buf = frame_buf_stream(MSG_TYPE_MSG, p_info->p_prefix, NULL, 0, arg->p_file);
+                break;
+            }
+            p_buf = frame_buf_gather(MSG_TYPE_MSG, NULL, 0, p_info->p_prefix, arg->p_payload, 0);
+            break;
+        }
+        case MSG_TYPE_FILE: /* 处理文件分享 */
+        {
+            DBG("handle file %s of %d bytes from fd %d, %s", arg->p_payload->data,
+                NULL != arg->p_file ? arg->p_file->len : 0, connect_fd, p_info->user_name);
+
+            if(NULL == arg->p_file ||
+                (NULL == p_info->p_prefix && ERR_NO_ERROR != connect_prefix_render(p_info)))
+            {
+                break;
+            }
+
+            /* 封装消息：帧头 + 前缀 + "文件名\0" + 暂存文件，文件内容不经过用户态，所有接收者共享同一个暂存文件 */
+            p_buf = frame_buf_stream(MSG_TYPE_FILE, p_info->p_prefix, arg->p_payload->data, arg->p_payload->len + 1, arg->p_file);
+            break;
+        }
+        case MSG_TYPE_USER_OFFLINE: /* 处理下线消息 */
+        {
+            DBG("handle user offline from fd %d, %s", connect_fd, p_info->user_name);
+
+            /* 封装消息 */
+            snprintf(buffer_tmp, sizeof(buffer_tmp), "[%s] offline", p_info->user_name);
+            p_buf = frame_buf_new(MSG_TYPE_USER_OFFLINE, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+            break;
+        }
+        case MSG_TYPE_USER_ONLINE: /* 处理上线消息 */
+        {
+            DBG("handle user online from fd %d, %s", connect_fd, p_info->user_name);
+
+            /* 封装消息 */
+            snprintf(buffer_tmp, sizeof(buffer_tmp), "[%s] online", p_info->user_name);
+            p_buf = frame_buf_new(MSG_TYPE_USER_ONLINE, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+            break;
+        }
+        case MSG_TYPE_ROOM_JOIN:    /* 处理加入房间 */
+        {
+            DBG("handle room join from fd %d, %s: %s", connect_fd, p_info->user_name, arg->p_payload->data);
+
+            p_room = room_join(p_server, p_connect, arg->p_payload->data, arg->p_payload->len);
+            if(NULL == p_room)
+            {
+                break;
+            }
+
+            /* 通知房间其他成员 */
+            snprintf(buffer_tmp, sizeof(buffer_tmp), "%s [%s] joined", p_room->name, p_info->user_name);
+            p_buf = frame_buf_new(MSG_TYPE_ROOM_JOIN, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+            break;
+        }
+        case MSG_TYPE_ROOM_LEAVE:   /* 处理离开房间 */
+        {
+            DBG("handle room leave from fd %d, %s: %s", connect_fd, p_info->user_name, arg->p_payload->data);
+
+            p_room = connect_room_find(p_info, arg->p_payload->data, arg->p_payload->len);
+            if(NULL == p_room)
+            {
+                break;
+            }
+
+            /* 先通知房间其他成员再离开，离开后房间可能已被回收 */
+            snprintf(buffer_tmp, sizeof(buffer_tmp), "%s [%s] left", p_room->name, p_info->user_name);
+            p_buf = frame_buf_new(MSG_TYPE_ROOM_LEAVE, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+            if(NULL != p_buf)
+            {
+                room_broadcast(p_server, p_room, connect_fd, p_buf, 0);
+                msg_buf_unref(p_buf);
+                p_buf = NULL;
+            }
+            room_leave(p_server, p_connect, p_room);
+            break;
+        }
+        case MSG_TYPE_ROOM_MSG: /* 处理房间消息 */
+        {
+            DBG("handle room msg from fd %d, %s: %s", connect_fd, p_info->user_name, arg->p_payload->data);
+
+            /* 数据为"房间名 消息"，只能向已加入的房间发送 */
+            p_space = memchr(arg->p_payload->data, ' ', arg->p_payload->len);
+            if(NULL == p_space)
+            {
+                DBG_ERR("bad room msg from client fd %d", connect_fd);
+                break;
+            }
+            length = p_space - arg->p_payload->data;
+            p_room = connect_room_find(p_info, arg->p_payload->data, length);
+            if(NULL == p_room)
+            {
+                DBG_ERR("client fd %d is not in room %.*s", connect_fd, length, arg->p_payload->data);
+                break;
+            }
+            if(NULL == p_info->p_prefix && ERR_NO_ERROR != connect_prefix_render(p_info))
+            {
+                break;
+            }
+
+            /* 封装消息：帧头 + "房间名 " + 前缀 + 消息数据 */
+            length++;
+            p_buf = frame_buf_gather(MSG_TYPE_ROOM_MSG, arg->p_payload->data, length, p_info->p_prefix, arg->p_payload, length);
+            break;
+        }
+        case MSG_TYPE_DIRECT:   /* 处理私聊消息 */
+        {
+            DBG("handle direct msg from fd %d, %s: %s", connect_fd, p_info->user_name, arg->p_payload->data);
+
+            /* 数据为"用户名 消息" */
+            p_space = memchr(arg->p_payload->data, ' ', arg->p_payload->len);
+            if(NULL == p_space)
+            {
+                DBG_ERR("bad direct msg from client fd %d", connect_fd);
+                break;
+            }
+            length = p_space - arg->p_payload->data;
+
+            p_target = user_index_hold(p_server, arg->p_payload->data, length);
+            if(NULL == p_target)
+            {
+                /* 对方不在线，以下线消息通知发送者 */
+                snprintf(buffer_tmp, sizeof(buffer_tmp), "[%.*s] offline", length, arg->p_payload->data);
+                p_buf = frame_buf_new(MSG_TYPE_USER_OFFLINE, 0, buffer_tmp, strnlen(buffer_tmp, MSG_FRAME_DATA_MAX));
+                connect_hold(p_connect);
+                p_target = p_connect;
+                break;
+            }
+            if(NULL == p_info->p_prefix && ERR_NO_ERROR != connect_prefix_render(p_info))
+            {
+                break;
+            }
+
+            /* 封装消息：帧头 + 前缀 + 消息数据 */
+            p_buf = frame_buf_gather(MSG_TYPE_DIRECT, NULL, 0, p_info->p_prefix, arg->p_payload, length + 1);
+            break;
+        }
+        default:
+        {
+            DBG_ERR("unknown message type %d from client fd %d", arg->protocol, connect_fd);
+            break;
+        }
+    }
+
+    /* 单播只发送给目标连接，房间消息只发送给房间成员，其余广播给其他客户端，帧只编码一次，所有接收者共享 */
+    if(NULL != p_target)
+    {
+        if(NULL != p_buf)
+        {
+            connect_post(p_server, p_target, p_buf);
+            msg_buf_unref(p_buf);
+        }
+        else
+        {
+            connect_put(p_server, p_target);
+        }
+    }
+    else if(NULL != p_buf)
+    {
+        /* 只有聊天消息记入历史与日志，上下线与加入离开通知不回放；日志只拷贝到待写缓冲区，落盘由写线程完成；
+           流式帧的数据在暂存文件中，不记录 */
+        if(p_server->log_enabled && NULL == arg->p_file && (MSG_TYPE_MSG == arg->protocol || MSG_TYPE_ROOM_MSG == arg->protocol))
+        {
+            msg_log_append(&(p_server->log), p_buf);
+        }
+        if(NULL != p_room)
+        {
+            room_broadcast(p_server, p_room, connect_fd, p_buf, MSG_TYPE_ROOM_MSG == arg->protocol);
+        }
+        else
+        {
+            if(MSG_TYPE_MSG == arg->protocol && NULL == arg->p_file)
+            {
+                server_history_recover(p_server);
+                history_append(&(p_server->history), p_buf);
+            }
+            server_broadcast(p_server, connect_fd, p_buf);
+        }
+        msg_buf_unref(p_buf);
+    }
+
+    msg_buf_unref(arg->p_payload);
+    msg_buf_unref(arg->p_file);
+    connect_put(p_server, p_connect);  /* 释放任务持有的连接引用 */
+    obj_pool_free(&(p_server->s_c_pool), s_c);  /* 释放服务器连接参数内存 */
+    return;
+}
+
+/*
+    function    登记新接受的连接，加入连接表与reactor的I/O后端，连接归该reactor所有
+    in          p_reactor   指向reactor
+                client_fd   已设为非阻塞的连接描述符
+    out
+    ret         errCode，失败时描述符已关闭
+*/
+static ERR_CODE reactor_connect_register(IN reactor_t *p_reactor, IN int client_fd)
+{
+    connect_t *p_connect = NULL;
+
+    /* 先加入连接表，epoll事件到达时即可查到连接 */
+    p_connect = connect_table_add(p_reactor, client_fd);
+    if(NULL == p_connect)
+    {
+        close(client_fd);
+        return ERR_SERVER_NEW_CONNECT;
+    }
+
+    if(ERR_NO_ERROR != p_reactor->p_backend->connect_add(p_reactor, p_connect))
+    {
+        connect_table_del(p_reactor->p_server, p_connect);  /* 释放引用时关闭描述符 */
+        return ERR_SERVER_NEW_CONNECT;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    描述符耗尽时用备用描述符接受一个排队的连接并立即关闭，避免边沿触发下队列中的连接无人处理
+    in          p_reactor   指向reactor
+    out
+    ret         errCode，无备用描述符或接受失败时返回ERR_SERVER_NEW_CONNECT
+*/
+static ERR_CODE reactor_accept_reject(IN reactor_t *p_reactor)
+{
+    int client_fd = -1;
+
+    if(-1 == p_reactor->spare_fd)
+    {
+        return ERR_SERVER_NEW_CONNECT;
+    }
+
+    close(p_reactor->spare_fd);
+    client_fd = accept(p_reactor->socket_fd, NULL, NULL);
+    if(-1 != client_fd)
+    {
+        close(client_fd);
+    }
+    p_reactor->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    DBG_ERR("reactor %d out of file descriptors, rejected a pending connection", p_reactor->id);
+    return (-1 == client_fd) ? ERR_SERVER_NEW_CONNECT : ERR_NO_ERROR;
+}
+
+/*
+    function    接受监听队列中的所有新连接，监听socket为边沿触发，必须接受到EAGAIN为止
+    in          p_reactor   指向reactor
+    out
+    ret         errCode，任一连接处理失败时返回ERR_SERVER_NEW_CONNECT
+*/
+static ERR_CODE handler_new_connection(IN reactor_t *p_reactor)
+{
+    struct sockaddr_in client_addr = {};
+    socklen_t addr_len = 0;
+    int client_fd = -1;
+    int accepted = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    PFM_ENSURE_RET(NULL != p_reactor, ERR_BAD_PARAM);
+
+    while(1)
+    {
+        /* 接受时即设为非阻塞与exec时关闭，省去每个连接一次fcntl */
+        addr_len = sizeof(client_addr);
+        client_fd = accept4(p_reactor->socket_fd, (struct sockaddr *)&client_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(-1 == client_fd)
+        {
+            if(EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                break;  /* 队列已空 */
+            }
+            if(EINTR == errno || ECONNABORTED == errno)
+            {
+                continue;   /* 被信号打断或对端在接受前已重置 */
+            }
+            if((EMFILE == errno || ENFILE == errno) && ERR_NO_ERROR == reactor_accept_reject(p_reactor))
+            {
+                continue;
+            }
+            DBG_ERR("accept new connection failed");
+            perror("accept4");
+            ret = ERR_SERVER_NEW_CONNECT;
+            break;
+        }
+        DBG("reactor %d accepted new connection from %s:%d, fd %d", p_reactor->id, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), client_fd);
+
+        if(ERR_NO_ERROR != reactor_connect_register(p_reactor, client_fd))
+        {
+            DBG_ERR("handle new connection fd %d failed", client_fd);
+            ret = ERR_SERVER_NEW_CONNECT;
+            continue;
+        }
+        accepted++;
+    }
+
+    DBG("reactor %d accepted %d connections", p_reactor->id, accepted);
+    return ret;
+}
+
+/*
+    function    按fd查找reactor自己拥有的已建立连接，同一批epoll事件中fd可能已被关闭并被其他reactor复用
+    in          p_reactor    指向reactor
+                connect_fd   连接文件描述符
+    out
+    ret         连接指针，连接不存在或不属于该reactor时返回NULL
+*/
+static connect_t *reactor_connect_get(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    connect_t *p_connect = NULL;
+
+    p_connect = connect_table_get(p_reactor->p_server, connect_fd);
+    if(NULL == p_connect || p_connect->reactor_id != p_reactor->id)
+    {
+        return NULL;
+    }
+
+    return p_connect;
+}
+
+/*
+    function    关闭连接：移出I/O后端与活跃连接数组，在途任务与I/O请求全部结束后才关闭描述符，只在所属reactor调用
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+    out
+    ret
+*/
+static void server_connect_close(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    connect_t *p_connect = NULL;
+
+    p_connect = reactor_connect_get(p_reactor, connect_fd);
+    if(NULL == p_connect)
+    {
+        return;
+    }
+
+    p_reactor->p_backend->connect_del(p_reactor, p_connect);  /* 停止接收数据 */
+    connect_table_del(p_reactor->p_server, p_connect);
+}
+
+/*
+    function    批量提交本轮epoll事件产生的任务，线程池队列满时reactor自行执行剩余任务，读取随之变慢，形成背压而不是丢弃消息
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void reactor_task_batch_flush(IN reactor_t *p_reactor)
+{
+    int added = 0;
+    int i = 0;
+
+    if(0 == p_reactor->task_batch_count)
+    {
+        return;
+    }
+
+    thread_pool_add_tasks(&(p_reactor->p_server->thread_pool), p_reactor->task_batch, p_reactor->task_batch_count, &added);
+    for(i = added; i < p_reactor->task_batch_count; ++i)
+    {
+        p_reactor->task_batch[i].task_func(p_reactor->task_batch[i].arg);
+    }
+    p_reactor->task_batch_count = 0;
+}
+
+/*
+    function    暂存待提交的任务，数组满时扩容，扩容失败时先批量提交已暂存的任务
+    in          p_reactor   指向reactor
+                p_task      任务
+    out
+    ret
+*/
+static void reactor_task_batch_add(IN reactor_t *p_reactor, IN const task_t *p_task)
+{
+    int new_cap = 0;
+    task_t *new_batch = NULL;
+
+    if(p_reactor->task_batch_count == p_reactor->task_batch_cap)
+    {
+        new_cap = p_reactor->task_batch_cap ? p_reactor->task_batch_cap * 2 : SERVER_EPOLL_EVENT_SIZE;
+        new_batch = (task_t *)realloc(p_reactor->task_batch, sizeof(task_t) * new_cap);
+        if(NULL == new_batch)
+        {
+            DBG_ERR("realloc task batch for reactor %d", p_reactor->id);
+            reactor_task_batch_flush(p_reactor);
+        }
+        else
+        {
+            p_reactor->task_batch = new_batch;
+            p_reactor->task_batch_cap = new_cap;
+        }
+    }
+
+    if(p_reactor->task_batch_count < p_reactor->task_batch_cap)
+    {
+        p_reactor->task_batch[p_reactor->task_batch_count++] = *p_task;
+    }
+    else if(ERR_NO_ERROR != thread_pool_add_task(&(p_reactor->p_server->thread_pool), p_task->task_func, p_task->arg))
+    {
+        p_task->task_func(p_task->arg);
+    }
+}
+
+/*
+    function    把一条消息加入连接的串行执行器，同一连接的消息按顺序处理
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                protocol    协议类型
+                p_payload   消息数据，由任务接管
+                p_file      流式帧的暂存文件，普通帧为NULL，由任务接管
+    out
+    ret         errCode，失败时释放p_payload与p_file
+*/
+static ERR_CODE server_dispatch_task(IN server_t *p_server, IN connect_t *p_connect, IN msg_type_t protocol,
+                                     IN msg_buf_t *p_payload, IN msg_buf_t *p_file)
+{
+    server_connect_t *s_c = NULL;
+    task_t run = {};
+
+    s_c = (server_connect_t *)obj_pool_alloc(&(p_server->s_c_pool));
+    if(NULL == s_c)
+    {
+        DBG_ERR("alloc for server connect");
+        msg_buf_unref(p_payload);
+        msg_buf_unref(p_file);
+        return ERR_NO_MEMORY;
+    }
+
+    s_c->protocol = protocol;
+    s_c->p_payload = p_payload;
+    s_c->p_file = p_file;
+    s_c->p_server = p_server;
+    s_c->connect_fd = p_connect->fd;
+    connect_hold(p_connect);  /* 任务持有连接引用 */
+
+    /* 执行器由空闲转为活跃时，本轮事件处理完后批量提交 */
+    if(thread_strand_push(&(p_connect->strand), &(s_c->strand_task), handle_client_msg, (void*)s_c, &run))
+    {
+        reactor_task_batch_add(&(p_server->reactors[p_connect->reactor_id]), &run);
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    拒绝流式帧：帧数据到达后直接丢弃，不创建暂存文件，并告知发送者
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                p_header    已解析的帧头
+                reason      拒绝原因
+    out
+    ret         消费的字节数，即帧头
+*/
+static int connect_upload_reject(IN server_t *p_server, IN connect_t *p_connect, IN const msg_header_t *p_header, IN const char *reason)
+{
+    char text[MSG_FRAME_DATA_MAX + 1] = {};
+    msg_buf_t *p_buf = NULL;
+
+    DBG_ERR("reject %d byte upload from client %d: %s", p_header->length, p_connect->fd, reason);
+    p_connect->upload_discard = p_header->length;
+
+    /* 在所属reactor中直接入队，本轮事件处理完后发出 */
+    snprintf(text, sizeof(text), "upload of %d bytes rejected: %s", p_header->length, reason);
+    p_buf = frame_buf_new(MSG_TYPE_MSG, 0, text, strlen(text));
+    if(NULL != p_buf)
+    {
+        connect_send(&(p_server->reactors[p_connect->reactor_id]), p_connect, p_buf);
+        msg_buf_unref(p_buf);
+    }
+
+    return p_header->header_len;
+}
+
+/*
+    function    开始接收流式帧：帧数据不在读缓冲区中积累，而是暂存到memfd，整帧收齐后作为文件缓冲区交给工作线程；
+                文件分享先从数据开头取出文件名；超过大小上限或暂存中的流式帧已满时在创建暂存文件之前拒绝
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                buf         帧的起始位置
+                len         读缓冲区中从帧起始开始的字节数
+                p_header    已解析的帧头
+    out
+    ret         >0 消费的字节数，即帧头与文件名，0 文件名尚未到齐，-1 帧非法或暂存文件创建失败
+*/
+static int connect_upload_begin(IN server_t *p_server, IN connect_t *p_connect, IN const char *buf, IN int len,
+                                IN const msg_header_t *p_header)
+{
+    const char *data = buf + p_header->header_len;
+    const char *p_nul = NULL;
+    msg_buf_t *p_head = NULL;
+    int avail = len - p_header->header_len;
+    int limit = 0;
+    int name_len = 0;
+
+    /* 只有注册时协商了流式能力的客户端可以发送流式帧，协商结果在握手应答发出前记录 */
+    if(0 == (atomic_load_explicit(&p_connect->caps, memory_order_relaxed) & MSG_CAPS_STREAM))
+    {
+        DBG_ERR("stream frame from client %d without stream caps", p_connect->fd);
+        return -1;
+    }
+    if(p_header->length > p_server->upload_max)
+    {
+        return connect_upload_reject(p_server, p_connect, p_header, "too large");
+    }
+
+    /* 文件分享的数据为"文件名\0文件内容" */
+    if(MSG_TYPE_FILE == p_header->protocol)
+    {
+        limit = avail < p_header->length ? avail : p_header->length;
+        limit = limit < MSG_FILE_NAME_MAX + 1 ? limit : MSG_FILE_NAME_MAX + 1;
+        p_nul = (const char *)memchr(data, '\0', limit);
+        if(NULL == p_nul)
+        {
+            if(limit == avail && avail < p_header->length && avail < MSG_FILE_NAME_MAX + 1)
+            {
+                return 0;
+            }
+            DBG_ERR("bad file name from client %d", p_connect->fd);
+            return -1;
+        }
+        name_len = p_nul - data;
+        if(0 == name_len)
+        {
+            DBG_ERR("empty file name from client %d", p_connect->fd);
+            return -1;
+        }
+    }
+
+    /* 占用一个暂存名额，文件名到齐之后才占用，避免等待文件名时名额被长期占住 */
+    if(atomic_fetch_add_explicit(&(p_server->upload_count), 1, memory_order_relaxed) >= p_server->upload_concurrency)
+    {
+        atomic_fetch_sub_explicit(&(p_server->upload_count), 1, memory_order_relaxed);
+        return connect_upload_reject(p_server, p_connect, p_header, "server busy");
+    }
+
+    p_head = msg_buf_new(name_len + 1);
+    if(NULL == p_head)
+    {
+        atomic_fetch_sub_explicit(&(p_server->upload_count), 1, memory_order_relaxed);
+        return -1;
+    }
+    memcpy(p_head->data, data, name_len);
+    p_head->data[name_len] = '\0';
+    p_head->len = name_len;
+    p_head->data_len = name_len;
+
+    p_connect->upload_fd = memfd_create("chat-upload", MFD_CLOEXEC);
+    if(-1 == p_connect->upload_fd)
+    {
+        DBG_ERR("memfd create for upload from client %d", p_connect->fd);
+        atomic_fetch_sub_explicit(&(p_server->upload_count), 1, memory_order_relaxed);
+        msg_buf_unref(p_head);
+        return -1;
+    }
+    p_connect->p_upload_head = p_head;
+    p_connect->upload_protocol = p_header->protocol;
+    p_connect->upload_len = p_header->length - (MSG_TYPE_FILE == p_header->protocol ? name_len + 1 : 0);
+    p_connect->upload_left = p_connect->upload_len;
+
+    DBG("client %d uploading %d bytes", p_connect->fd, p_connect->upload_len);
+    return p_header->header_len + (MSG_TYPE_FILE == p_header->protocol ? name_len + 1 : 0);
+}
+
+/*
+    function    把读缓冲区中属于流式帧的数据写入暂存文件，整帧收齐后交给连接的串行执行器
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+                buf         读缓冲区中的数据
+                len         数据长度
+    out
+    ret         消费的字节数，写暂存文件或提交任务失败返回-1
+*/
+static int connect_upload_write(IN server_t *p_server, IN connect_t *p_connect, IN const char *buf, IN int len)
+{
+    msg_buf_t *p_file = NULL;
+    msg_buf_t *p_head = NULL;
+    ssize_t n = 0;
+    int total = len < p_connect->upload_left ? len : p_connect->upload_left;
+    int written = 0;
+
+    while(written < total)
+    {
+        n = write(p_connect->upload_fd, buf + written, total - written);
+        if(n < 0)
+        {
+            if(EINTR == errno)  continue;
+            DBG_ERR("write upload from client %d", p_connect->fd);
+            return -1;
+        }
+        written += n;
+    }
+    p_connect->upload_left -= written;
+    if(0 < p_connect->upload_left)
+    {
+        return written;
+    }
+
+    /* 整帧收齐，暂存文件由文件缓冲区接管 */
+    p_file = msg_buf_file(p_connect->upload_fd, p_connect->upload_len);
+    if(NULL == p_file)
+    {
+        return -1;  /* 暂存文件在连接释放时关闭 */
+    }
+    p_head = p_connect->p_upload_head;
+    p_connect->upload_fd = -1;
+    p_connect->p_upload_head = NULL;
+    atomic_fetch_sub_explicit(&(p_server->upload_count), 1, memory_order_relaxed);
+
+    if(ERR_NO_ERROR != server_dispatch_task(p_server, p_connect, p_connect->upload_protocol, p_head, p_file))
+    {
+        return -1;
+    }
+    return written;
+}
+
+/*
+    function    从连接读缓冲区中取出所有完整帧，逐帧加入连接的串行执行器，剩余半帧移到缓冲区头部；流式帧的数据边收边写入暂存文件
+    in          p_server    指向服务器对象
+                p_connect   指向连接
+    out
+    ret         errCode，帧非法时返回ERR_PROTOCOL_FRAME
+*/
+static ERR_CODE server_dispatch_frames(IN server_t *p_server, IN connect_t *p_connect)
+{
+    msg_buf_t *p_payload = NULL;
+    msg_header_t header = {};
+    int offset = 0;
+    int consumed = 0;
+    int length = 0;
+    ERR_CODE ret = ERR_NO_ERROR;
+
+    while(offset < p_connect->read_len)
+    {
+        if(0 <= p_connect->upload_fd)
+        {
+            consumed = connect_upload_write(p_server, p_connect, p_connect->read_buf + offset, p_connect->read_len - offset);
+            if(consumed < 0)
+            {
+                ret = ERR_FILE_WRITE;
+                break;
+            }
+            offset += consumed;
+            continue;
+        }
+
+        /* 被拒绝的流式帧的数据不暂存，收到即丢弃 */
+        if(0 < p_connect->upload_discard)
+        {
+            consumed = p_connect->read_len - offset < p_connect->upload_discard ? p_connect->read_len - offset : p_connect->upload_discard;
+            p_connect->upload_discard -= consumed;
+            offset += consumed;
+            continue;
+        }
+
+        /* 两种帧格式都接受，旧客户端无需升级 */
+        memset(&header, 0, sizeof(header));
+        consumed = msg_frame_header_decode(p_connect->read_buf + offset, p_connect->read_len - offset, &header);
+        if(consumed < 0)
+        {
+            DBG_ERR("bad frame from client %d", p_connect->fd);
+            ret = ERR_PROTOCOL_FRAME;
+            break;
+        }
+
+        /* 只有注册时协商了压缩能力的客户端可以发送压缩帧，不为其他连接在reactor上解压 */
+        if(0 < header.header_len && (header.flags & MSG_FLAG_COMPRESSED) &&
+           0 == (atomic_load_explicit(&p_connect->caps, memory_order_relaxed) & MSG_CAPS_COMPRESS))
+        {
+            DBG_ERR("compressed frame from client %d without compress caps", p_connect->fd);
+            ret = ERR_PROTOCOL_FRAME;
+            break;
+        }
+
+        /* 超长消息与文件分享只要帧头完整即开始暂存，不等整帧到齐 */
+        if(0 < header.header_len && (MSG_TYPE_FILE == header.protocol || MSG_FRAME_DATA_MAX < header.length))
+        {
+            consumed = connect_upload_begin(p_server, p_connect, p_connect->read_buf + offset, p_connect->read_len - offset, &header);
+            if(consumed < 0)
+            {
+                ret = ERR_PROTOCOL_FRAME;
+                break;
+            }
+            if(0 == consumed)
+            {
+                break;  /* 文件名未到齐 */
+            }
+            offset += consumed;
+
+            /* 空文件没有后续数据，立即提交 */
+            if(0 <= p_connect->upload_fd && 0 == p_connect->upload_left && 0 > connect_upload_write(p_server, p_connect, NULL, 0))
+            {
+                ret = ERR_FILE_WRITE;
+                break;
+            }
+            continue;
+        }
+        if(0 == consumed)
+        {
+            break;  /* 数据不足一帧，等待后续数据 */
+        }
+
+        /* 消息数据只在此拷贝一次，之后作为广播帧的分段被引用；多申请一个字节存放结束符 */
+        length = (header.flags & MSG_FLAG_COMPRESSED) ? MSG_FRAME_DATA_MAX : header.length;
+        p_payload = msg_buf_new(length + 1);
+        if(NULL == p_payload)
+        {
+            DBG_ERR("alloc for client %d payload", p_connect->fd);
+            ret = ERR_NO_MEMORY;
+            break;
+        }
+
+        /* 压缩帧在此解压，广播时再由接收者共享一份重新压缩的变体 */
+        if(header.flags & MSG_FLAG_COMPRESSED)
+        {
+            length = msg_data_decompress(p_connect->read_buf + offset + header.header_len, header.length, p_payload->data, length);
+            if(length < 0)
+            {
+                DBG_ERR("bad compressed frame from client %d", p_connect->fd);
+                msg_buf_unref(p_payload);
+                ret = ERR_PROTOCOL_FRAME;
+                break;
+            }
+        }
+        else
+        {
+            memcpy(p_payload->data, p_connect->read_buf + offset + header.header_len, length);
+        }
+        p_payload->data[length] = '\0';
+        p_payload->len = length;
+        p_payload->data_len = length;
+        offset += consumed;
+
+        ret = server_dispatch_task(p_server, p_connect, header.protocol, p_payload, NULL);
+        if(ERR_NO_ERROR != ret)
+        {
+            break;
+        }
+    }
+
+    /* 将剩余半帧移到缓冲区头部 */
+    if(offset > 0)
+    {
+        memmove(p_connect->read_buf, p_connect->read_buf + offset, p_connect->read_len - offset);
+        p_connect->read_len -= offset;
+    }
+
+    return ret;
+}
+
+/*
+    function    扩容连接读缓冲区，首次调用时分配
+    in          p_connect   指向连接
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_read_buffer_grow(IN connect_t *p_connect)
+{
+    int new_cap = p_connect->read_cap ? p_connect->read_cap * 2 : SERVER_READ_BUFFER_SIZE;
+    char *new_buf = NULL;
+
+    new_buf = (char *)realloc(p_connect->read_buf, new_cap);
+    if(NULL == new_buf)
+    {
+        DBG_ERR("realloc read buffer for connect fd %d", p_connect->fd);
+        return ERR_NO_MEMORY;
+    }
+
+    p_connect->read_buf = new_buf;
+    p_connect->read_cap = new_cap;
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    处理可写事件，发送积压的数据，发送完毕后取消EPOLLOUT
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+    out
+    ret         errCode
+*/
+static ERR_CODE handler_write_event(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    server_t *p_server = NULL;
+    connect_t *p_connect = NULL;
+
+    PFM_ENSURE_RET(NULL != p_reactor, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(-1 != connect_fd, ERR_BAD_PARAM);
+    p_server = p_reactor->p_server;
+
+    p_connect = reactor_connect_get(p_reactor, connect_fd);
+    PFM_ENSURE_RET(NULL != p_connect, ERR_BAD_PARAM);
+
+    pthread_mutex_lock(&(p_connect->out_mutex));
+    if(ERR_NO_ERROR != connect_flush(p_connect))
+    {
+        p_connect->out_error = 1;
+        shutdown(connect_fd, SHUT_RDWR);
+    }
+    if(0 == p_connect->out_count)
+    {
+        connect_arm_write(p_server, p_connect, 0);
+    }
+    pthread_mutex_unlock(&(p_connect->out_mutex));
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    处理可读事件，边沿触发下循环读取直到EAGAIN，每次读取后取出所有完整帧
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+    out
+    ret         errCode
+*/
+static ERR_CODE handler_read_event(IN reactor_t *p_reactor, IN int connect_fd)
+{
+    server_t *p_server = NULL;
+    ssize_t bytes_read = 0;
+    connect_t *p_connect = NULL;
+    int closed = 0;
+
+    PFM_ENSURE_RET(NULL != p_reactor, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(-1 != connect_fd, ERR_BAD_PARAM);
+    p_server = p_reactor->p_server;
+
+    p_connect = reactor_connect_get(p_reactor, connect_fd);  /* 确保连接存在且属于该reactor */
+    PFM_ENSURE_RET(NULL != p_connect, ERR_BAD_PARAM);
+
+    while(!closed)
+    {
+        if(p_connect->read_len == p_connect->read_cap &&
+            ERR_NO_ERROR != connect_read_buffer_grow(p_connect))
+        {
+            closed = 1;
+            break;
+        }
+
+        bytes_read = read(connect_fd, p_connect->read_buf + p_connect->read_len, p_connect->read_cap - p_connect->read_len);
+        if(bytes_read > 0)
+        {
+            p_connect->read_len += bytes_read;
+            if(ERR_NO_ERROR != server_dispatch_frames(p_server, p_connect))
+            {
+                closed = 1;
+            }
+        }
+        else if(0 == bytes_read)       /* 客户端关闭连接 */
+        {
+            DBG_ALZ("client %d closed connection", connect_fd);
+            closed = 1;
+        }
+        else if(EINTR == errno)
+        {
+            continue;
+        }
+        else if(EAGAIN == errno || EWOULDBLOCK == errno)   /* 数据已读完 */
+        {
+            break;
+        }
+        else
+        {
+            DBG_ERR("read from client %d failed", connect_fd);
+            perror("read");
+            closed = 1;
+        }
+    }
+
+    if(closed)
+    {
+        server_connect_close(p_reactor, connect_fd);
+    }
+
+    return ERR_NO_ERROR;
+}
+/*
+    function    epoll后端初始化：创建epoll实例，注册监听socket与唤醒eventfd
+    in          p_reactor   指向reactor
+    out
+    ret         errCode
+*/
+static ERR_CODE epoll_backend_init(IN reactor_t *p_reactor)
+{
+    struct epoll_event ev = {};
+
+    /* 初始化epoll */
+    p_reactor->epoll_fd = epoll_create(10);
+    if(-1 == p_reactor->epoll_fd)
+    {
+        DBG_ERR("create epoll failed");
+        perror("epoll create");
+        return ERR_SERVER_INIT;
+    }
+    DBG("reactor %d create epoll fd %d", p_reactor->id, p_reactor->epoll_fd);
+
+    /* 将socket添加到epoll */
+    ev.events = EPOLLIN | EPOLLET;  /* 可读事件 */
+    ev.data.fd = p_reactor->socket_fd;  /* 监听socket的文件描述符 */
+    if(-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_reactor->socket_fd, &ev))
+    {
+        DBG_ERR("add socket to epoll failed");
+        perror("epoll ctl add");
+        goto err;
+    }
+    DBG("add socket %d to epoll fd %d", p_reactor->socket_fd, p_reactor->epoll_fd);
+
+    /* 将唤醒eventfd添加到epoll */
+    ev.events = EPOLLIN;
+    ev.data.fd = p_reactor->wake_fd;
+    if(-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_reactor->wake_fd, &ev))
+    {
+        DBG_ERR("add eventfd to epoll failed");
+        perror("epoll ctl add");
+        goto err;
+    }
+
+    return ERR_NO_ERROR;
+
+err:
+    close(p_reactor->epoll_fd);
+    p_reactor->epoll_fd = -1;
+    return ERR_SERVER_INIT;
+}
+
+/*
+    function    epoll后端销毁
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void epoll_backend_destroy(IN reactor_t *p_reactor)
+{
+    if(-1 != p_reactor->epoll_fd)
+    {
+        close(p_reactor->epoll_fd);
+        p_reactor->epoll_fd = -1;
+        DBG("close reactor %d epoll_fd", p_reactor->id);
+    }
+}
+
+/*
+    function    epoll后端注册新连接的可读事件
+    in          p_reactor   指向reactor
+                p_connect   指向连接
+    out
+    ret         errCode
+*/
+static ERR_CODE epoll_connect_add(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    struct epoll_event ev = {};
+
+    ev.events = EPOLLIN | EPOLLET;  /* 可读事件 */
+    ev.data.fd = p_connect->fd;  /* 新连接的文件描述符 */
+    if(-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_connect->fd, &ev))
+    {
+        DBG_ERR("add new connect fd %d to epoll failed", p_connect->fd);
+        perror("epoll ctl add");
+        return ERR_SERVER_NEW_CONNECT;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    epoll后端移除连接
+    in          p_reactor   指向reactor
+                p_connect   指向连接
+    out
+    ret
+*/
+static void epoll_connect_del(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_DEL, p_connect->fd, NULL);  /* 从epoll中删除 */
+}
+
+/*
+    function    epoll后端事件循环，处理自己的监听socket与连接，直到服务器退出
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void epoll_backend_run(IN reactor_t *p_reactor)
+{
+    server_t *p_server = p_reactor->p_server;
+    struct epoll_event events[SERVER_EPOLL_EVENT_SIZE] = {};
+    int events_num = 0;
+    uint64_t count = 0;
+    int i = 0;
+
+    while(!atomic_load(&p_server->shutdown))
+    {
+        /* 监听epoll事件 */
+        events_num = epoll_wait(p_reactor->epoll_fd, events, SERVER_EPOLL_EVENT_SIZE, -1);
+        for(i = 0; i < events_num; ++i)
+        {
+            if(events[i].data.fd == p_reactor->socket_fd)  /* 新连接 */
+            {
+                handler_new_connection(p_reactor);
+            }
+            else if(events[i].data.fd == p_reactor->wake_fd)  /* 唤醒事件，发送邮箱中的广播 */
+            {
+                (void)!read(p_reactor->wake_fd, &count, sizeof(count));
+                reactor_mailbox_drain(p_reactor);
+            }
+            else if(events[i].events & (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP))
+            {
+                if(events[i].events & EPOLLOUT)         /* 处理可写事件 */
+                {
+                    handler_write_event(p_reactor, events[i].data.fd);
+                }
+                if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))  /* 处理可读事件，错误也由读事件发现 */
+                {
+                    handler_read_event(p_reactor, events[i].data.fd);
+                }
+            }
+            else if(events[i].events & EPOLLRDHUP)  /* 处理连接关闭事件 */
+            {
+                DBG_ERR("client fd %d closed connection", events[i].data.fd);
+                server_connect_close(p_reactor, events[i].data.fd);
+            }
+            else
+            {
+                DBG_ERR("unknown epoll event %d for fd %d", events[i].events, events[i].data.fd);
+            }
+        }
+
+        /* 本轮事件产生的任务一次提交，本轮积压的发送每个连接一次发出 */
+        reactor_task_batch_flush(p_reactor);
+        reactor_send_flush(p_reactor);
+    }
+}
+
+/*
+    function    epoll后端发送连接积压的数据，未发完时注册EPOLLOUT
+    in          p_reactor   指向reactor
+                p_connect   指向连接，调用者持有out_mutex
+    out
+    ret
+*/
+static void epoll_connect_flush(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    if(ERR_NO_ERROR != connect_flush(p_connect))
+    {
+        p_connect->out_error = 1;
+        shutdown(p_connect->fd, SHUT_RDWR);
+        return;
+    }
+
+    if(0 < p_connect->out_count)
+    {
+        connect_arm_write(p_reactor->p_server, p_connect, 1);
+    }
+}
+
+/* epoll后端 */
+static const reactor_backend_t epoll_backend = {
+    .name = "epoll",
+    .init = epoll_backend_init,
+    .destroy = epoll_backend_destroy,
+    .run = epoll_backend_run,
+    .connect_add = epoll_connect_add,
+    .connect_del = epoll_connect_del,
+    .connect_flush = epoll_connect_flush,
+};
+
+/*
+    function    获取io_uring提交项，提交队列满时先提交已填写的提交项
+    in          p_reactor   指向reactor
+    out
+    ret         提交项指针，提交失败时返回NULL
+*/
+static struct io_uring_sqe *reactor_uring_sqe(IN reactor_t *p_reactor)
+{
+    struct io_uring_sqe *p_sqe = NULL;
+
+    p_sqe = uring_get_sqe(&(p_reactor->ring));
+    if(NULL == p_sqe && ERR_NO_ERROR == uring_submit_and_wait(&(p_reactor->ring), 0, -1))
+    {
+        p_sqe = uring_get_sqe(&(p_reactor->ring));
+    }
+    if(NULL == p_sqe)
+    {
+        DBG_ERR("reactor %d io_uring submission queue full", p_reactor->id);
+    }
+
+    return p_sqe;
+}
+
+/*
+    function    在监听socket上提交多发接受请求，一次提交持续产生新连接
+    in          p_reactor   指向reactor
+    out
+    ret         errCode
+*/
+static ERR_CODE uring_accept_arm(IN reactor_t *p_reactor)
+{
+    struct io_uring_sqe *p_sqe = reactor_uring_sqe(p_reactor);
+
+    PFM_ENSURE_RET(NULL != p_sqe, ERR_URING_INIT);
+
+    p_sqe->opcode = IORING_OP_ACCEPT;
+    p_sqe->fd = p_reactor->socket_fd;
+    p_sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    p_sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_ACCEPT, p_reactor->socket_fd);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    提交读取唤醒eventfd的请求
+    in          p_reactor   指向reactor
+    out
+    ret         errCode
+*/
+static ERR_CODE uring_wake_arm(IN reactor_t *p_reactor)
+{
+    struct io_uring_sqe *p_sqe = reactor_uring_sqe(p_reactor);
+
+    PFM_ENSURE_RET(NULL != p_sqe, ERR_URING_INIT);
+
+    p_sqe->opcode = IORING_OP_READ;
+    p_sqe->fd = p_reactor->wake_fd;
+    p_sqe->addr = (unsigned long long)(unsigned long)&(p_reactor->wake_value);
+    p_sqe->len = sizeof(p_reactor->wake_value);
+    p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_WAKE, p_reactor->wake_fd);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    在连接上提交多发接收请求，数据写入内核从缓冲区环中挑选的缓冲区，请求持有一个连接引用直到最后一个完成项
+    in          p_reactor   指向reactor
+                p_connect   指向连接
+    out
+    ret         errCode
+*/
+static ERR_CODE uring_recv_arm(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    struct io_uring_sqe *p_sqe = reactor_uring_sqe(p_reactor);
+
+    PFM_ENSURE_RET(NULL != p_sqe, ERR_URING_INIT);
+
+    p_sqe->opcode = IORING_OP_RECV;
+    p_sqe->fd = p_connect->fd;
+    p_sqe->ioprio = IORING_RECV_MULTISHOT;
+    p_sqe->flags = IOSQE_BUFFER_SELECT;
+    p_sqe->buf_group = p_reactor->buf_ring.bgid;
+    p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_RECV, p_connect->fd);
+    connect_hold(p_connect);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    io_uring后端初始化：创建io_uring实例与接收缓冲区环，提交监听socket的多发接受与eventfd读取
+    in          p_reactor   指向reactor
+    out
+    ret         errCode
+*/
+static ERR_CODE uring_backend_init(IN reactor_t *p_reactor)
+{
+    if(ERR_NO_ERROR != uring_init(&(p_reactor->ring), SERVER_URING_ENTRIES))
+    {
+        return ERR_URING_INIT;
+    }
+
+    if(ERR_NO_ERROR != uring_buf_ring_init(&(p_reactor->ring), &(p_reactor->buf_ring), 0, SERVER_URING_BUF_COUNT, SERVER_URING_BUF_SIZE) ||
+        ERR_NO_ERROR != uring_accept_arm(p_reactor) ||
+        ERR_NO_ERROR != uring_wake_arm(p_reactor) ||
+        ERR_NO_ERROR != uring_submit_and_wait(&(p_reactor->ring), 0, -1))
+    {
+        uring_destroy(&(p_reactor->ring));
+        uring_buf_ring_destroy(&(p_reactor->buf_ring));
+        return ERR_URING_INIT;
+    }
+
+    DBG("reactor %d io_uring fd %d", p_reactor->id, p_reactor->ring.ring_fd);
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    io_uring后端销毁，关闭io_uring时内核取消所有在途请求
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void uring_backend_destroy(IN reactor_t *p_reactor)
+{
+    uring_destroy(&(p_reactor->ring));
+    uring_buf_ring_destroy(&(p_reactor->buf_ring));
+}
+
+/*
+    function    io_uring后端开始接收新连接上的数据
+    in          p_reactor   指向reactor
+                p_connect   指向连接
+    out
+    ret         errCode
+*/
+static ERR_CODE uring_connect_add(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    return uring_recv_arm(p_reactor, p_connect);
+}
+
+/*
+    function    io_uring后端取消连接上的多发接收，取消后的最后一个完成项释放接收请求持有的引用
+    in          p_reactor   指向reactor
+                p_connect   指向连接
+    out
+    ret
+*/
+static void uring_connect_del(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    struct io_uring_sqe *p_sqe = reactor_uring_sqe(p_reactor);
+
+    if(NULL == p_sqe)
+    {
+        shutdown(p_connect->fd, SHUT_RDWR);    /* 无法提交取消请求时让接收以连接关闭结束 */
+        return;
+    }
+
+    p_sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    p_sqe->addr = REACTOR_URING_DATA(REACTOR_URING_RECV, p_connect->fd);
+    p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_CANCEL, p_connect->fd);
+}
+
+/*
+    function    io_uring后端为连接填写一个聚合发送请求，包含发送队列中的多个缓冲区，随下一次等待一并提交，每个连接同时只有一个发送在途以保证顺序；
+                队首数据在文件中时改为sendfile与可写通知
+    in          p_reactor   指向reactor
+                p_connect   指向连接，调用者持有out_mutex
+    out
+    ret
+*/
+static void uring_connect_flush(IN reactor_t *p_reactor, IN connect_t *p_connect)
+{
+    struct io_uring_sqe *p_sqe = NULL;
+    size_t bytes = 0;
+
+    /* 发送在途期间iovec与msghdr必须保持有效，放在连接中 */
+    if(NULL == p_connect->out_iov)
+    {
+        p_connect->out_iov = (struct iovec *)malloc(sizeof(struct iovec) * SERVER_OUT_IOV_MAX);
+    }
+    if(NULL == p_connect->out_iov)
+    {
+        goto err;
+    }
+
+    memset(&(p_connect->out_msg), 0, sizeof(p_connect->out_msg));
+    p_connect->out_msg.msg_iov = p_connect->out_iov;
+    p_connect->out_msg.msg_iovlen = connect_out_iov(p_connect, p_connect->out_iov, SERVER_OUT_IOV_MAX, &bytes);
+
+    /* 队首数据在文件中：io_uring没有对应的请求，直接非阻塞sendfile，socket缓冲区满时提交可写通知，可写后再次发送 */
+    if(0 == p_connect->out_msg.msg_iovlen)
+    {
+        if(ERR_NO_ERROR != connect_flush(p_connect))
+        {
+            goto err;
+        }
+        if(0 == p_connect->out_count)
+        {
+            return;
+        }
+
+        p_sqe = reactor_uring_sqe(p_reactor);
+        if(NULL == p_sqe)
+        {
+            goto err;
+        }
+        p_sqe->opcode = IORING_OP_POLL_ADD;
+        p_sqe->fd = p_connect->fd;
+        p_sqe->poll32_events = POLLOUT;
+        p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_POLL, p_connect->fd);
+        connect_hold(p_connect);  /* 可写通知持有连接引用 */
+        p_connect->out_armed = 1;
+        return;
+    }
+
+    p_sqe = reactor_uring_sqe(p_reactor);
+    if(NULL == p_sqe)
+    {
+        goto err;
+    }
+    p_sqe->opcode = IORING_OP_SENDMSG;
+    p_sqe->fd = p_connect->fd;
+    p_sqe->addr = (unsigned long long)(unsigned long)&(p_connect->out_msg);
+    p_sqe->len = 1;
+    p_sqe->msg_flags = MSG_NOSIGNAL;
+    p_sqe->user_data = REACTOR_URING_DATA(REACTOR_URING_SEND, p_connect->fd);
+    connect_hold(p_connect);  /* 发送请求持有连接引用，完成前发送队列不会被释放 */
+    p_connect->out_armed = 1;
+    return;
+
+err:
+    p_connect->out_error = 1;
+    shutdown(p_connect->fd, SHUT_RDWR);
+}
+
+/*
+    function    处理发送完成：推进发送队列，队列中仍有数据时再次登记为待发送，与期间新入队的帧一起发送
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+                res         发送的字节数或负的错误码
+    out
+    ret
+*/
+static void uring_handle_send(IN reactor_t *p_reactor, IN int connect_fd, IN int res)
+{
+    server_t *p_server = p_reactor->p_server;
+    connect_t *p_connect = &(p_server->connects[connect_fd]);
+
+    pthread_mutex_lock(&(p_connect->out_mutex));
+    p_connect->out_armed = 0;
+    if(res < 0)
+    {
+        DBG_ERR("send to connect fd %d failed, res %d", connect_fd, res);
+        p_connect->out_error = 1;
+        shutdown(connect_fd, SHUT_RDWR);
+    }
+    else
+    {
+        connect_out_advance(p_connect, res, 0);
+    }
+
+    if(!p_connect->out_error && !p_connect->out_pending && 0 < p_connect->out_count &&
+        CONNECT_STATE_OPEN == atomic_load_explicit(&p_connect->state, memory_order_acquire))
+    {
+        if(ERR_NO_ERROR == reactor_send_pending_add(p_reactor, connect_fd))
+        {
+            p_connect->out_pending = 1;
+        }
+        else
+        {
+            p_connect->out_error = 1;
+            shutdown(connect_fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&(p_connect->out_mutex));
+
+    connect_put(p_server, p_connect);  /* 释放发送请求持有的引用 */
+}
+
+/*
+    function    把接收到的数据追加到连接读缓冲区，不足时扩容
+    in          p_connect   指向连接
+                data        数据
+                len         数据长度
+    out
+    ret         errCode
+*/
+static ERR_CODE connect_read_append(IN connect_t *p_connect, IN const char *data, IN int len)
+{
+    while(p_connect->read_cap - p_connect->read_len < len)
+    {
+        if(ERR_NO_ERROR != connect_read_buffer_grow(p_connect))
+        {
+            return ERR_NO_MEMORY;
+        }
+    }
+
+    memcpy(p_connect->read_buf + p_connect->read_len, data, len);
+    p_connect->read_len += len;
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    处理接收完成：数据追加到读缓冲区后立即归还内核缓冲区，取出所有完整帧；多发接收结束时释放其引用，连接仍打开则重新提交
+    in          p_reactor   指向reactor
+                connect_fd  连接文件描述符
+                res         接收的字节数或负的错误码
+                flags       完成项标志
+    out
+    ret
+*/
+static void uring_handle_recv(IN reactor_t *p_reactor, IN int connect_fd, IN int res, IN unsigned flags)
+{
+    server_t *p_server = p_reactor->p_server;
+    connect_t *p_connect = &(p_server->connects[connect_fd]);
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    int open = 0;
+    int closed = 0;
+
+    /* 接收请求持有连接引用，槽位不会被复用，关闭后到达的完成项只归还缓冲区 */
+    open = (CONNECT_STATE_OPEN == atomic_load_explicit(&p_connect->state, memory_order_acquire));
+
+    if(flags & IORING_CQE_F_BUFFER)
+    {
+        if(open && res > 0 && ERR_NO_ERROR != connect_read_append(p_connect, uring_buf_ring_get(&(p_reactor->buf_ring), bid), res))
+        {
+            closed = 1;
+        }
+        uring_buf_ring_recycle(&(p_reactor->buf_ring), bid);
+    }
+
+    if(open)
+    {
+        if(0 == res)        /* 客户端关闭连接 */
+        {
+            DBG_ALZ("client %d closed connection", connect_fd);
+            closed = 1;
+        }
+        else if(res < 0 && -ENOBUFS != res)     /* 缓冲区耗尽只结束本次多发，重新提交即可 */
+        {
+            DBG_ERR("recv from client %d failed, res %d", connect_fd, res);
+            closed = 1;
+        }
+        else if(res > 0 && !closed && ERR_NO_ERROR != server_dispatch_frames(p_server, p_connect))
+        {
+            closed = 1;
+        }
+
+        if(!closed && !(flags & IORING_CQE_F_MORE) && ERR_NO_ERROR != uring_recv_arm(p_reactor, p_connect))
+        {
+            closed = 1;
+        }
+
+        if(closed)
+        {
+            server_connect_close(p_reactor, connect_fd);
+        }
+    }
+
+    if(!(flags & IORING_CQE_F_MORE))
+    {
+        connect_put(p_server, p_connect);  /* 释放接收请求持有的引用 */
+    }
+}
+
+/*
+    function    处理多发接受的完成项：登记新连接，多发结束时重新提交
+    in          p_reactor   指向reactor
+                res         新连接描述符或负的错误码
+                flags       完成项标志
+    out
+    ret
+*/
+static void uring_handle_accept(IN reactor_t *p_reactor, IN int res, IN unsigned flags)
+{
+    if(res >= 0)
+    {
+        DBG("reactor %d accepted new connection fd %d", p_reactor->id, res);
+        if(ERR_NO_ERROR != reactor_connect_register(p_reactor, res))
+        {
+            DBG_ERR("handle new connection fd %d failed", res);
+        }
+    }
+    else if(-EMFILE == res || -ENFILE == res)
+    {
+        reactor_accept_reject(p_reactor);
+    }
+    else
+    {
+        DBG_ERR("reactor %d accept failed, res %d", p_reactor->id, res);
+        if(-EINVAL == res)
+        {
+            return;     /* 内核不支持多发接受，不再重试 */
+        }
+    }
+
+    if(!(flags & IORING_CQE_F_MORE) && !atomic_load(&(p_reactor->p_server->shutdown)))
+    {
+        uring_accept_arm(p_reactor);
+    }
+}
+
+/*
+    function    io_uring后端事件循环：一次系统调用提交上一轮的全部请求并等待完成项，直到服务器退出
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void uring_backend_run(IN reactor_t *p_reactor)
+{
+    server_t *p_server = p_reactor->p_server;
+    struct io_uring_cqe *p_cqe = NULL;
+    unsigned long long user_data = 0;
+    unsigned flags = 0;
+    int woken = 0;
+    int res = 0;
+
+    while(!atomic_load(&p_server->shutdown))
+    {
+        if(ERR_NO_ERROR != uring_submit_and_wait(&(p_reactor->ring), 1, -1))
+        {
+            break;
+        }
+
+        woken = 0;
+        while(NULL != (p_cqe = uring_peek_cqe(&(p_reactor->ring))))
+        {
+            user_data = p_cqe->user_data;
+            res = p_cqe->res;
+            flags = p_cqe->flags;
+            uring_cqe_seen(&(p_reactor->ring));
+
+            switch(REACTOR_URING_TYPE(user_data))
+            {
+                case REACTOR_URING_ACCEPT:  /* 新连接 */
+                {
+                    uring_handle_accept(p_reactor, res, flags);
+                    break;
+                }
+                case REACTOR_URING_WAKE:    /* 唤醒事件，本轮完成项处理完后发送邮箱中的广播 */
+                {
+                    woken = 1;
+                    uring_wake_arm(p_reactor);
+                    break;
+                }
+                case REACTOR_URING_RECV:
+                {
+                    uring_handle_recv(p_reactor, REACTOR_URING_FD(user_data), res, flags);
+                    break;
+                }
+                case REACTOR_URING_SEND:
+                {
+                    uring_handle_send(p_reactor, REACTOR_URING_FD(user_data), res);
+                    break;
+                }
+                case REACTOR_URING_POLL:    /* 可写通知按发送了0字节处理，由发送完成的逻辑继续发送 */
+                {
+                    uring_handle_send(p_reactor, REACTOR_URING_FD(user_data), res < 0 ? res : 0);
+                    break;
+                }
+                default:    /* 取消请求的完成项 */
+                {
+                    break;
+                }
+            }
+        }
+
+        if(woken)
+        {
+            reactor_mailbox_drain(p_reactor);
+        }
+
+        /* 本轮产生的任务一次提交，发送请求随下一次等待一次提交 */
+        reactor_task_batch_flush(p_reactor);
+        reactor_send_flush(p_reactor);
+    }
+}
+
+/* io_uring后端 */
+static const reactor_backend_t uring_backend = {
+    .name = "io_uring",
+    .init = uring_backend_init,
+    .destroy = uring_backend_destroy,
+    .run = uring_backend_run,
+    .connect_add = uring_connect_add,
+    .connect_del = uring_connect_del,
+    .connect_flush = uring_connect_flush,
+};
+
+/*
+    function    reactor初始化：创建监听socket、唤醒eventfd与I/O后端实例，多个reactor时通过SO_REUSEPORT绑定同一端口，由内核分发新连接
+    in          p_server    指向服务器对象
+                p_reactor   指向reactor
+                id          reactor编号
+    out
+    ret         errCode
+*/
+static ERR_CODE reactor_init(IN server_t *p_server, IN OUT reactor_t *p_reactor, IN int id)
+{
+    struct sockaddr_in server_addr = {};
+    int opt = 1;
+
+    p_reactor->p_server = p_server;
+    p_reactor->id = id;
+    p_reactor->socket_fd = -1;
+    p_reactor->epoll_fd = -1;
+    p_reactor->wake_fd = -1;
+    p_reactor->spare_fd = -1;
+
+    /* 创建socket */
+    p_reactor->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(-1 == p_reactor->socket_fd)
+    {
+        DBG_ERR("create socket failed");
+        perror("socket create");
+        goto err;
+    }
+    DBG("reactor %d create socket %d", id, p_reactor->socket_fd);
+
+    /* 设置socket选项，允许地址重用 */
+    setsockopt(p_reactor->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    DBG("set socket %d option SO_REUSEADDR", p_reactor->socket_fd);
+
+    /* 多个reactor各自监听同一端口，内核按连接哈希分发 */
+    if(1 < p_server->reactor_count &&
+        -1 == setsockopt(p_reactor->socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
+    {
+        DBG_ERR("set socket option SO_REUSEPORT failed");
+        perror("setsockopt SO_REUSEPORT");
+        goto err;
+    }
+
+    /* 设置socket为非阻塞 */
+    if(-1 == fcntl(p_reactor->socket_fd, F_SETFL, O_NONBLOCK))
+    {
+        DBG_ERR("set socket to non-blocking failed");
+        perror("fcntl set non-blocking");
+        goto err;
+    }
+    DBG("set socket %d to non-blocking", p_reactor->socket_fd);
+
+    /* 绑定socket */
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);        /* 绑定所有接口上 */
+    server_addr.sin_port = htons(SERVER_PORT);
+    if(0 != bind(p_reactor->socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+    {
+        DBG_ERR("bind socket failed");
+        perror("socket bind");
+        goto err;
+    }
+    DBG("reactor %d bind socket %d to %d", id, p_reactor->socket_fd, SERVER_PORT);
+
+    /* 监听socket */
+    if(0 != listen(p_reactor->socket_fd, p_server->listen_backlog))
+    {
+        DBG_ERR("listen socket failed");
+        perror("socket listen");
+        goto err;
+    }
+    DBG("reactor %d listen socket %d, backlog %d", id, p_reactor->socket_fd, p_server->listen_backlog);
+
+    /* 预留备用描述符，打开失败不影响运行，只是描述符耗尽时无法拒绝排队的连接 */
+    p_reactor->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if(-1 == p_reactor->spare_fd)
+    {
+        DBG_ERR("open spare fd failed");
+        perror("open /dev/null");
+    }
+
+    /* 创建唤醒eventfd */
+    p_reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(-1 == p_reactor->wake_fd)
+    {
+        DBG_ERR("create eventfd failed");
+        perror("eventfd");
+        goto err;
+    }
+
+    /* 初始化I/O后端，io_uring不可用时退回epoll */
+    p_reactor->p_backend = (SERVER_BACKEND_URING == p_server->backend) ? &uring_backend : &epoll_backend;
+    if(ERR_NO_ERROR != p_reactor->p_backend->init(p_reactor))
+    {
+        if(&epoll_backend == p_reactor->p_backend)
+        {
+            goto err;
+        }
+        DBG_ERR("reactor %d io_uring unavailable, fall back to epoll", id);
+        p_reactor->p_backend = &epoll_backend;
+        if(ERR_NO_ERROR != p_reactor->p_backend->init(p_reactor))
+        {
+            goto err;
+        }
+    }
+    DBG_ALZ("reactor %d uses %s backend", id, p_reactor->p_backend->name);
+
+    return ERR_NO_ERROR;
+
+err:
+    if(-1 != p_reactor->socket_fd)      close(p_reactor->socket_fd);
+    if(-1 != p_reactor->wake_fd)        close(p_reactor->wake_fd);
+    if(-1 != p_reactor->spare_fd)       close(p_reactor->spare_fd);
+    p_reactor->socket_fd = -1;
+    p_reactor->wake_fd = -1;
+    p_reactor->spare_fd = -1;
+    p_reactor->p_backend = NULL;
+
+    return ERR_SERVER_INIT;
+}
+
+/*
+    function    reactor销毁，关闭监听socket、I/O后端与eventfd，丢弃邮箱中未处理的邮件
+    in          p_reactor   指向reactor
+    out
+    ret
+*/
+static void reactor_destroy(IN reactor_t *p_reactor)
+{
+    reactor_mail_t *p_mail = NULL;
+
+    if(-1 != p_reactor->socket_fd)
+    {
+        close(p_reactor->socket_fd);
+        p_reactor->socket_fd = -1;
+        DBG("close reactor %d socket_fd", p_reactor->id);
+    }
+
+    if(NULL != p_reactor->p_backend)
+    {
+        p_reactor->p_backend->destroy(p_reactor);
+        p_reactor->p_backend = NULL;
+    }
+
+    if(-1 != p_reactor->wake_fd)
+    {
+        close(p_reactor->wake_fd);
+        p_reactor->wake_fd = -1;
+    }
+
+    if(-1 != p_reactor->spare_fd)
+    {
+        close(p_reactor->spare_fd);
+        p_reactor->spare_fd = -1;
+    }
+
+    while(NULL != (p_mail = (reactor_mail_t *)mpsc_queue_pop(&(p_reactor->mailbox))))
+    {
+        /* 连接表已先于reactor销毁，目标连接已随之释放，不再访问 */
+        if(NULL != p_mail->p_room)
+        {
+            room_put(p_mail->p_room);
+        }
+        msg_buf_unref(p_mail->p_buf);
+        obj_pool_free(&(p_reactor->p_server->mail_pool), p_mail);
+    }
+
+    free(p_reactor->connect_fds);
+    p_reactor->connect_fds = NULL;
+    p_reactor->connect_count = 0;
+    p_reactor->connect_cap = 0;
+
+    free(p_reactor->task_batch);
+    p_reactor->task_batch = NULL;
+    p_reactor->task_batch_count = 0;
+    p_reactor->task_batch_cap = 0;
+
+    free(p_reactor->send_fds);
+    p_reactor->send_fds = NULL;
+    p_reactor->send_count = 0;
+    p_reactor->send_cap = 0;
+}
+
+/*
+    function    reactor线程入口，运行I/O后端的事件循环直到服务器退出
+    in          arg     指向reactor
+    out
+    ret         NULL
+*/
+static void *reactor_run(void *arg)
+{
+    reactor_t *p_reactor = (reactor_t *)arg;
+
+    DBG("reactor %d running", p_reactor->id);
+    p_reactor->p_backend->run(p_reactor);
+    DBG("reactor %d exit", p_reactor->id);
+
+    return NULL;
+}
+
+/*
+    function    服务器对象初始化
+    in          p_server        指向服务器对象
+                p_config        服务器配置
+    out
+    ret         errCode
+*/
+ERR_CODE server_init(IN OUT server_t *p_server, IN const server_config_t *p_config)
+{
+    int thread_pool_flag = 0;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_server && NULL != p_config, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 < p_config->thread_pool_size && 0 < p_config->task_queue_size, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 < p_config->reactor_count && SERVER_REACTOR_MAX >= p_config->reactor_count, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 < p_config->listen_backlog, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 <= p_config->history_count && 0 <= p_config->history_bytes, ERR_BAD_PARAM);
+
+    atomic_init(&p_server->shutdown, 0);
+    atomic_init(&p_server->history_recovered, 0);
+    p_server->listen_backlog = p_config->listen_backlog;
+    p_server->backend = p_config->backend;
+    p_server->history_count = p_config->history_count;
+    p_server->compress = p_config->compress;
+    p_server->upload_max = p_config->upload_max;
+    p_server->upload_concurrency = p_config->upload_concurrency;
+    atomic_init(&(p_server->upload_count), 0);
+    p_server->out_file_limit = SERVER_OUT_FILE_FACTOR * p_config->upload_max;
+    p_server->history_bytes = p_config->history_bytes;
+    history_init(&(p_server->history), p_config->history_count, p_config->history_bytes);
+
+    /* 初始化对象池，任务参数与邮件在热路径上反复申请释放，不经过malloc */
+    PFM_ENSURE_RET(ERR_NO_ERROR == obj_pool_init(&(p_server->s_c_pool), "server_connect", sizeof(server_connect_t), SERVER_POOL_SLAB_OBJS), ERR_SERVER_INIT);
+    PFM_ENSURE_RET(ERR_NO_ERROR == obj_pool_init(&(p_server->mail_pool), "reactor_mail", sizeof(reactor_mail_t), SERVER_POOL_SLAB_OBJS), ERR_SERVER_INIT);
+
+    /* 初始化服务器线程池 */
+    PFM_ENSURE_RET(ERR_NO_ERROR == thread_pool_init_mode(&(p_server->thread_pool), p_config->thread_pool_size, p_config->task_queue_size, p_config->thread_pool_mode), ERR_SERVER_INIT);
+    thread_pool_flag = 1;
+    DBG("server init thread pool with %d threads, %d tasks", p_config->thread_pool_size, p_config->task_queue_size);
+
+    /* 初始化互斥锁 */
+    pthread_mutex_init(&(p_server->mutex), NULL);
+    DBG("initialize server mutex");
+
+    /* 启用持久化时映射已有的日志段并启动日志写线程，历史在首次使用时才从映射的页面中恢复，启动时间与日志大小无关 */
+    if(NULL != p_config->log_dir)
+    {
+        if(ERR_NO_ERROR != msg_log_init(&(p_server->log), p_config->log_dir, SERVER_LOG_SEGMENT_BYTES, SERVER_LOG_BUFFER_SIZE, p_config->log_commit_ms))
+        {
+            goto err;
+        }
+        p_server->log_enabled = 1;
+    }
+
+    /* 初始化房间注册表与连接表，reactor创建前完成，连接事件到达时即可使用 */
+    if(ERR_NO_ERROR != room_table_init(p_server) || ERR_NO_ERROR != user_index_init(p_server) ||
+        ERR_NO_ERROR != connect_table_init(p_server))
+    {
+        goto err;
+    }
 
-    /* 初始化其他参数 */
-    p_server->connect_head.fd = -1;
-    p_server->connect_head.next = NULL;
-    p_server->connect_count = 0;
+    /* 初始化reactor */
+    p_server->reactors = (reactor_t *)calloc(p_config->reactor_count, sizeof(reactor_t));
+    if(NULL == p_server->reactors)
+    {
+        DBG_ERR("calloc for reactors");
+        goto err;
+    }
+    p_server->reactor_count = p_config->reactor_count;
+    for(i = 0; i < p_server->reactor_count; ++i)
+    {
+        p_server->reactors[i].socket_fd = -1;
+        p_server->reactors[i].epoll_fd = -1;
+        p_server->reactors[i].wake_fd = -1;
+        p_server->reactors[i].spare_fd = -1;
+        mpsc_queue_init(&(p_server->reactors[i].mailbox));
+        atomic_init(&(p_server->reactors[i].mail_signaled), 0);
+    }
+    for(i = 0; i < p_server->reactor_count; ++i)
+    {
+        if(ERR_NO_ERROR != reactor_init(p_server, &(p_server->reactors[i]), i))
+        {
+            goto err;
+        }
+    }
 
-    DBG_ALZ("server init done");
+    DBG_ALZ("server init done, %d reactors", p_server->reactor_count);
     return ERR_NO_ERROR;
 
 err:
     DBG_ERR("server init failed, cleaning up resources");
 
     if(thread_pool_flag)    thread_pool_destroy(&(p_server->thread_pool));
-    if(-1 != p_server->socket_fd)       close(p_server->socket_fd);
-    if(-1 != p_server->epoll_fd)         close(p_server->epoll_fd);
+    for(i = 0; NULL != p_server->reactors && i < p_server->reactor_count; ++i)
+    {
+        reactor_destroy(&(p_server->reactors[i]));
+    }
+    connect_table_destroy(p_server);
+    room_table_destroy(p_server);
+    user_index_destroy(p_server);
+    history_destroy(&(p_server->history));
+    if(p_server->log_enabled)   msg_log_destroy(&(p_server->log));
+    free(p_server->reactors);
+    obj_pool_destroy(&(p_server->s_c_pool));
+    obj_pool_destroy(&(p_server->mail_pool));
     pthread_mutex_destroy(&(p_server->mutex));
     memset(p_server, 0, sizeof(server_t));
 
@@ -510,15 +3742,72 @@ err:
 }
 
 /*
-    function    服务器对象销毁
+    function    运行服务器，1~N-1号reactor在新线程中运行，0号reactor在调用线程中运行，收到退出信号后返回
+    in          p_server        指向服务器对象
+    out
+    ret         errCode
+*/
+ERR_CODE server_run(IN server_t *p_server)
+{
+    uint64_t one = 1;
+    int started = 1;
+    int i = 0;
+
+    PFM_ENSURE_RET(NULL != p_server && NULL != p_server->reactors, ERR_BAD_PARAM);
+
+    for(i = 1; i < p_server->reactor_count; ++i)
+    {
+        if(0 != pthread_create(&(p_server->reactors[i].thread), NULL, reactor_run, &(p_server->reactors[i])))
+        {
+            DBG_ERR("create reactor %d thread failed", i);
+            atomic_store(&p_server->shutdown, 1);
+            break;
+        }
+        started++;
+    }
+
+    if(!atomic_load(&p_server->shutdown))
+    {
+        p_server->reactors[0].thread = pthread_self();
+        reactor_run(&(p_server->reactors[0]));
+    }
+
+    /* 唤醒并等待其他reactor退出 */
+    atomic_store(&p_server->shutdown, 1);
+    for(i = 1; i < started; ++i)
+    {
+        (void)!write(p_server->reactors[i].wake_fd, &one, sizeof(one));
+        pthread_join(p_server->reactors[i].thread, NULL);
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    输出对象池统计
+    in          p_pool          对象池指针
+    out
+    ret
+*/
+static void server_pool_stats_log(IN obj_pool_t *p_pool)
+{
+    obj_pool_stats_t stats = {};
+
+    obj_pool_stats(p_pool, &stats);
+    DBG_ALZ("pool %s: %ld slabs, %ld objs, %ld allocs, %ld frees, %ld in depot, %ld transfers",
+            p_pool->name, stats.slab_count, stats.obj_total, stats.alloc_count, stats.free_count,
+            stats.depot_objs, stats.transfer_count);
+}
+
+/*
+    function    服务器对象销毁，在所有reactor退出后调用
     in          p_server                        指向服务器对象
     out
     ret         errCode
 */
 ERR_CODE server_destory(IN server_t *p_server)
 {
-    connect_t *ptr = NULL;
-    connect_t *ptr_next = NULL;
+    int i = 0;
 
     PFM_ENSURE_RET(NULL != p_server, ERR_BAD_PARAM);
 
@@ -526,39 +3815,36 @@ ERR_CODE server_destory(IN server_t *p_server)
     thread_pool_destroy(&(p_server->thread_pool));
     DBG("destory thread_pool");
 
-    /* 释放连接内存，关闭连接 */
-    if(0 != p_server->connect_count)
+    /* 工作线程已全部退出，不再有新记录，写线程把剩余记录落盘后退出 */
+    if(p_server->log_enabled)
     {
-        ptr = p_server->connect_head.next;
-        while(ptr)
-        {
-            ptr_next = ptr->next;
-            close(ptr->fd);
-            DBG("close connect fd %d", ptr->fd);
-            free(ptr);
-            ptr = ptr_next;
-        }
+        msg_log_destroy(&(p_server->log));
     }
-    p_server->connect_count = 0;
-    p_server->connect_head.fd = -1;
-    p_server->connect_head.next = NULL;
 
-    /* 关闭socket描述符 */
-    if(-1 != p_server->socket_fd)
-    {
-        close(p_server->socket_fd);
-        p_server->socket_fd = -1;
-        DBG("close socket_fd");
-    }
+    /* 释放连接内存，关闭连接 */
+    connect_table_destroy(p_server);
 
-    /* 关闭epoll描述符 */
-    if(-1 != p_server->epoll_fd)
+    /* 关闭reactor的socket、epoll与eventfd描述符 */
+    for(i = 0; NULL != p_server->reactors && i < p_server->reactor_count; ++i)
     {
-        close(p_server->epoll_fd);
-        p_server->epoll_fd = -1;
-        DBG("close epoll_fd");
+        reactor_destroy(&(p_server->reactors[i]));
     }
 
+    /* 连接释放时已离开所有房间并删除用户名，邮件持有的房间引用也已随邮箱释放 */
+    room_table_destroy(p_server);
+    user_index_destroy(p_server);
+    history_destroy(&(p_server->history));
+
+    free(p_server->reactors);
+    p_server->reactors = NULL;
+    p_server->reactor_count = 0;
+
+    /* 输出对象池统计后销毁，未执行的任务参数随slab一并释放 */
+    server_pool_stats_log(&(p_server->s_c_pool));
+    server_pool_stats_log(&(p_server->mail_pool));
+    obj_pool_destroy(&(p_server->s_c_pool));
+    obj_pool_destroy(&(p_server->mail_pool));
+
     /* 销毁互斥锁 */
     pthread_mutex_destroy(&(p_server->mutex));
 
@@ -572,14 +3858,130 @@ ERR_CODE server_destory(IN server_t *p_server)
     Main
 */
 
-int main()
+int main(int argc, char *argv[])
 {
     struct sigaction sa = {};
-    struct epoll_event events[SERVER_EPOLL_EVENT_SIZE] = {};
-    int events_num = 0;
-    int i = 0;
+    server_config_t config = {
+        .thread_pool_size = SERVER_THREAD_POOL_SIZE,
+        .task_queue_size = SERVER_THREAD_TASK_QUEUE_SIZE,
+        .thread_pool_mode = THREAD_POOL_MODE_SHARED,
+        .reactor_count = SERVER_REACTOR_COUNT,
+        .listen_backlog = SERVER_LISTEN_BACKLOG,
+        .backend = SERVER_BACKEND_EPOLL,
+        .history_count = SERVER_HISTORY_COUNT,
+        .history_bytes = SERVER_HISTORY_BYTES,
+        .log_dir = NULL,
+        .log_commit_ms = SERVER_LOG_COMMIT_MS,
+        .upload_max = SERVER_UPLOAD_MAX,
+        .upload_concurrency = SERVER_UPLOAD_CONCURRENCY,
+        .compress = 1,
+    };
+    int opt = 0;
+
+    /* -r N：reactor数量，0表示按在线CPU核数；-w：线程池使用工作窃取调度；-b N：监听队列长度；-u：使用io_uring后端；
+       -H N：每份消息历史保留的消息数，0表示不保留；-M N：每份消息历史的缓冲区字节数；
+       -L dir：把聊天消息持久化到该目录下的分段日志；-C N：日志提交周期，毫秒；-z：不与客户端协商压缩帧；
+       -F N：单个流式帧的字节数上限；-U N：同时暂存中的流式帧数量上限，0表示不接收流式帧 */
+    while(-1 != (opt = getopt(argc, argv, "r:wb:uH:M:L:C:zF:U:")))
+    {
+        switch(opt)
+        {
+            case 'r':
+            {
+                config.reactor_count = atoi(optarg);
+                if(0 == config.reactor_count)
+                {
+                    config.reactor_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                if(SERVER_REACTOR_MAX < config.reactor_count)
+                {
+                    config.reactor_count = SERVER_REACTOR_MAX;
+                }
+                break;
+            }
+            case 'w':
+            {
+                config.thread_pool_mode = THREAD_POOL_MODE_STEALING;
+                break;
+            }
+            case 'u':
+            {
+                config.backend = SERVER_BACKEND_URING;
+                break;
+            }
+            case 'b':
+            {
+                config.listen_backlog = atoi(optarg);
+                if(0 >= config.listen_backlog)
+                {
+                    config.listen_backlog = SERVER_LISTEN_BACKLOG;
+                }
+                break;
+            }
+            case 'H':
+            {
+                config.history_count = atoi(optarg);
+                if(0 > config.history_count)
+                {
+                    config.history_count = 0;
+                }
+                break;
+            }
+            case 'M':
+            {
+                config.history_bytes = atoi(optarg);
+                if(0 >= config.history_bytes)
+                {
+                    config.history_bytes = SERVER_HISTORY_BYTES;
+                }
+                break;
+            }
+            case 'L':
+            {
+                config.log_dir = optarg;
+                break;
+            }
+            case 'C':
+            {
+                config.log_commit_ms = atoi(optarg);
+                if(0 > config.log_commit_ms)
+                {
+                    config.log_commit_ms = 0;
+                }
+                break;
+            }
+            case 'z':
+            {
+                config.compress = 0;
+                break;
+            }
+            case 'F':
+            {
+                config.upload_max = atoi(optarg);
+                if(0 >= config.upload_max || MSG_FRAME_STREAM_MAX < config.upload_max)
+                {
+                    config.upload_max = SERVER_UPLOAD_MAX;
+                }
+                break;
+            }
+            case 'U':
+            {
+                config.upload_concurrency = atoi(optarg);
+                if(0 > config.upload_concurrency)
+                {
+                    config.upload_concurrency = 0;
+                }
+                break;
+            }
+            default:
+            {
+                fprintf(stderr, "usage: %s [-r reactor_count] [-w] [-b listen_backlog] [-u] [-H history_count] [-M history_bytes] [-L log_dir] [-C commit_ms] [-z] [-F upload_max] [-U uploads]\n", argv[0]);
+                return ERR_BAD_PARAM;
+            }
+        }
+    }
 
-    PFM_ENSURE_RET(ERR_NO_ERROR == server_init(&server, SERVER_THREAD_POOL_SIZE, SERVER_THREAD_TASK_QUEUE_SIZE), ERR_SERVER_INIT);
+    PFM_ENSURE_RET(ERR_NO_ERROR == server_init(&server, &config), ERR_SERVER_INIT);
 
     sa.sa_handler = signal_handler;
     sigemptyset(&sa.sa_mask);    // 清空信号掩码
@@ -590,38 +3992,20 @@ int main()
         perror("sigaction");
         DBG_ERR("sigaction failed");
         server_destory(&server);
+        return ERR_SERVER_INIT;
     }
 
-    while(1)
-    {
-        /* 监听epoll事件 */
-        events_num = epoll_wait(server.epoll_fd, events, SERVER_EPOLL_EVENT_SIZE, -1);
-        for(i = 0; i < events_num; ++i)
-        {
-            if(events[i].data.fd == server.socket_fd)  /* 新连接 */
-            {
-                handler_new_connection(&server, events[i].data.fd);
-            }
-            else if(events[i].events & EPOLLIN)         /* 处理可读事件 */
-            {
-                handler_read_event(&server, events[i].data.fd);
-            }
-            else if(events[i].events & EPOLLRDHUP)  /* 处理连接关闭事件 */
-            {
-                DBG_ERR("client fd %d closed connection", events[i].data.fd);
-                pthread_mutex_lock(&(server.mutex));  /* 锁定服务器互斥锁 */
-                connect_list_del((void *)&(server_connect_t){.p_server = &server, .connect_fd = events[i].data.fd});
-                pthread_mutex_unlock(&(server.mutex));  /* 解锁服务器互斥锁 */
-                close(events[i].data.fd);  /* 关闭连接 */
-                epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, events[i].data.fd, NULL);  /* 从epoll中删除 */
-            }
-            else
-            {
-                DBG_ERR("unknown epoll event %d for fd %d", events[i].events, events[i].data.fd);
-            }
-        }
+    // sendfile没有MSG_NOSIGNAL，向已关闭的连接发送暂存文件时忽略SIGPIPE，由返回的EPIPE处理
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction");
+        DBG_ERR("sigaction failed");
+        server_destory(&server);
+        return ERR_SERVER_INIT;
     }
 
+    server_run(&server);
+
     PFM_ENSURE_RET(ERR_NO_ERROR == server_destory(&server), ERR_SERVER_INIT);
 
     return 0;
@@ -5,57 +5,367 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sched.h>
 
 #include "thread_pool.h"
 #include "debug_log.h"
 
+/*
+    Variables
+*/
+
+/* 窃取模式下当前线程所属的线程池与编号，池外线程为NULL */
+static __thread thread_pool_t *tls_pool = NULL;
+static __thread int tls_worker = -1;
+
 /*
     Function definitions
 */
 
-static void *thread_worker(void *p_pool)
+/*
+    function    从任务队列中取出一个任务，无锁
+    in          pool                线程池指针
+    out         p_task              取出的任务
+    ret         1 取出成功，0 队列为空
+*/
+static int task_queue_pop(thread_pool_t *pool, task_t *p_task)
 {
-    task_t *p_task = NULL;
-    thread_pool_t *pool = NULL;
+    unsigned long mask = pool->task_queue_size - 1;
+    unsigned long pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+    task_slot_t *p_slot = NULL;
+    long diff = 0;
 
-    PFM_ENSURE_RET(NULL != p_pool, NULL);
-    pool = (thread_pool_t *)p_pool;
+    while(1)
+    {
+        p_slot = &pool->task_queue[pos & mask];
+        diff = (long)atomic_load_explicit(&p_slot->seq, memory_order_acquire) - (long)(pos + 1);
+        if(0 == diff)
+        {
+            /* 槽中已有任务，竞争出队下标 */
+            if(atomic_compare_exchange_weak_explicit(&pool->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            return 0;   /* 队列为空 */
+        }
+        else
+        {
+            pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *p_task = p_slot->task;
+
+    /* 槽序号推进一圈，供下一轮入队使用 */
+    atomic_store_explicit(&p_slot->seq, pos + mask + 1, memory_order_release);
+
+    return 1;
+}
+
+/*
+    function    向任务队列中批量放入任务，一次CAS占用连续槽位，无锁，不等待消费者
+    in          pool                线程池指针
+                p_tasks             任务数组
+                count               任务数量
+    out
+    ret         放入的任务数，为p_tasks的前缀；只占用已确认空闲的连续槽位，遇到消费者尚未释放的槽即止，
+                队列已满时返回0
+*/
+static int task_queue_push_batch(thread_pool_t *pool, const task_t *p_tasks, int count)
+{
+    unsigned long mask = pool->task_queue_size - 1;
+    unsigned long pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+    task_slot_t *p_slot = NULL;
+    long diff = 0;
+    int n = 0;
+    int i = 0;
 
-    while(1)    /* 循环处理任务 */
+    while(1)
     {
-        pthread_mutex_lock(pool->mutex);  /* 锁定线程池 */
+        p_slot = &pool->task_queue[pos & mask];
+        diff = (long)atomic_load_explicit(&p_slot->seq, memory_order_acquire) - (long)pos;
+        if(diff < 0)
+        {
+            return 0;   /* 队列已满，槽中任务尚未被取走 */
+        }
+        if(diff > 0)
+        {
+            pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+            continue;
+        }
 
-        while(pool->task_queue->next == NULL && !pool->shutdown)
+        /* 首个槽空闲，逐个确认其后的槽也已空闲，只占用确认过的前缀；被领取但消费者尚未复制完的槽留到下一批，
+           reactor不在此等待被抢占的工作线程。序号等于pos + i的槽只有占用它的生产者会修改，CAS成功前不会变化 */
+        n = 1;
+        while(n < count && n <= (int)mask &&
+              atomic_load_explicit(&pool->task_queue[(pos + n) & mask].seq, memory_order_acquire) == pos + n)
         {
-            /* 等待任务条件变量 */
-            pthread_cond_wait(pool->cond, pool->mutex);
+            n++;
         }
 
-        /* 线程池销毁标志1 */
-        if(pool->shutdown)
+        /* 竞争入队下标，一次占用n个槽 */
+        if(atomic_compare_exchange_weak_explicit(&pool->enqueue_pos, &pos, pos + n, memory_order_relaxed, memory_order_relaxed))
         {
-            DBG("Thread %ld exit for destroy thread pool", pthread_self());
-            pthread_mutex_unlock(pool->mutex);
             break;
         }
+    }
+
+    for(i = 0; i < n; ++i)
+    {
+        p_slot = &pool->task_queue[(pos + i) & mask];
+        p_slot->task = p_tasks[i];
+        atomic_store_explicit(&p_slot->seq, pos + i + 1, memory_order_release);
+    }
+
+    return n;
+}
+
+/*
+    function    所属线程向双端队列bottom端压入任务
+    in          p_deque             双端队列指针
+                p_task              任务
+    out
+    ret         1 压入成功，0 队列已满
+*/
+static int task_deque_push(task_deque_t *p_deque, const task_t *p_task)
+{
+    long b = atomic_load_explicit(&p_deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&p_deque->top, memory_order_acquire);
+
+    if(b - t > p_deque->mask)
+    {
+        return 0;
+    }
+
+    __atomic_store_n(&p_deque->tasks[b & p_deque->mask].task_func, p_task->task_func, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_deque->tasks[b & p_deque->mask].arg, p_task->arg, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&p_deque->bottom, b + 1, memory_order_relaxed);
+
+    return 1;
+}
+
+/*
+    function    所属线程从双端队列bottom端弹出任务，后进先出，缓存更热
+    in          p_deque             双端队列指针
+    out         p_task              弹出的任务
+    ret         1 弹出成功，0 队列为空
+*/
+static int task_deque_take(task_deque_t *p_deque, task_t *p_task)
+{
+    long b = atomic_load_explicit(&p_deque->bottom, memory_order_relaxed) - 1;
+    long t = 0;
+    int ret = 1;
+
+    atomic_store_explicit(&p_deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&p_deque->top, memory_order_relaxed);
+
+    if(t > b)
+    {
+        /* 队列为空，恢复bottom */
+        atomic_store_explicit(&p_deque->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    p_task->task_func = __atomic_load_n(&p_deque->tasks[b & p_deque->mask].task_func, __ATOMIC_RELAXED);
+    p_task->arg = __atomic_load_n(&p_deque->tasks[b & p_deque->mask].arg, __ATOMIC_RELAXED);
+    if(t == b)
+    {
+        /* 最后一个任务，与窃取者竞争 */
+        if(!atomic_compare_exchange_strong_explicit(&p_deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            ret = 0;
+        }
+        atomic_store_explicit(&p_deque->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+/*
+    function    其他线程从双端队列top端窃取任务，先进先出
+    in          p_deque             双端队列指针
+    out         p_task              窃取的任务
+    ret         1 窃取成功，0 队列为空，-1 与其他线程竞争失败，可重试
+*/
+static int task_deque_steal(task_deque_t *p_deque, task_t *p_task)
+{
+    long t = atomic_load_explicit(&p_deque->top, memory_order_acquire);
+    long b = 0;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&p_deque->bottom, memory_order_acquire);
+    if(t >= b)
+    {
+        return 0;
+    }
+
+    /* 先读任务再CAS，CAS失败时读到的任务作废 */
+    p_task->task_func = __atomic_load_n(&p_deque->tasks[t & p_deque->mask].task_func, __ATOMIC_RELAXED);
+    p_task->arg = __atomic_load_n(&p_deque->tasks[t & p_deque->mask].arg, __ATOMIC_RELAXED);
+    if(!atomic_compare_exchange_strong_explicit(&p_deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+    function    窃取模式下查找任务：先取自己的双端队列，再取共享队列，最后依次窃取其他线程
+    in          pool                线程池指针
+                index               当前线程编号
+    out         p_task              找到的任务
+    ret         1 找到任务，0 所有队列都为空
+*/
+static int task_find(thread_pool_t *pool, int index, task_t *p_task)
+{
+    int count = pool->free_thread_count;
+    int victim = 0;
+    int retry = 0;
+    int ret = 0;
+    int i = 0;
+
+    if(task_deque_take(&pool->deques[index], p_task))
+    {
+        return 1;
+    }
+
+    if(task_queue_pop(pool, p_task))
+    {
+        return 1;
+    }
+
+    do
+    {
+        retry = 0;
+        for(i = 1; i < count; ++i)
+        {
+            victim = (index + i) % count;
+            ret = task_deque_steal(&pool->deques[victim], p_task);
+            if(1 == ret)
+            {
+                return 1;
+            }
+            if(-1 == ret)
+            {
+                retry = 1;
+            }
+        }
+    }while(retry);
+
+    return 0;
+}
+
+/*
+    function    工作线程取下一个任务，共享模式取共享队列，窃取模式依次查找各队列
+    in          pool                线程池指针
+    out         p_task              取出的任务
+    ret         1 取出成功，0 没有任务
+*/
+static int task_next(thread_pool_t *pool, task_t *p_task)
+{
+    if(THREAD_POOL_MODE_STEALING == pool->mode)
+    {
+        return task_find(pool, tls_worker, p_task);
+    }
 
-        /* 取出任务 */
-        p_task = pool->task_queue->next;
-        pool->task_queue->next = p_task->next;
-        pthread_mutex_unlock(pool->mutex);
+    return task_queue_pop(pool, p_task);
+}
 
-        /* 执行任务，负责free */
-        if(p_task && p_task->task_func)
+/*
+    function    按新增任务数唤醒空闲线程，最多唤醒当前空闲的线程数，没有空闲线程时不进入内核
+    in          pool                线程池指针
+                count               新增任务数
+    out
+    ret
+*/
+static void thread_pool_wake(thread_pool_t *pool, int count)
+{
+    int idle = 0;
+
+    /* 先发布任务再读空闲数，与工作线程先登记空闲再复查队列配对，不会丢失唤醒 */
+    atomic_thread_fence(memory_order_seq_cst);
+    idle = atomic_load_explicit(&pool->idle_count, memory_order_relaxed);
+    if(count > idle)
+    {
+        count = idle;
+    }
+
+    while(count-- > 0)
+    {
+        sem_post(pool->sem);
+    }
+}
+
+static void *thread_worker(void *p_pool)
+{
+    task_t task = {};
+    thread_pool_t *pool = NULL;
+
+    PFM_ENSURE_RET(NULL != p_pool, NULL);
+    pool = (thread_pool_t *)p_pool;
+
+    tls_pool = pool;
+    tls_worker = atomic_fetch_add(&pool->worker_seq, 1);
+
+    while(!atomic_load(&pool->shutdown))    /* 循环处理任务 */
+    {
+        /* 有任务时不经过信号量连续执行 */
+        if(task_next(pool, &task))
         {
             DBG("Thread %ld executing task", pthread_self());
-            p_task->task_func(p_task->arg);
-            free(p_task);
+            task.task_func(task.arg);
+            continue;
+        }
+
+        /* 先登记空闲再复查队列，复查之后提交的任务必然看到本线程空闲并唤醒 */
+        atomic_fetch_add_explicit(&pool->idle_count, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(task_next(pool, &task))
+        {
+            atomic_fetch_sub_explicit(&pool->idle_count, 1, memory_order_relaxed);
+            task.task_func(task.arg);
+            continue;
         }
+
+        /* 等待唤醒，多余的唤醒只会空找一次 */
+        while(0 != sem_wait(pool->sem) && EINTR == errno);
+        atomic_fetch_sub_explicit(&pool->idle_count, 1, memory_order_relaxed);
     }
 
+    DBG("Thread %ld exit for destroy thread pool", pthread_self());
     return NULL;
 }
 
+/*
+    function    释放窃取模式的双端队列
+    in          p_pool              线程池指针
+    out
+    ret
+*/
+static void task_deques_free(thread_pool_t *p_pool)
+{
+    int i = 0;
+
+    if(NULL == p_pool->deques)
+    {
+        return;
+    }
+
+    for(i = 0; i < p_pool->free_thread_count; ++i)
+    {
+        free(p_pool->deques[i].tasks);
+    }
+    free(p_pool->deques);
+    p_pool->deques = NULL;
+}
+
 /*
     function    线程池初始化
     in
@@ -67,6 +377,23 @@ static void *thread_worker(void *p_pool)
 */
 ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queue_size)
 {
+    return thread_pool_init_mode(p_pool, thread_count, task_queue_size, THREAD_POOL_MODE_SHARED);
+}
+
+/*
+    function    按指定调度模式初始化线程池
+    in
+                p_pool              线程池指针
+                thread_count        工作线程数量
+                task_queue_size     任务队列大小，窃取模式下也是每个线程双端队列的大小
+                mode                调度模式
+    out
+    ret         errCode
+*/
+ERR_CODE thread_pool_init_mode(thread_pool_t *p_pool, int thread_count, int task_queue_size, thread_pool_mode_t mode)
+{
+    int queue_size = 1;
+    int created = 0;
     int i = 0;
 
     /* 参数检查 */
@@ -74,6 +401,8 @@ ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queu
     PFM_ENSURE_RET(0 < thread_count, ERR_BAD_PARAM);
     PFM_ENSURE_RET(0 < task_queue_size, ERR_BAD_PARAM);
 
+    memset(p_pool, 0, sizeof(thread_pool_t));
+
     /* 申请线程数组空间 */
     p_pool->pthreads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
     if(NULL == p_pool->pthreads)
@@ -84,36 +413,62 @@ ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queu
     memset(p_pool->pthreads, 0, sizeof(pthread_t) * thread_count);
     p_pool->free_thread_count = thread_count;
 
-    /* 申请线程池锁空间 */
-    p_pool->mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    if(NULL == p_pool->mutex)
+    /* 申请信号量空间 */
+    p_pool->sem = (sem_t *)malloc(sizeof(sem_t));
+    if(NULL == p_pool->sem)
     {
-        DBG_ERR("malloc for pthread mutex");
+        DBG_ERR("malloc for sem");
         goto err;
     }
-    /* 初始化线程池锁 */
-    pthread_mutex_init(p_pool->mutex, NULL);
+    /* 初始化信号量 */
+    sem_init(p_pool->sem, 0, 0);
 
-    /* 申请线程池条件变量空间 */
-    p_pool->cond = (pthread_cond_t*)malloc(sizeof(pthread_cond_t));
-    if(NULL == p_pool->cond)
+    /* 任务队列，预分配环形数组，容量向上取整为2的幂，下标按掩码取模 */
+    while(queue_size < task_queue_size)
     {
-        DBG_ERR("malloc for pthread cond");
-        goto err;
+        queue_size <<= 1;
     }
-    /* 初始化线程池条件变量 */
-    pthread_cond_init(p_pool->cond, NULL);
-
-    /* 任务队列，使用链表实现，线程池维护一个头节点 */
-    p_pool->task_queue = (task_t *)malloc(sizeof(task_t));
+    p_pool->task_queue = (task_slot_t *)aligned_alloc(THREAD_POOL_CACHE_LINE, sizeof(task_slot_t) * queue_size);
     if(NULL == p_pool->task_queue)
     {
         DBG_ERR("malloc for task queue");
         goto err;
     }
-    memset(p_pool->task_queue, 0, sizeof(task_t));
+    memset(p_pool->task_queue, 0, sizeof(task_slot_t) * queue_size);
+    for(i = 0; i < queue_size; ++i)
+    {
+        atomic_init(&p_pool->task_queue[i].seq, i);
+    }
+    p_pool->task_queue_size = queue_size;
+    atomic_init(&p_pool->enqueue_pos, 0);
+    atomic_init(&p_pool->dequeue_pos, 0);
+
+    /* 窃取模式下每个线程一个双端队列 */
+    p_pool->mode = mode;
+    atomic_init(&p_pool->worker_seq, 0);
+    atomic_init(&p_pool->idle_count, 0);
+    if(THREAD_POOL_MODE_STEALING == mode)
+    {
+        p_pool->deques = (task_deque_t *)aligned_alloc(THREAD_POOL_CACHE_LINE, sizeof(task_deque_t) * thread_count);
+        if(NULL == p_pool->deques)
+        {
+            DBG_ERR("malloc for task deques");
+            goto err;
+        }
+        memset(p_pool->deques, 0, sizeof(task_deque_t) * thread_count);
+        for(i = 0; i < thread_count; ++i)
+        {
+            p_pool->deques[i].tasks = (task_t *)calloc(queue_size, sizeof(task_t));
+            if(NULL == p_pool->deques[i].tasks)
+            {
+                DBG_ERR("malloc for task deque %d", i);
+                goto err;
+            }
+            p_pool->deques[i].mask = queue_size - 1;
+        }
+    }
 
-    p_pool->shutdown = 0;       /* 销毁标志0 */
+    atomic_init(&p_pool->shutdown, 0);       /* 销毁标志0 */
 
     /* 线程池线程工作 */
     for(i = 0; i < thread_count; ++ i)
@@ -124,27 +479,36 @@ ERR_CODE thread_pool_init(thread_pool_t *p_pool, int thread_count, int task_queu
             DBG_ERR("create thread %d failed", i);
             goto err;
         }
+        created++;
     }
 
-    DBG("create thread pool success");
+    DBG("create thread pool success, mode %d, task queue size %d", mode, queue_size);
 
     return ERR_NO_ERROR;
 err:
 
-    if(p_pool->pthreads)    free(p_pool->pthreads);
-    if(p_pool->mutex)       free(p_pool->mutex);
-    if(p_pool->task_queue)  free(p_pool->task_queue);
-    if(p_pool->cond)        free(p_pool->cond);
+    /* 唤醒并回收已创建的线程 */
+    atomic_store(&p_pool->shutdown, 1);
+    for(i = 0; i < created; ++i)
+    {
+        sem_post(p_pool->sem);
+    }
+    for(i = 0; i < created; ++i)
+    {
+        pthread_join(p_pool->pthreads[i], NULL);
+    }
 
-    for(i = 0; i < thread_count; ++i)
+    if(p_pool->pthreads)    free(p_pool->pthreads);
+    if(p_pool->sem)
     {
-        if(p_pool->pthreads[i])
-        {
-            pthread_cancel(p_pool->pthreads[i]);  // 取消已创建的线程
-        }
+        sem_destroy(p_pool->sem);
+        free(p_pool->sem);
     }
+    if(p_pool->task_queue)  free(p_pool->task_queue);
+    task_deques_free(p_pool);
 
     memset(p_pool, 0, sizeof(thread_pool_t));
+    atomic_store(&p_pool->shutdown, 1);
 
     return ERR_THREAD_POOL_INIT;
 }
@@ -160,17 +524,20 @@ ERR_CODE thread_pool_destroy(thread_pool_t *p_pool)
 {
     PFM_ENSURE_RET(NULL != p_pool, ERR_BAD_PARAM);
 
-    if(p_pool->shutdown)
+    if(atomic_load(&p_pool->shutdown) || NULL == p_pool->sem)
     {
         DBG_ERR("thread pool already shutdown");
         return ERR_NO_ERROR;  /* 已经销毁 */
     }
 
     /* 设置销毁标志 */
-    p_pool->shutdown = 1;
+    atomic_store(&p_pool->shutdown, 1);
 
     /* 唤醒所有线程 */
-    pthread_cond_broadcast(p_pool->cond);
+    for(int i = 0; i < p_pool->free_thread_count; ++i)
+    {
+        sem_post(p_pool->sem);
+    }
 
     for(int i = 0; i < p_pool->free_thread_count; ++i)
     {
@@ -182,10 +549,15 @@ ERR_CODE thread_pool_destroy(thread_pool_t *p_pool)
 
     /* 释放资源 */
     if(p_pool->pthreads)    free(p_pool->pthreads);
-    if(p_pool->mutex)       free(p_pool->mutex);
+    if(p_pool->sem)
+    {
+        sem_destroy(p_pool->sem);
+        free(p_pool->sem);
+    }
     if(p_pool->task_queue)  free(p_pool->task_queue);
-    if(p_pool->cond)        free(p_pool->cond);
+    task_deques_free(p_pool);
     memset(p_pool, 0, sizeof(thread_pool_t));  /* 清空线程池 */
+    atomic_store(&p_pool->shutdown, 1);
 
     DBG("thread pool destroyed");
 
@@ -193,52 +565,204 @@ ERR_CODE thread_pool_destroy(thread_pool_t *p_pool)
 }
 
 /*
-    function    线程池添加任务
+    function    线程池添加任务，不阻塞
     in
                 p_pool              线程池指针
                 task_func           任务函数
                 arg                 任务函数参数
     out
-    ret         errCode
+    ret         errCode，队列已满时返回ERR_THREAD_POOL_FULL，任务未被接收，由调用者决定丢弃或自行执行
 */
 ERR_CODE thread_pool_add_task(thread_pool_t *p_pool, void (*task_func)(void *arg), void *arg)
 {
-    task_t *p_task = NULL;
+    task_t task = {};
 
     /* 参数检查 */
     PFM_ENSURE_RET(NULL != p_pool, ERR_BAD_PARAM);
     PFM_ENSURE_RET(NULL != task_func, ERR_BAD_PARAM);
 
-    /* 申请任务空间 */
-    p_task = (task_t *)malloc(sizeof(task_t));
-    if(NULL == p_task)
+    /* 设置任务 */
+    task.task_func = task_func;
+    task.arg = arg;
+
+    return thread_pool_add_tasks(p_pool, &task, 1, NULL);
+}
+
+/*
+    function    线程池批量添加任务，不阻塞；一次占用共享队列中的连续槽位，按需要的线程数唤醒
+    in
+                p_pool              线程池指针
+                p_tasks             任务数组
+                count               任务数量
+    out         p_added             实际添加的任务数，为p_tasks的前缀，可为NULL
+    ret         errCode，队列已满时返回ERR_THREAD_POOL_FULL，未添加的任务由调用者决定丢弃或自行执行
+*/
+ERR_CODE thread_pool_add_tasks(thread_pool_t *p_pool, const task_t *p_tasks, int count, int *p_added)
+{
+    int added = 0;
+    int n = 0;
+
+    /* 参数检查 */
+    PFM_ENSURE_RET(NULL != p_pool, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(NULL != p_tasks && 0 <= count, ERR_BAD_PARAM);
+
+    /* 窃取模式下池内线程提交的任务压入自己的双端队列，满时退回共享队列 */
+    if(THREAD_POOL_MODE_STEALING == p_pool->mode && tls_pool == p_pool)
     {
-        DBG_ERR("malloc for task");
-        return ERR_NO_MEMORY;
+        while(added < count && task_deque_push(&p_pool->deques[tls_worker], &p_tasks[added]))
+        {
+            added++;
+        }
     }
-    memset(p_task, 0, sizeof(task_t));
 
-    /* 设置任务 */
-    p_task->task_func = task_func;
-    p_task->arg = arg;
+    /* 其余任务分批放入共享队列，每批占用当前已空闲的连续槽位，队列已满时停止 */
+    while(added < count && 0 < (n = task_queue_push_batch(p_pool, p_tasks + added, count - added)))
+    {
+        added += n;
+    }
 
-    /* 锁定线程池 */
-    pthread_mutex_lock(p_pool->mutex);
+    /* 唤醒空闲线程处理任务，没有空闲线程时不进入内核 */
+    thread_pool_wake(p_pool, added);
 
-    /* 将任务添加到队列 */
-    p_task->next = p_pool->task_queue->next;
-    p_pool->task_queue->next = p_task;
+    if(NULL != p_added)
+    {
+        *p_added = added;
+    }
 
-    /* 唤醒一个线程处理任务 */
-    pthread_cond_signal(p_pool->cond);
+    if(added < count)
+    {
+        DBG("thread pool task queue full, %d of %d tasks added", added, count);
+        return ERR_THREAD_POOL_FULL;
+    }
 
-    pthread_mutex_unlock(p_pool->mutex);
+    DBG("%d tasks added to thread pool", count);
 
-    DBG("task added to thread pool");
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    串行执行器初始化
+    in
+                p_strand            串行执行器指针
+                p_pool              执行任务的线程池
+    out
+    ret         errCode
+*/
+ERR_CODE thread_strand_init(thread_strand_t *p_strand, thread_pool_t *p_pool)
+{
+    PFM_ENSURE_RET(NULL != p_strand && NULL != p_pool, ERR_BAD_PARAM);
+
+    p_strand->p_pool = p_pool;
+    mpsc_queue_init(&p_strand->queue);
+    atomic_init(&p_strand->pending, 0);
 
     return ERR_NO_ERROR;
 }
 
+/*
+    function    串行执行器的执行函数，同一时刻每个执行器至多一个线程在执行
+    in
+                arg                 串行执行器指针
+    out
+    ret
+*/
+static void thread_strand_run(void *arg)
+{
+    thread_strand_t *p_strand = (thread_strand_t *)arg;
+    thread_strand_task_t *p_node = NULL;
+    task_t task = {};
+    int count = 0;
+
+    while(1)
+    {
+        /* pending不为0时队列中必有任务，提交者入队尚未完成时pop会等待 */
+        p_node = (thread_strand_task_t *)mpsc_queue_pop(&p_strand->queue);
+        if(NULL == p_node)
+        {
+            sched_yield();
+            continue;
+        }
+        task = p_node->task;    /* 任务执行后节点可能已被释放 */
+        task.task_func(task.arg);
+
+        /* 最后一个任务执行完，执行器回到空闲，此后不能再访问执行器 */
+        if(1 == atomic_fetch_sub_explicit(&p_strand->pending, 1, memory_order_acq_rel))
+        {
+            return;
+        }
+
+        /* 连续执行过多时让出线程，重新排队，排队失败则继续执行 */
+        if(++count >= THREAD_POOL_STRAND_BATCH)
+        {
+            count = 0;
+            if(ERR_NO_ERROR == thread_pool_add_task(p_strand->p_pool, thread_strand_run, p_strand))
+            {
+                return;
+            }
+        }
+    }
+}
+
+/*
+    function    向串行执行器提交任务，不阻塞；执行器空闲时将其调度到线程池，线程池队列满时在调用线程中执行
+    in
+                p_strand            串行执行器指针
+                p_node              任务节点，任务执行完之前调用者不能释放
+                task_func           任务函数
+                arg                 任务函数参数
+    out
+    ret         errCode
+*/
+ERR_CODE thread_strand_add_task(thread_strand_t *p_strand, thread_strand_task_t *p_node, void (*task_func)(void *arg), void *arg)
+{
+    task_t run = {};
+
+    /* 参数检查 */
+    PFM_ENSURE_RET(NULL != p_strand && NULL != p_node, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(NULL != task_func, ERR_BAD_PARAM);
+
+    /* 执行器正在执行，任务由当前执行者按顺序取出 */
+    if(!thread_strand_push(p_strand, p_node, task_func, arg, &run))
+    {
+        return ERR_NO_ERROR;
+    }
+
+    /* 执行器空闲，调度执行；线程池队列满时在调用线程中执行，形成背压 */
+    if(ERR_NO_ERROR != thread_pool_add_task(p_strand->p_pool, run.task_func, run.arg))
+    {
+        run.task_func(run.arg);
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    向串行执行器加入任务但不调度，用于批量提交
+    in
+                p_strand            串行执行器指针
+                p_node              任务节点，任务执行完之前调用者不能释放
+                task_func           任务函数
+                arg                 任务函数参数
+    out         p_run               执行器由空闲转为活跃时，需要提交到线程池的执行任务
+    ret         1 调用者需要提交p_run（提交失败时应在调用线程中执行），0 执行器已在执行
+*/
+int thread_strand_push(thread_strand_t *p_strand, thread_strand_task_t *p_node, void (*task_func)(void *arg), void *arg, task_t *p_run)
+{
+    p_node->task.task_func = task_func;
+    p_node->task.arg = arg;
+    mpsc_queue_push(&p_strand->queue, &p_node->node);
+
+    if(0 != atomic_fetch_add_explicit(&p_strand->pending, 1, memory_order_acq_rel))
+    {
+        return 0;
+    }
+
+    p_run->task_func = thread_strand_run;
+    p_run->arg = p_strand;
+
+    return 1;
+}
+
 /*
 
 ========================
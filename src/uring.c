@@ -0,0 +1,374 @@
+/*
+    Include files
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/*
+    Function definitions
+*/
+
+/*
+    function    创建io_uring实例并映射提交与完成队列，内核不支持所需特性时失败
+    in          p_ring          io_uring实例指针
+                entries         提交队列长度，完成队列为其4倍
+    out
+    ret         errCode
+*/
+ERR_CODE uring_init(IN uring_t *p_ring, IN unsigned entries)
+{
+    struct io_uring_params params = {};
+    char *sq = NULL;
+    char *cq = NULL;
+
+    PFM_ENSURE_RET(NULL != p_ring && 0 < entries, ERR_BAD_PARAM);
+
+    memset(p_ring, 0, sizeof(uring_t));
+    p_ring->ring_fd = -1;
+
+    /* 多连接同时完成时完成项远多于提交项，完成队列放大避免溢出 */
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    p_ring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(-1 == p_ring->ring_fd)
+    {
+        DBG_ERR("io_uring_setup failed, errno %d", errno);
+        return ERR_URING_INIT;
+    }
+
+    /* 等待时的超时依赖EXT_ARG */
+    if(!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        DBG_ERR("io_uring lacks IORING_FEAT_EXT_ARG");
+        goto err;
+    }
+
+    p_ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    p_ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        p_ring->sq_len = p_ring->sq_len > p_ring->cq_len ? p_ring->sq_len : p_ring->cq_len;
+        p_ring->cq_len = p_ring->sq_len;
+    }
+
+    p_ring->sq_ptr = mmap(NULL, p_ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->ring_fd, IORING_OFF_SQ_RING);
+    if(MAP_FAILED == p_ring->sq_ptr)
+    {
+        p_ring->sq_ptr = NULL;
+        DBG_ERR("mmap io_uring sq ring failed");
+        goto err;
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        p_ring->cq_ptr = p_ring->sq_ptr;
+    }
+    else
+    {
+        p_ring->cq_ptr = mmap(NULL, p_ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->ring_fd, IORING_OFF_CQ_RING);
+        if(MAP_FAILED == p_ring->cq_ptr)
+        {
+            p_ring->cq_ptr = NULL;
+            DBG_ERR("mmap io_uring cq ring failed");
+            goto err;
+        }
+    }
+
+    p_ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_ring->sqes = (struct io_uring_sqe *)mmap(NULL, p_ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->ring_fd, IORING_OFF_SQES);
+    if(MAP_FAILED == (void *)p_ring->sqes)
+    {
+        p_ring->sqes = NULL;
+        DBG_ERR("mmap io_uring sqes failed");
+        goto err;
+    }
+
+    sq = (char *)p_ring->sq_ptr;
+    p_ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    p_ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    p_ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    p_ring->sq_entries = params.sq_entries;
+    p_ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    p_ring->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    p_ring->sqe_tail = *(p_ring->sq_tail);
+
+    cq = (char *)p_ring->cq_ptr;
+    p_ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    p_ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    p_ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    p_ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return ERR_NO_ERROR;
+
+err:
+    uring_destroy(p_ring);
+    return ERR_URING_INIT;
+}
+
+/*
+    function    销毁io_uring实例，内核取消所有在途请求
+    in          p_ring          io_uring实例指针
+    out
+    ret
+*/
+void uring_destroy(IN uring_t *p_ring)
+{
+    if(NULL == p_ring)
+    {
+        return;
+    }
+
+    if(NULL != p_ring->sqes)
+    {
+        munmap(p_ring->sqes, p_ring->sqes_len);
+    }
+    if(NULL != p_ring->cq_ptr && p_ring->cq_ptr != p_ring->sq_ptr)
+    {
+        munmap(p_ring->cq_ptr, p_ring->cq_len);
+    }
+    if(NULL != p_ring->sq_ptr)
+    {
+        munmap(p_ring->sq_ptr, p_ring->sq_len);
+    }
+    if(-1 != p_ring->ring_fd)
+    {
+        close(p_ring->ring_fd);
+    }
+
+    memset(p_ring, 0, sizeof(uring_t));
+    p_ring->ring_fd = -1;
+}
+
+/*
+    function    获取一个空闲提交项，内容已清零，提交队列满时返回NULL，调用者先提交再重试
+    in          p_ring          io_uring实例指针
+    out
+    ret         提交项指针
+*/
+struct io_uring_sqe *uring_get_sqe(IN uring_t *p_ring)
+{
+    unsigned head = __atomic_load_n(p_ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned index = 0;
+    struct io_uring_sqe *p_sqe = NULL;
+
+    if(p_ring->sqe_tail - head >= p_ring->sq_entries)
+    {
+        return NULL;
+    }
+
+    index = p_ring->sqe_tail & p_ring->sq_mask;
+    p_sqe = &(p_ring->sqes[index]);
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    p_ring->sq_array[index] = index;
+    p_ring->sqe_tail++;
+
+    return p_sqe;
+}
+
+/*
+    function    提交所有已填写的提交项，并等待至少wait_nr个完成项或超时
+    in          p_ring          io_uring实例指针
+                wait_nr         等待的完成项数量，0表示只提交不等待
+                timeout_ms      等待超时，毫秒，-1表示一直等待
+    out
+    ret         errCode，超时与被信号打断也返回ERR_NO_ERROR
+*/
+ERR_CODE uring_submit_and_wait(IN uring_t *p_ring, IN unsigned wait_nr, IN int timeout_ms)
+{
+    struct io_uring_getevents_arg arg = {};
+    struct __kernel_timespec ts = {};
+    unsigned to_submit = 0;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    int ret = 0;
+
+    /* 发布已填写的提交项，内核未消费的提交项下次一并提交 */
+    __atomic_store_n(p_ring->sq_tail, p_ring->sqe_tail, __ATOMIC_RELEASE);
+    to_submit = p_ring->sqe_tail - __atomic_load_n(p_ring->sq_head, __ATOMIC_ACQUIRE);
+
+    /* 完成队列溢出时需要进入内核取回溢出的完成项 */
+    if(0 < wait_nr || (__atomic_load_n(p_ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    if(0 == to_submit && !(flags & IORING_ENTER_GETEVENTS))
+    {
+        return ERR_NO_ERROR;
+    }
+
+    arg.sigmask_sz = _NSIG / 8;
+    if(0 <= timeout_ms)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (unsigned long long)(unsigned long)&ts;
+    }
+
+    ret = (int)syscall(__NR_io_uring_enter, p_ring->ring_fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    if(-1 == ret && ETIME != errno && EINTR != errno && EBUSY != errno && EAGAIN != errno)
+    {
+        DBG_ERR("io_uring_enter failed, errno %d", errno);
+        return ERR_URING_INIT;
+    }
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    查看下一个完成项，处理完后调用uring_cqe_seen
+    in          p_ring          io_uring实例指针
+    out
+    ret         完成项指针，没有完成项时返回NULL
+*/
+struct io_uring_cqe *uring_peek_cqe(IN uring_t *p_ring)
+{
+    unsigned head = *(p_ring->cq_head);
+
+    if(head == __atomic_load_n(p_ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    return &(p_ring->cqes[head & p_ring->cq_mask]);
+}
+
+/*
+    function    归还已处理的完成项
+    in          p_ring          io_uring实例指针
+    out
+    ret
+*/
+void uring_cqe_seen(IN uring_t *p_ring)
+{
+    __atomic_store_n(p_ring->cq_head, *(p_ring->cq_head) + 1, __ATOMIC_RELEASE);
+}
+
+/*
+    function    把缓冲区放入描述环，调用者随后发布环尾
+    in          p_buf_ring      缓冲区环指针
+                bid             缓冲区编号
+    out
+    ret
+*/
+static void uring_buf_ring_add(IN uring_buf_ring_t *p_buf_ring, IN unsigned bid)
+{
+    struct io_uring_buf *p_buf = &(p_buf_ring->p_ring->bufs[p_buf_ring->tail & (p_buf_ring->entries - 1)]);
+
+    p_buf->addr = (unsigned long long)(unsigned long)(p_buf_ring->bufs + (size_t)bid * p_buf_ring->buf_size);
+    p_buf->len = p_buf_ring->buf_size;
+    p_buf->bid = (unsigned short)bid;
+    p_buf_ring->tail++;
+}
+
+/*
+    function    创建接收缓冲区环并注册到io_uring
+    in          p_ring          io_uring实例指针
+                p_buf_ring      缓冲区环指针
+                bgid            缓冲区组编号
+                entries         缓冲区数量，2的幂
+                buf_size        单个缓冲区大小
+    out
+    ret         errCode
+*/
+ERR_CODE uring_buf_ring_init(IN uring_t *p_ring, IN uring_buf_ring_t *p_buf_ring, IN int bgid, IN unsigned entries, IN int buf_size)
+{
+    struct io_uring_buf_reg reg = {};
+    unsigned i = 0;
+
+    PFM_ENSURE_RET(NULL != p_ring && NULL != p_buf_ring, ERR_BAD_PARAM);
+    PFM_ENSURE_RET(0 < entries && 0 == (entries & (entries - 1)) && 32768 >= entries && 0 < buf_size, ERR_BAD_PARAM);
+
+    memset(p_buf_ring, 0, sizeof(uring_buf_ring_t));
+    p_buf_ring->entries = entries;
+    p_buf_ring->buf_size = buf_size;
+    p_buf_ring->bgid = bgid;
+
+    /* 描述环必须页对齐 */
+    p_buf_ring->ring_len = entries * sizeof(struct io_uring_buf);
+    p_buf_ring->p_ring = (struct io_uring_buf_ring *)mmap(NULL, p_buf_ring->ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == (void *)p_buf_ring->p_ring)
+    {
+        p_buf_ring->p_ring = NULL;
+        DBG_ERR("mmap io_uring buffer ring failed");
+        return ERR_NO_MEMORY;
+    }
+
+    p_buf_ring->bufs = (char *)malloc((size_t)entries * buf_size);
+    if(NULL == p_buf_ring->bufs)
+    {
+        DBG_ERR("malloc for io_uring buffers");
+        uring_buf_ring_destroy(p_buf_ring);
+        return ERR_NO_MEMORY;
+    }
+
+    reg.ring_addr = (unsigned long long)(unsigned long)p_buf_ring->p_ring;
+    reg.ring_entries = entries;
+    reg.bgid = (unsigned short)bgid;
+    if(0 != syscall(__NR_io_uring_register, p_ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    {
+        DBG_ERR("register io_uring buffer ring failed, errno %d", errno);
+        uring_buf_ring_destroy(p_buf_ring);
+        return ERR_URING_INIT;
+    }
+
+    for(i = 0; i < entries; ++i)
+    {
+        uring_buf_ring_add(p_buf_ring, i);
+    }
+    __atomic_store_n(&(p_buf_ring->p_ring->tail), p_buf_ring->tail, __ATOMIC_RELEASE);
+
+    return ERR_NO_ERROR;
+}
+
+/*
+    function    释放接收缓冲区环，在io_uring销毁后调用
+    in          p_buf_ring      缓冲区环指针
+    out
+    ret
+*/
+void uring_buf_ring_destroy(IN uring_buf_ring_t *p_buf_ring)
+{
+    if(NULL == p_buf_ring)
+    {
+        return;
+    }
+
+    if(NULL != p_buf_ring->p_ring)
+    {
+        munmap(p_buf_ring->p_ring, p_buf_ring->ring_len);
+    }
+    free(p_buf_ring->bufs);
+    memset(p_buf_ring, 0, sizeof(uring_buf_ring_t));
+}
+
+/*
+    function    取得内核选中的缓冲区
+    in          p_buf_ring      缓冲区环指针
+                bid             完成项中的缓冲区编号
+    out
+    ret         缓冲区指针
+*/
+char *uring_buf_ring_get(IN uring_buf_ring_t *p_buf_ring, IN unsigned bid)
+{
+    return p_buf_ring->bufs + (size_t)bid * p_buf_ring->buf_size;
+}
+
+/*
+    function    数据取走后把缓冲区归还给内核
+    in          p_buf_ring      缓冲区环指针
+                bid             缓冲区编号
+    out
+    ret
+*/
+void uring_buf_ring_recycle(IN uring_buf_ring_t *p_buf_ring, IN unsigned bid)
+{
+    uring_buf_ring_add(p_buf_ring, bid);
+    __atomic_store_n(&(p_buf_ring->p_ring->tail), p_buf_ring->tail, __ATOMIC_RELEASE);
+}